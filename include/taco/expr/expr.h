@@ -80,6 +80,10 @@ public:
   /// and execute it's expression.
   const Schedule& getSchedule() const;
 
+  /// Set the parallel loop schedule of the tensor var. Operator splits are
+  /// part of the index expression, so they are not copied from the schedule.
+  void setSchedule(const Schedule& schedule);
+
   /// Assign an index expression to the tensor var, with the given free vars
   /// denoting the indexing on the left-hand-side.
   void setIndexExpression(std::vector<IndexVar> freeVars, IndexExpr indexExpr,
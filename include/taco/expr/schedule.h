@@ -3,6 +3,7 @@
 
 #include <memory>
 #include <vector>
+#include <ostream>
 
 namespace taco {
 
@@ -28,6 +29,26 @@ private:
 std::ostream& operator<<(std::ostream&, const OperatorSplit&);
 
 
+/// The policies for distributing the iterations of parallel loops to threads.
+enum class ParallelSchedule {
+  /// Static scheduling for loops with dense bodies and dynamic scheduling
+  /// with chunk size 16 for loops over sparse sub-tensors.
+  Default,
+
+  /// OpenMP static, dynamic and guided scheduling.
+  Static, Dynamic, Guided,
+
+  /// Split the loop into one contiguous block per thread, such that every
+  /// block covers about the same number of nonzeros of the sparse level
+  /// below the loop. Falls back to static scheduling if there is no such
+  /// level.
+  Balanced
+};
+
+/// Print a parallel schedule.
+std::ostream& operator<<(std::ostream&, const ParallelSchedule&);
+
+
 /// A schedule controls code generation and determines how index expression
 /// should be computed.
 class Schedule {
@@ -46,6 +67,18 @@ public:
   /// Removes operator splits from the schedule.
   void clearOperatorSplits();
 
+  /// Set how the iterations of parallel loops are distributed to threads. A
+  /// chunk size of zero selects the default chunk size of the policy. The
+  /// chunk size is ignored by balanced scheduling.
+  void setParallelSchedule(ParallelSchedule parallelSchedule,
+                           int chunkSize=0);
+
+  /// Returns the parallel loop scheduling policy.
+  ParallelSchedule getParallelSchedule() const;
+
+  /// Returns the chunk size of parallel loops, or zero for the default.
+  int getChunkSize() const;
+
 private:
   struct Content;
   std::shared_ptr<Content> content;
@@ -475,7 +475,7 @@ public:
   static const IRNodeType _type_info = IRNodeType::Case;
 };
 
-enum class LoopKind {Serial, Static, Dynamic, Vectorized};
+enum class LoopKind {Serial, Static, Dynamic, Guided, Balanced, Vectorized};
 
 /** A for loop from start to end by increment.
  * A vectorized loop will require the increment to be 1 and the
@@ -484,6 +484,12 @@ enum class LoopKind {Serial, Static, Dynamic, Vectorized};
  * If the loop is vectorized, the width says which vector width
  * to use.  By default (0), it will not set a specific width and
  * let clang determine the width to use.
+ *
+ * If the loop is parallel, the chunk size says how many iterations
+ * to schedule at a time.  By default (0), the OpenMP default is used.
+ * A balanced loop splits its iterations into one block per thread,
+ * such that each block covers the same number of entries of the
+ * balance_pos array (the pos array of the level below the loop).
  */
 struct For : public StmtNode<For> {
 public:
@@ -494,10 +500,13 @@ public:
   Stmt contents;
   LoopKind kind;
   int vec_width;  // vectorization width
+  int chunk_size; // parallel chunk size
+  Expr balance_pos;
   
   static Stmt make(Expr var, Expr start, Expr end, Expr increment,
                    Stmt contents, LoopKind kind=LoopKind::Serial,
-                   int vec_width=0);
+                   int vec_width=0, int chunk_size=0,
+                   Expr balance_pos=Expr());
   
   static const IRNodeType _type_info = IRNodeType::For;
 };
@@ -0,0 +1,16 @@
+#ifndef TACO_PARALLEL_H
+#define TACO_PARALLEL_H
+
+namespace taco {
+
+/// Set the number of threads that parallel kernels run with. The default is
+/// given by the TACO_NUM_THREADS environment variable, or the number of
+/// hardware threads if it is not set. Kernels only run in parallel if the C
+/// compiler supports OpenMP.
+void setNumThreads(int numThreads);
+
+/// Get the number of threads that parallel kernels run with.
+int getNumThreads();
+
+}
+#endif
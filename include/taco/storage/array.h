@@ -23,6 +23,11 @@ public:
   /// Construct an array of elements of the given type.
   Array(DataType type, void* data, size_t size, Policy policy=Free);
 
+  /// Construct an array of elements of the given type that lie in memory
+  /// owned by `owner`, such as a memory mapped file. The array does not free
+  /// the data, but keeps the owner alive for as long as the array exists.
+  Array(DataType type, void* data, size_t size, std::shared_ptr<void> owner);
+
   /// Returns the type of the array elements
   const DataType& getType() const;
 
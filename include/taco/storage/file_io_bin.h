@@ -0,0 +1,36 @@
+/// Read and write the taco binary tensor format. A binary tensor file stores
+/// a packed tensor as it is laid out in memory: a header with the component
+/// type, dimensions and format, followed by every index array and the value
+/// array, each aligned to 64 bytes. Reading a file memory maps it and wraps
+/// the arrays in place, so a packed tensor is loaded without parsing or
+/// copying it. Files are written in the byte order of the machine.
+
+#ifndef TACO_FILE_IO_BIN_H
+#define TACO_FILE_IO_BIN_H
+
+#include <istream>
+#include <ostream>
+#include <string>
+
+namespace taco {
+class TensorBase;
+class Format;
+
+/// Read a binary tensor from a file by memory mapping it. Tensors stored in a
+/// format other than `format` are converted to it. Binary tensors are always
+/// packed, so `pack` is ignored. The header, positions and coordinates of the
+/// file are validated before its arrays are used, so corrupt files are
+/// rejected.
+TensorBase readBIN(std::string filename, const Format& format, bool pack=true);
+
+/// Read a binary tensor from a stream, copying it into memory.
+TensorBase readBIN(std::istream& stream, const Format& format, bool pack=true);
+
+/// Write a binary tensor to a file.
+void writeBIN(std::string filename, const TensorBase& tensor);
+
+/// Write a binary tensor to a stream.
+void writeBIN(std::ostream& stream, const TensorBase& tensor);
+
+}
+#endif
@@ -32,17 +32,22 @@ void writeHeader(std::ostream &hbfile,
                  std::string mxtype, int nrow, int ncol, int nnzero, int neltvl,
                  std::string ptrfmt, std::string indfmt,
                  std::string valfmt, std::string rhsfmt);
-void readIndices(std::istream &hbfile, int linesize, int indices[]);
+void readIndices(std::istream &hbfile, int linesize, int indsize,
+                 int indices[]);
 void writeIndices(std::ostream &hbfile, int indsize,
                   int linesize, int indices[]);
-void readValues(std::istream &hbfile, int linesize, double values[]);
+void readValues(std::istream &hbfile, int linesize, int valuesize,
+                double values[]);
 void writeValues(std::ostream &hbfile, int valuesize,
                  int valperline, double values[]);
 // Useless for Taco
 void readRHS();
 void writeRHS();
 
-/// Read an rb matrix from a file.
+/// Read an rb matrix from a file. The CSC arrays stored in the file become
+/// the index of a CSC matrix without being packed again, and matrices in other
+/// formats are converted from it. Rb matrices are always packed, so `pack` is
+/// ignored.
 TensorBase readRB(std::string filename, const Format& format, bool pack=true);
 
 /// Read an rb matrix from a stream
@@ -1,6 +1,7 @@
 #ifndef TACO_FILE_IO_TNS_H
 #define TACO_FILE_IO_TNS_H
 
+#include <cstddef>
 #include <istream>
 #include <ostream>
 #include <string>
@@ -15,6 +16,15 @@ TensorBase readTNS(std::string filename, const Format& format, bool pack=true);
 /// Read a tns tensor from a stream.
 TensorBase readTNS(std::istream& stream, const Format& format, bool pack=true);
 
+/// Read a tns tensor from a file that may be larger than memory into a packed
+/// tensor. The file is parsed and sorted `windowSize` bytes at a time, the
+/// sorted runs are spilled to temporary files, and the runs are merged
+/// straight into the tensor's index and values. Duplicate coordinates are
+/// summed. Besides the packed tensor, memory holds the entries of one window,
+/// parsed and then sorted in place, and a small read buffer per run.
+TensorBase readTNSStreaming(std::string filename, const Format& format,
+                            size_t windowSize=size_t(1) << 28);
+
 /// Write a tns tensor to a file.
 void writeTNS(std::string filename, const TensorBase& tensor);
 
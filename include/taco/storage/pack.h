@@ -6,10 +6,12 @@
 #ifndef TACO_STORAGE_PACK_H
 #define TACO_STORAGE_PACK_H
 
+#include <cstddef>
 #include <vector>
 
 namespace taco {
 class Format;
+class DataType;
 namespace ir {
 class Stmt;
 }
@@ -17,18 +19,81 @@ namespace storage {
 class Storage;
 
 /// Pack tensor coordinates into a format. The coordinates must be stored as a
-/// structure of arrays, that is one vector per axis coordinate and one vector
-/// for the values. The coordinates must be sorted lexicographically.
+/// structure of arrays, that is one vector per axis coordinate and an array of
+/// `numCoordinates` values of type `datatype`. The coordinates must be sorted
+/// lexicographically and must be unique. The index and value arrays are
+/// counted before they are filled, so that each is allocated exactly once.
+Storage pack(const std::vector<int>&              dimensions,
+             const Format&                        format,
+             const std::vector<std::vector<int>>& coordinates,
+             const void*                          values,
+             size_t                               numCoordinates,
+             DataType                             datatype);
+
+/// Pack tensor coordinates into a format, like the above, but with the
+/// coordinates of every mode given by a pointer to `numCoordinates` integers.
+Storage pack(const std::vector<int>&              dimensions,
+             const Format&                        format,
+             const std::vector<const int*>&       coordinates,
+             const void*                          values,
+             size_t                               numCoordinates,
+             DataType                             datatype);
+
+/// Pack tensor coordinates with double values into a format. The coordinates
+/// must be stored as a structure of arrays, that is one vector per axis
+/// coordinate and one vector for the values. The coordinates must be sorted
+/// lexicographically.
 Storage pack(const std::vector<int>&              dimensions,
              const Format&                        format,
              const std::vector<std::vector<int>>& coordinates,
              const std::vector<double>            values);
 
+/// Pack tensor coordinates into a format, like `pack`, and merge them with
+/// `storage`, which must already be packed in the same format with values of
+/// type `datatype`. Components that are both in `storage` and in the
+/// coordinates are summed. Every index array is merged segment by segment, so
+/// the cost is linear in the size of `storage` and the number of coordinates.
+/// The format must not have fixed modes.
+Storage packMerged(const Storage&                       storage,
+                   const std::vector<int>&              dimensions,
+                   const Format&                        format,
+                   const std::vector<const int*>&       coordinates,
+                   const void*                          values,
+                   size_t                               numCoordinates,
+                   DataType                             datatype);
+
+/// Pack tensor coordinates into a format, like `pack`, with a kernel
+/// generated by `packCode` for the format and component type. Kernels are
+/// compiled the first time a format and component type is packed and reused
+/// after that. Tensors the code generator does not support, such as tensors
+/// with fixed modes, and tensors whose kernel the C compiler (`TACO_CC`)
+/// cannot build are packed by `pack`.
+Storage packCompiled(const std::vector<int>&              dimensions,
+                     const Format&                        format,
+                     const std::vector<std::vector<int>>& coordinates,
+                     const void*                          values,
+                     size_t                               numCoordinates,
+                     DataType                             datatype);
+
+/// Pack tensor coordinates into a format with a compiled pack kernel, like the
+/// above, but with the coordinates of every mode given by a pointer to
+/// `numCoordinates` integers.
+Storage packCompiled(const std::vector<int>&              dimensions,
+                     const Format&                        format,
+                     const std::vector<const int*>&       coordinates,
+                     const void*                          values,
+                     size_t                               numCoordinates,
+                     DataType                             datatype);
+
 /// Generate code to pack tensor coordinates into a specific format. In the
 /// generated code the coordinates must be stored as a structure of arrays,
-/// that is one vector per axis coordinate and one vector for the values.
-/// The coordinates must be sorted lexicographically.
-ir::Stmt packCode(const Format& format);
+/// that is one array per mode coordinate and one array for the values of type
+/// `ctype`. The coordinates must be sorted lexicographically and must be
+/// unique. The generated function is called `pack` and takes the result
+/// tensor, the coordinate arrays, the values and a pointer to the number of
+/// coordinates. It counts the size of every index array before it allocates
+/// and fills them.
+ir::Stmt packCode(const Format& format, DataType ctype);
 
 }}
 #endif
@@ -4,13 +4,16 @@
 #include <memory>
 #include <string>
 #include <vector>
+#include <future>
 #include <cassert>
+#include <cstring>
 
 #include "taco/type.h"
 #include "taco/format.h"
 #include "taco/error.h"
 
 #include "taco/expr/expr.h"
+#include "taco/expr/schedule.h"
 
 #include "taco/storage/storage.h"
 #include "taco/storage/index.h"
@@ -70,13 +73,64 @@ public:
   void reserve(size_t numCoordinates);
 
   /// Insert a value into the tensor. The number of coordinates must match the
-  /// tensor order.
+  /// tensor order. The value is converted to the component type.
   void insert(const std::initializer_list<int>& coordinate, double value);
 
   /// Insert a value into the tensor. The number of coordinates must match the
-  /// tensor order.
+  /// tensor order. The value is converted to the component type.
   void insert(const std::vector<int>& coordinate, double value);
 
+  /// Insert `numCoordinates` values into the tensor. `coordinates` holds the
+  /// coordinates of the values one after the other, each with one integer per
+  /// mode. The values are converted to the component type.
+  void insertBulk(const int* coordinates, const double* values,
+                  size_t numCoordinates);
+
+  /// A handle that inserts values into a tensor through a coordinate buffer of
+  /// its own. Threads that each insert through their own inserter can insert
+  /// into the same tensor concurrently.
+  class Inserter {
+  public:
+    /// Insert a value into the tensor. The number of coordinates must match
+    /// the tensor order. The value is converted to the component type.
+    void insert(const std::initializer_list<int>& coordinate, double value);
+
+    /// Insert a value into the tensor. The number of coordinates must match
+    /// the tensor order. The value is converted to the component type.
+    void insert(const std::vector<int>& coordinate, double value);
+
+    /// Insert `numCoordinates` values into the tensor, like
+    /// `TensorBase::insertBulk`.
+    void insertBulk(const int* coordinates, const double* values,
+                    size_t numCoordinates);
+
+  private:
+    friend class TensorBase;
+    Inserter(const TensorBase& tensor,
+             std::shared_ptr<std::vector<char>> buffer);
+
+    std::vector<int>                   dimensions;
+    size_t                             coordinateSize;
+    void                               (*storeValue)(char*, double);
+    std::shared_ptr<std::vector<char>> buffer;
+
+    void insert(const int* coordinate, size_t order, double value);
+  };
+
+  /// Returns a new inserter for this tensor. The values inserted through all
+  /// inserters are packed by the next `pack`, which must not run while values
+  /// are being inserted.
+  Inserter inserter();
+
+  /// Adopt caller-owned coordinates and values in coordinate (COO) format,
+  /// with one array of `numCoordinates` integers per mode and one array of
+  /// `numCoordinates` values of the component type. The arrays are not copied
+  /// and must not change or be freed until the tensor has been packed.
+  /// Coordinates that are sorted in the storage order of the format and are
+  /// unique are packed directly from the arrays.
+  void adoptCoordinates(const std::vector<const int*>& coordinates,
+                        const void* values, size_t numCoordinates);
+
   /// Returns the storage for this tensor. Tensor values are stored according
   /// to the format of the tensor.
   const storage::Storage& getStorage() const;
@@ -85,9 +139,23 @@ public:
   /// to the format of the tensor.
   storage::Storage& getStorage();
 
-  /// Pack tensor into the given format
+  /// Pack tensor into the given format. The coordinates inserted since the
+  /// last pack replace the packed components.
   void pack();
 
+  /// Pack the coordinates inserted since the last pack and merge them into
+  /// the packed components, summing the components at the same coordinates,
+  /// in time linear in the size of the packed tensor. The packed components
+  /// are kept if no coordinates have been inserted. Tensors with fixed modes
+  /// cannot be packed incrementally.
+  void packIncremental();
+
+  /// Returns a packed tensor with the components of this tensor, without
+  /// changing it. A packed tensor without new coordinates is returned itself,
+  /// and otherwise its new coordinates are copied into a new tensor that is
+  /// packed.
+  TensorBase getPacked() const;
+
   /// Zero out the values
   void zero();
 
@@ -116,9 +184,23 @@ public:
   void setIndexExpression(const std::vector<taco::IndexVar>& indexVars,
                           taco::IndexExpr expr, bool accumulate=false);
 
-  /// Compile the tensor expression.
+  /// Set the schedule that determines how the tensor expression's parallel
+  /// loops are distributed to threads. Takes effect on the next compile.
+  void setSchedule(const Schedule& schedule);
+
+  /// Compile the tensor expression. Kernels are shared between tensors, so if
+  /// a tensor with the same expression, formats, dimensions and allocation
+  /// size has already been compiled then its kernel is reused.
   void compile(bool assembleWhileCompute=false);
 
+  /// Compile the tensor expression in the background. The expression is
+  /// lowered before this function returns, but the C compiler runs on a
+  /// bounded pool of worker threads (see `TACO_COMPILE_THREADS`). The
+  /// returned future is ready when the kernel has been compiled and loaded,
+  /// and `assemble` and `compute` wait for it if needed. Lowering is not
+  /// thread safe, so this function must not be called concurrently.
+  std::shared_future<void> compileAsync(bool assembleWhileCompute=false);
+
   /// Assemble the tensor storage, including index and value arrays.
   void assemble();
 
@@ -128,6 +210,10 @@ public:
   /// Compile, assemble and compute as needed.
   void evaluate();
 
+  /// Set the number of threads that this tensor's kernels run with,
+  /// overriding `taco::setNumThreads`. Zero restores the global setting.
+  void setNumThreads(int numThreads);
+
   /// Get the source code of the kernel functions.
   std::string getSource() const;
 
@@ -136,6 +222,13 @@ public:
   /// then it will will be created it from the given expression.
   void compileSource(std::string source);
 
+  /// Bind the tensor expression to precompiled kernels instead of compiling
+  /// it, e.g. the `_shim_` entry points of a library built by
+  /// `compileToStaticLibrary` from a tensor with the same expression, formats
+  /// and `assembleWhileCompute` setting. The C compiler is not invoked.
+  void bindPrecompiled(int (*assemble)(void**), int (*compute)(void**),
+                       bool assembleWhileCompute=false);
+
   /// Print the IR loops that compute the tensor's expression.
   void printComputeIR(std::ostream& stream, bool color=false,
                       bool simplify=false) const;
@@ -150,10 +243,15 @@ public:
   /// Get the size of the initial index allocations.
   size_t getAllocSize() const;
 
-  /// Get the taco_tensor_t representation of this tensor.
+  /// Get the taco_tensor_t representation of this tensor. The descriptor is
+  /// owned by the tensor and must not be freed by the caller. It stays valid
+  /// for the lifetime of the tensor and is reused by subsequent calls, which
+  /// refresh its dimensions and data pointers, so it must not be requested
+  /// from several threads at once.
   taco_tensor_t* getTacoTensorT();
 
-  /// True iff two tensors have the same type and the same values.
+  /// True iff two tensors have the same type and the same values, within a
+  /// relative tolerance of 1e-5 (see `compare`).
   friend bool equals(const TensorBase&, const TensorBase&);
 
   /// True iff two TensorBase objects refer to the same tensor (TensorBase
@@ -172,16 +270,83 @@ public:
   /// Print a tensor to a stream.
   friend std::ostream& operator<<(std::ostream&, const TensorBase&);
 
+  friend std::shared_future<void>
+  compileAsync(const std::vector<TensorBase>& tensors,
+               bool assembleWhileCompute);
+
+  friend class Kernel;
+
+protected:
+  /// Append a coordinate to the coordinate buffer and return the location its
+  /// value must be stored at.
+  char* appendCoordinate(const int* coordinate, size_t order);
+
 private:
   struct Content;
   std::shared_ptr<Content> content;
 
+  void packArguments();
+
+  /// Pack the new coordinates, and merge them with the packed components if
+  /// `merge` is true.
+  void packCoordinates(bool merge);
+
   std::shared_ptr<std::vector<char>> coordinateBuffer;
   size_t                             coordinateBufferUsed;
   size_t                             coordinateSize;
 };
 
 
+/// A compiled tensor expression that can be evaluated with different tensors.
+/// A kernel is compiled from a template tensor whose expression gives the
+/// index variables and formats, and can then be called many times with any
+/// result and operand tensors whose component types, orders and formats match
+/// those of the template. Dimensions are not part of the kernel, except for
+/// small dense modes whose loops are specialized to the template dimension,
+/// and modes that are indexed by the same index variable must have the same
+/// dimension.
+class Kernel {
+public:
+  /// Create an undefined kernel.
+  Kernel();
+
+  /// Compile the expression of the given tensor into a kernel.
+  explicit Kernel(const TensorBase& tensor, bool assembleWhileCompute=false);
+
+  /// Assemble the result tensor storage from the given operands. The
+  /// operands are ordered by their first occurrence in the expression.
+  void assemble(TensorBase& result,
+                const std::vector<TensorBase>& operands) const;
+
+  /// Compute the result tensor values from the given operands.
+  void compute(TensorBase& result,
+               const std::vector<TensorBase>& operands) const;
+
+  /// Assemble and compute as needed.
+  void evaluate(TensorBase& result,
+                const std::vector<TensorBase>& operands) const;
+
+  /// Set the number of threads that the kernel runs with, overriding
+  /// `taco::setNumThreads`. Zero restores the global setting.
+  void setNumThreads(int numThreads);
+
+  /// Returns the number of operands that the kernel takes.
+  size_t getNumOperands() const;
+
+  /// True if the kernel has been compiled from an expression.
+  bool defined() const;
+
+private:
+  struct Content;
+  std::shared_ptr<Content> content;
+
+  void checkArguments(const TensorBase& result,
+                      const std::vector<TensorBase>& operands) const;
+  void call(void* func, TensorBase& result,
+            const std::vector<TensorBase>& operands, bool unpack) const;
+};
+
+
 /// A reference to a tensor. Tensor object copies copies the reference, and
 /// subsequent method calls affect both tensor references. To deeply copy a
 /// tensor (for instance to change the format) compute a copy index expression
@@ -214,6 +379,20 @@ public:
         " components to a Tensor<" << type<CType>() << ">";
   }
 
+  /// Insert a value into the tensor. The number of coordinates must match the
+  /// tensor order.
+  void insert(const std::initializer_list<int>& coordinate, CType value) {
+    std::memcpy(appendCoordinate(coordinate.begin(), coordinate.size()),
+                &value, sizeof(CType));
+  }
+
+  /// Insert a value into the tensor. The number of coordinates must match the
+  /// tensor order.
+  void insert(const std::vector<int>& coordinate, CType value) {
+    std::memcpy(appendCoordinate(coordinate.data(), coordinate.size()),
+                &value, sizeof(CType));
+  }
+
   class const_iterator {
   public:
     typedef const_iterator self_type;
@@ -282,7 +461,7 @@ public:
         }
 
         const size_t idx = (lvl == 0) ? 0 : ptrs[lvl - 1];
-        curVal.second = getValue<double>(tensor->getStorage().getValues(), idx);
+        curVal.second = getValue<CType>(tensor->getStorage().getValues(), idx);
 
         for (size_t i = 0; i < lvl; ++i) {
           const size_t mode = modeOrdering[i];
@@ -403,15 +582,22 @@ enum class FileType {
   ttx,
 
   /// .rb  - The rutherford-boeing sparse matrix format.
-  rb
+  rb,
+
+  /// .bin - The taco binary tensor format. It stores the format, dimensions,
+  ///        index arrays and value array of a packed tensor, aligned so that
+  ///        the file can be memory mapped and used without copying.
+  bin
 };
 
 /// Read a tensor from a file. The file format is inferred from the filename
-/// and the tensor is returned packed by default.
+/// and the tensor is returned packed by default. Gzip compressed files, such
+/// as `.tns.gz` files, are decompressed while they are read (see `TACO_ZLIB`).
 TensorBase read(std::string filename, Format format, bool pack = true);
 
 /// Read a tensor from a file of the given file format and the tensor is
-/// returned packed by default.
+/// returned packed by default. Gzip compressed files are decompressed while
+/// they are read.
 TensorBase read(std::string filename, FileType filetype, Format format,
                 bool pack = true);
 
@@ -421,9 +607,11 @@ TensorBase read(std::istream& stream, FileType filetype, Format format,
                 bool pack = true);
 
 /// Write a tensor to a file. The file format is inferred from the filename.
+/// Files whose name ends with `.gz` are gzip compressed.
 void write(std::string filename, const TensorBase& tensor);
 
-/// Write a tensor to a file in the given file format.
+/// Write a tensor to a file in the given file format. Files whose name ends
+/// with `.gz` are gzip compressed.
 void write(std::string filename, FileType filetype, const TensorBase& tensor);
 
 /// Write a tensor to a stream in the given file format.
@@ -462,6 +650,63 @@ TensorBase makeCSC(const std::string& name, const std::vector<int>& dimensions,
 void getCSCArrays(const TensorBase& tensor,
                   int** colptr, int** rowidx, double** vals);
 
+/// Convert a tensor to another format. The index and value arrays of the
+/// tensor are converted directly, without inserting the components into a new
+/// tensor: compressed matrices are transposed (e.g. CSR to CSC) with parallel
+/// counting sorts of their index arrays, and other tensors have their
+/// coordinates extracted in parallel and packed in the new format, which does
+/// not sort them when the two formats have the same mode ordering. Every
+/// stored component is kept, including the zeros of dense modes.
+TensorBase convert(const TensorBase& tensor, const Format& format);
+
+/// The result of comparing two tensors with `compare`.
+struct TensorComparison {
+  /// True iff the tensors have the same component type and dimensions, and
+  /// all their components are within the tolerance.
+  bool isEqual = true;
+
+  /// The coordinate of the first component, in the storage order of the first
+  /// tensor, that is not within the tolerance. Empty if there is no such
+  /// component, for scalars, and for tensors of different types or shapes.
+  std::vector<int> mismatch;
+
+  /// The largest absolute and relative errors between two components.
+  double maxAbsError = 0.0;
+  double maxRelError = 0.0;
+};
+
+/// Compare the components of two tensors. Components `a` and `b` are within
+/// the tolerance if `|a-b| <= absTolerance + relTolerance * max(|a|,|b|)`, and
+/// NaNs are only equal to NaNs. Components that are stored in one tensor only
+/// are compared to zero. Tensors whose index arrays are the same are compared
+/// with `memcmp` on the index arrays and in parallel on the value arrays;
+/// tensors in different formats are converted to the format of `a` first.
+TensorComparison compare(const TensorBase& a, const TensorBase& b,
+                         double relTolerance = 1e-5, double absTolerance = 0.0);
+
+
+/// Compile the expressions of many tensors. The kernels are compiled into one
+/// library by a single compiler invocation, which amortizes the compiler
+/// startup cost when compiling many small kernels.
+void compile(const std::vector<TensorBase>& tensors,
+             bool assembleWhileCompute=false);
+
+/// Compile the expressions of many tensors into one library in the
+/// background (see `TensorBase::compileAsync`). The returned future is ready
+/// when every tensor's kernel is loaded.
+std::shared_future<void> compileAsync(const std::vector<TensorBase>& tensors,
+                                      bool assembleWhileCompute=false);
+
+/// Compile the expressions of many tensors ahead of time into the static
+/// library path/prefix.a with the header path/prefix.h. The kernels of the
+/// i-th tensor are named prefix_assemble<i> and prefix_compute<i>, and their
+/// entry points `_shim_prefix_assemble<i>` and `_shim_prefix_compute<i>` can be
+/// bound to tensors with `TensorBase::bindPrecompiled`. The prefix must be a
+/// valid C identifier. If the C compiler supports OpenMP the library must be
+/// linked with the OpenMP runtime (e.g. `-fopenmp`).
+void compileToStaticLibrary(std::string path, std::string prefix,
+                            const std::vector<TensorBase>& tensors,
+                            bool assembleWhileCompute=false);
 
 /// Pack the operands in the given expression.
 void packOperands(const TensorBase& tensor);
@@ -472,5 +717,245 @@ Tensor<CType> iterate(const TensorBase& tensor) {
   return Tensor<CType>(tensor);
 }
 
+namespace detail {
+
+/// The index arrays of one level of a packed tensor, fetched once for
+/// `forEachNonzero`.
+struct NonzeroLevel {
+  ModeType   type;
+  int        size;
+  const int* pos;
+  const int* idx;
+  size_t     mode;
+};
+
+/// Returns the index arrays of every level of a packed tensor's storage.
+inline std::vector<NonzeroLevel> getNonzeroLevels(
+    const storage::Storage& storage) {
+  const Format& format = storage.getFormat();
+  std::vector<NonzeroLevel> levels(format.getOrder());
+  for (size_t i = 0; i < levels.size(); i++) {
+    const storage::ModeIndex modeIndex = storage.getIndex().getModeIndex(i);
+    const int* first = (const int*)modeIndex.getIndexArray(0).getData();
+    levels[i].type = format.getModeTypes()[i];
+    levels[i].size = (levels[i].type == Sparse) ? 0 : first[0];
+    levels[i].pos = first;
+    levels[i].idx = (levels[i].type == Dense) ? nullptr :
+                    (const int*)modeIndex.getIndexArray(1).getData();
+    levels[i].mode = format.getModeOrdering()[i];
+  }
+  return levels;
+}
+
+/// Returns the number of positions of the first level of a packed tensor.
+inline size_t getNumFirstLevelPositions(const std::vector<NonzeroLevel>& levels) {
+  return (levels[0].type == Sparse) ? levels[0].pos[1] : levels[0].size;
+}
+
+template <typename CType, typename Callback>
+void forEachNonzero(const std::vector<NonzeroLevel>& levels, size_t level,
+                    size_t p, std::vector<int>& coordinate,
+                    const CType* vals, Callback& callback);
+
+/// Calls the callback for the components stored under positions [begin, end)
+/// of `level`, whose dense coordinates are the positions minus `offset`.
+template <typename CType, typename Callback>
+void forEachNonzero(const std::vector<NonzeroLevel>& levels, size_t level,
+                    size_t begin, size_t end, size_t offset,
+                    std::vector<int>& coordinate, const CType* vals,
+                    Callback& callback) {
+  const NonzeroLevel& l = levels[level];
+  const std::vector<int>& constCoordinate = coordinate;
+  const bool isLast = (level + 1 == levels.size());
+
+  // The innermost level calls the callback directly in a tight loop
+  if (l.type == Dense) {
+    for (size_t k = begin; k < end; k++) {
+      coordinate[l.mode] = (int)(k - offset);
+      if (isLast) {
+        callback(constCoordinate, vals[k]);
+      }
+      else {
+        forEachNonzero(levels, level + 1, k, coordinate, vals, callback);
+      }
+    }
+  }
+  else if (isLast) {
+    for (size_t k = begin; k < end; k++) {
+      coordinate[l.mode] = l.idx[k];
+      callback(constCoordinate, vals[k]);
+    }
+  }
+  else {
+    for (size_t k = begin; k < end; k++) {
+      coordinate[l.mode] = l.idx[k];
+      forEachNonzero(levels, level + 1, k, coordinate, vals, callback);
+    }
+  }
+}
+
+/// Calls the callback for the components stored under position `p` of the
+/// level above `level`.
+template <typename CType, typename Callback>
+void forEachNonzero(const std::vector<NonzeroLevel>& levels, size_t level,
+                    size_t p, std::vector<int>& coordinate,
+                    const CType* vals, Callback& callback) {
+  const NonzeroLevel& l = levels[level];
+  if (l.type == Sparse) {
+    forEachNonzero(levels, level, l.pos[p], l.pos[p + 1], 0, coordinate, vals,
+                   callback);
+  }
+  else {
+    size_t begin = p * l.size;
+    forEachNonzero(levels, level, begin, begin + l.size, begin, coordinate,
+                   vals, callback);
+  }
+}
+
+/// Visits the components under position `p` of the level above `levels`,
+/// whose remaining levels have the mode types `Types`. Every level is a loop
+/// that is specialized to its mode type at compile time.
+template <typename CType, typename Callback, ModeType... Types>
+struct StaticNonzeroVisitor;
+
+template <typename CType, typename Callback>
+struct StaticNonzeroVisitor<CType, Callback> {
+  static void visit(const NonzeroLevel*, size_t p,
+                    std::vector<int>& coordinate, const CType* vals,
+                    Callback& callback) {
+    const std::vector<int>& constCoordinate = coordinate;
+    callback(constCoordinate, vals[p]);
+  }
+};
+
+template <typename CType, typename Callback, ModeType... Types>
+struct StaticNonzeroVisitor<CType, Callback, Dense, Types...> {
+  static void visit(const NonzeroLevel* levels, size_t p,
+                    std::vector<int>& coordinate, const CType* vals,
+                    Callback& callback) {
+    const size_t size = levels[0].size;
+    const size_t mode = levels[0].mode;
+    for (size_t i = 0; i < size; i++) {
+      coordinate[mode] = (int)i;
+      StaticNonzeroVisitor<CType, Callback, Types...>::visit(
+          levels + 1, p * size + i, coordinate, vals, callback);
+    }
+  }
+};
+
+template <typename CType, typename Callback, ModeType... Types>
+struct StaticNonzeroVisitor<CType, Callback, Sparse, Types...> {
+  static void visit(const NonzeroLevel* levels, size_t p,
+                    std::vector<int>& coordinate, const CType* vals,
+                    Callback& callback) {
+    const int* idx = levels[0].idx;
+    const size_t mode = levels[0].mode;
+    for (size_t k = levels[0].pos[p]; k < (size_t)levels[0].pos[p + 1]; k++) {
+      coordinate[mode] = idx[k];
+      StaticNonzeroVisitor<CType, Callback, Types...>::visit(
+          levels + 1, k, coordinate, vals, callback);
+    }
+  }
+};
+
+template <typename CType, typename Callback, ModeType... Types>
+struct StaticNonzeroVisitor<CType, Callback, Fixed, Types...> {
+  static void visit(const NonzeroLevel* levels, size_t p,
+                    std::vector<int>& coordinate, const CType* vals,
+                    Callback& callback) {
+    const int* idx = levels[0].idx;
+    const size_t mode = levels[0].mode;
+    const size_t begin = p * levels[0].size;
+    for (size_t k = begin; k < begin + levels[0].size; k++) {
+      coordinate[mode] = idx[k];
+      StaticNonzeroVisitor<CType, Callback, Types...>::visit(
+          levels + 1, k, coordinate, vals, callback);
+    }
+  }
+};
+
+/// Picks the `StaticNonzeroVisitor` for the mode types of the next
+/// `Remaining` levels, after those of the levels `Types` that are picked.
+template <size_t Remaining, typename CType, typename Callback,
+          ModeType... Types>
+struct NonzeroDispatch {
+  static void visit(const NonzeroLevel* levels, std::vector<int>& coordinate,
+                    const CType* vals, Callback& callback) {
+    switch (levels[sizeof...(Types)].type) {
+      case Dense:
+        NonzeroDispatch<Remaining - 1, CType, Callback, Types..., Dense>::
+            visit(levels, coordinate, vals, callback);
+        break;
+      case Sparse:
+        NonzeroDispatch<Remaining - 1, CType, Callback, Types..., Sparse>::
+            visit(levels, coordinate, vals, callback);
+        break;
+      case Fixed:
+        NonzeroDispatch<Remaining - 1, CType, Callback, Types..., Fixed>::
+            visit(levels, coordinate, vals, callback);
+        break;
+    }
+  }
+};
+
+template <typename CType, typename Callback, ModeType... Types>
+struct NonzeroDispatch<0, CType, Callback, Types...> {
+  static void visit(const NonzeroLevel* levels, std::vector<int>& coordinate,
+                    const CType* vals, Callback& callback) {
+    StaticNonzeroVisitor<CType, Callback, Types...>::visit(
+        levels, 0, coordinate, vals, callback);
+  }
+};
+
+}
+
+/// Calls `callback(coordinate, value)` for every component stored in a packed
+/// tensor, in the order they are stored. The coordinate is a
+/// `const std::vector<int>&` in the order of the tensor's modes that is reused
+/// from call to call, and the value is a `CType`, which must be the tensor's
+/// component type. Unlike `Tensor<CType>::const_iterator`, the index arrays
+/// are fetched once and read through raw pointers, so nothing is allocated,
+/// copied or dispatched on type per component. Tensors of order up to three
+/// are visited by loops specialized to their mode types at compile time,
+/// picked once per call, and higher orders by a loop per level that branches
+/// on its mode type.
+template <typename CType, typename Callback>
+void forEachNonzero(const TensorBase& tensor, Callback callback) {
+  taco_uassert(tensor.getComponentType() == type<CType>()) <<
+      "Iterating over a tensor with " << tensor.getComponentType() <<
+      " components as " << type<CType>();
+  const storage::Storage& storage = tensor.getStorage();
+  const CType* vals = static_cast<const CType*>(storage.getValues().getData());
+  if (vals == nullptr) {
+    return;
+  }
+
+  std::vector<int> coordinate(tensor.getOrder());
+  if (tensor.getOrder() == 0) {
+    const std::vector<int>& constCoordinate = coordinate;
+    callback(constCoordinate, vals[0]);
+    return;
+  }
+
+  std::vector<detail::NonzeroLevel> levels = detail::getNonzeroLevels(storage);
+  switch (levels.size()) {
+    case 1:
+      detail::NonzeroDispatch<1, CType, Callback>::visit(
+          levels.data(), coordinate, vals, callback);
+      break;
+    case 2:
+      detail::NonzeroDispatch<2, CType, Callback>::visit(
+          levels.data(), coordinate, vals, callback);
+      break;
+    case 3:
+      detail::NonzeroDispatch<3, CType, Callback>::visit(
+          levels.data(), coordinate, vals, callback);
+      break;
+    default:
+      detail::forEachNonzero(levels, 0, 0, coordinate, vals, callback);
+      break;
+  }
+}
+
 }
 #endif
@@ -11,6 +11,7 @@ namespace taco {
 namespace util {
 std::string getFromEnv(std::string flag, std::string dflt);
 std::string getTmpdir();
+std::string getCachedir();
 extern std::string cachedtmpdir;
 extern void cachedtmpdirCleanup(void);
 
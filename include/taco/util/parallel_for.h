@@ -0,0 +1,48 @@
+#ifndef TACO_UTIL_PARALLEL_FOR_H
+#define TACO_UTIL_PARALLEL_FOR_H
+
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+#include "taco/parallel.h"
+
+namespace taco {
+namespace util {
+
+/// Returns the number of blocks to split `size` iterations into so that
+/// every block has at least `minBlockSize` iterations and there are no more
+/// blocks than threads (see `taco::getNumThreads`). Returns at least one.
+inline size_t getNumBlocks(size_t size, size_t minBlockSize) {
+  size_t numBlocks = (minBlockSize > 0) ? size / minBlockSize : size;
+  size_t numThreads = (size_t)getNumThreads();
+  numBlocks = (numBlocks < numThreads) ? numBlocks : numThreads;
+  return (numBlocks > 0) ? numBlocks : 1;
+}
+
+/// Returns the first iteration of block `block` when `size` iterations are
+/// split into `numBlocks` contiguous blocks of (almost) equal size. Block
+/// `block` ends where block `block+1` begins.
+inline size_t getBlockBegin(size_t size, size_t numBlocks, size_t block) {
+  return (size / numBlocks) * block + ((size % numBlocks) * block) / numBlocks;
+}
+
+/// Calls `task(i)` for every `i` in [0, numTasks), each on its own thread.
+/// The calling thread runs task 0 and returns when all tasks have finished.
+template <typename F>
+void parallelFor(size_t numTasks, F task) {
+  std::vector<std::thread> threads;
+  threads.reserve((numTasks > 0) ? numTasks - 1 : 0);
+  for (size_t i = 1; i < numTasks; i++) {
+    threads.push_back(std::thread(task, i));
+  }
+  if (numTasks > 0) {
+    task(0);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+}}
+#endif
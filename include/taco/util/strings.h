@@ -68,5 +68,9 @@ std::string repeat(std::string text, size_t n);
 /// is filled with `fill`.
 std::string fill(std::string text, char fill, size_t n);
 
+/// Returns a hexadecimal 64-bit FNV-1a hash of the text. Unlike `std::hash`
+/// the hash is stable across processes and builds, so it can name files.
+std::string hash(const std::string& text);
+
 }}
 #endif
@@ -0,0 +1,52 @@
+#ifndef TACO_UTIL_THREAD_POOL_H
+#define TACO_UTIL_THREAD_POOL_H
+
+#include <queue>
+#include <vector>
+#include <memory>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#include "taco/util/uncopyable.h"
+
+namespace taco {
+namespace util {
+
+/// A fixed number of worker threads that run submitted tasks in the order
+/// they are submitted. The destructor finishes all submitted tasks.
+class ThreadPool : Uncopyable {
+public:
+  /// Create a pool with `numThreads` worker threads (at least one).
+  explicit ThreadPool(size_t numThreads);
+  ~ThreadPool();
+
+  /// Returns the number of worker threads.
+  size_t getNumThreads() const;
+
+  /// Run `task` on a worker thread. The returned future becomes ready when
+  /// the task has finished and holds its result.
+  template <typename F>
+  std::future<typename std::result_of<F()>::type> submit(F task) {
+    typedef typename std::result_of<F()>::type R;
+    auto packagedTask = std::make_shared<std::packaged_task<R()>>(task);
+    std::future<R> result = packagedTask->get_future();
+    enqueue([packagedTask]() { (*packagedTask)(); });
+    return result;
+  }
+
+private:
+  std::vector<std::thread>          workers;
+  std::queue<std::function<void()>> tasks;
+  std::mutex                        tasksMutex;
+  std::condition_variable           tasksAvailable;
+  bool                              stopping;
+
+  void enqueue(std::function<void()> task);
+  void work();
+};
+
+}}
+#endif
@@ -30,7 +30,18 @@ const string cHeaders =
   "#include <stdlib.h>\n"
   "#include <stdint.h>\n"
   "#include <math.h>\n"
+  "#ifdef _OPENMP\n"
+  "#include <omp.h>\n"
+  "#endif\n"
   "#define TACO_MIN(_a,_b) ((_a) < (_b) ? (_a) : (_b))\n"
+  "static inline int32_t taco_lower_bound(int32_t* array, int32_t lo,\n"
+  "                                       int32_t hi, int64_t target) {\n"
+  "  while (lo < hi) {\n"
+  "    int32_t mid = lo + (hi - lo) / 2;\n"
+  "    if (array[mid] < target) lo = mid + 1; else hi = mid;\n"
+  "  }\n"
+  "  return lo;\n"
+  "}\n"
   "#ifndef TACO_TENSOR_T_DEFINED\n"
   "#define TACO_TENSOR_T_DEFINED\n"
   "typedef enum { taco_mode_dense, taco_mode_sparse } taco_mode_t;\n"
@@ -99,6 +110,9 @@ protected:
     op->increment.accept(this);
     inVarAssignLHSWithDecl = false;
 
+    if (op->balance_pos.defined()) {
+      op->balance_pos.accept(this);
+    }
     op->contents.accept(this);
   }
 
@@ -190,7 +204,8 @@ string unpackTensorProperty(string varname, const GetProperty* op,
   if (op->property == TensorProperty::Values) {
     // for the values, it's in the last slot
     ret << toCType(tensor->type, true);
-    ret << " restrict " << varname << " = (double*)(";
+    ret << " restrict " << varname << " = (" << toCType(tensor->type, true)
+        << ")(";
     ret << tensor->name << "->vals);\n";
     return ret.str();
   }
@@ -566,11 +581,28 @@ static string genVectorizePragma(int width) {
   return ret.str();
 }
 
-static string getParallelizePragma(LoopKind kind) {
+static string getParallelizePragma(LoopKind kind, int chunkSize) {
   stringstream ret;
   ret << "#pragma omp parallel for";
-  if (kind == LoopKind::Dynamic) {
-    ret << " schedule(dynamic, 16)";
+  switch (kind) {
+    case LoopKind::Static:
+      if (chunkSize > 0) {
+        ret << " schedule(static, " << chunkSize << ")";
+      }
+      break;
+    case LoopKind::Dynamic:
+      ret << " schedule(dynamic, " << (chunkSize > 0 ? chunkSize : 16) << ")";
+      break;
+    case LoopKind::Guided:
+      ret << " schedule(guided";
+      if (chunkSize > 0) {
+        ret << ", " << chunkSize;
+      }
+      ret << ")";
+      break;
+    default:
+      taco_ierror;
+      break;
   }
   return ret.str();
 }
@@ -589,9 +621,14 @@ void CodeGen_C::visit(const For* op) {
       break;
     case LoopKind::Static:
     case LoopKind::Dynamic:
+    case LoopKind::Guided:
       doIndent();
-      out << getParallelizePragma(op->kind);
+      out << getParallelizePragma(op->kind, op->chunk_size);
       out << "\n";
+      break;
+    case LoopKind::Balanced:
+      visitBalanced(op);
+      return;
     default:
       break;
   }
@@ -599,6 +636,91 @@ void CodeGen_C::visit(const For* op) {
   IRPrinter::visit(op);
 }
 
+// Balanced loops give each thread one contiguous block of iterations, where
+// the block boundaries are found by binary search in the pos array so that
+// every block covers about the same number of nonzeros.
+void CodeGen_C::visitBalanced(const For* op) {
+  taco_iassert(op->balance_pos.defined());
+  string tid = genUniqueName("tid");
+  string nthreads = genUniqueName("nthreads");
+  string first = genUniqueName("first");
+  string nnz = genUniqueName("nnz");
+  string begin = genUniqueName("begin");
+  string end = genUniqueName("end");
+
+  doIndent();
+  stream << "#pragma omp parallel\n";
+  doIndent();
+  stream << "{\n";
+  indent++;
+
+  doIndent();
+  stream << "int32_t " << tid << " = 0;\n";
+  doIndent();
+  stream << "int32_t " << nthreads << " = 1;\n";
+  stream << "#ifdef _OPENMP\n";
+  doIndent();
+  stream << tid << " = omp_get_thread_num();\n";
+  doIndent();
+  stream << nthreads << " = omp_get_num_threads();\n";
+  stream << "#endif\n";
+
+  doIndent();
+  stream << "int32_t " << begin << " = ";
+  op->start.accept(this);
+  stream << ";\n";
+  doIndent();
+  stream << "int32_t " << end << " = ";
+  op->end.accept(this);
+  stream << ";\n";
+
+  doIndent();
+  stream << "int64_t " << first << " = ";
+  op->balance_pos.accept(this);
+  stream << "[" << begin << "];\n";
+  doIndent();
+  stream << "int64_t " << nnz << " = ";
+  op->balance_pos.accept(this);
+  stream << "[" << end << "] - " << first << ";\n";
+
+  // The last block extends to the end to include trailing empty iterations
+  doIndent();
+  stream << "if (" << tid << " + 1 < " << nthreads << ") {\n";
+  indent++;
+  doIndent();
+  stream << end << " = taco_lower_bound(";
+  op->balance_pos.accept(this);
+  stream << ", " << begin << ", " << end << ", "
+         << first << " + " << nnz << " * (" << tid << " + 1) / "
+         << nthreads << ");\n";
+  indent--;
+  doIndent();
+  stream << "}\n";
+  doIndent();
+  stream << begin << " = taco_lower_bound(";
+  op->balance_pos.accept(this);
+  stream << ", " << begin << ", " << end << ", "
+         << first << " + " << nnz << " * " << tid << " / "
+         << nthreads << ");\n";
+
+  doIndent();
+  stream << "for (" << util::toString(op->var.type()) << " ";
+  op->var.accept(this);
+  stream << " = " << begin << "; ";
+  op->var.accept(this);
+  stream << " < " << end << "; ";
+  op->var.accept(this);
+  stream << "++) {\n";
+  op->contents.accept(this);
+  stream << "\n";
+  doIndent();
+  stream << "}\n";
+
+  indent--;
+  doIndent();
+  stream << "}";
+}
+
 void CodeGen_C::visit(const While* op) {
   // it's not clear from documentation that clang will vectorize
   // while loops
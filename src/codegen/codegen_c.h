@@ -36,6 +36,7 @@ protected:
   void visit(const Function*);
   void visit(const Var*);
   void visit(const For*);
+  void visitBalanced(const For*);
   void visit(const While*);
   void visit(const GetProperty*);
   void visit(const Min*);
@@ -1,5 +1,8 @@
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <mutex>
 #include <dlfcn.h>
 #include <unistd.h>
 
@@ -8,12 +11,20 @@
 #include "taco/error.h"
 #include "taco/util/strings.h"
 #include "taco/util/env.h"
+#include "taco/util/thread_pool.h"
+#include "taco/parallel.h"
 
 using namespace std;
 
 namespace taco {
 namespace ir {
 
+Module::~Module() {
+  if (compiled.valid()) {
+    compiled.wait();
+  }
+}
+
 void Module::setJITTmpdir() {
   tmpdir = util::getTmpdir();
 }
@@ -64,54 +75,243 @@ void Module::compileToSource(string path, string prefix) {
   header_file.close();
 }
 
-void Module::compileToStaticLibrary(string path, string prefix) {
-  taco_tassert(false) << "Compiling to a static library is not supported";
-}
-  
 namespace {
 
-void writeShims(vector<Stmt> funcs, string path, string prefix) {
+string generateShims(const vector<Stmt>& funcs) {
   stringstream shims;
-  
   for (auto func: funcs) {
     CodeGen_C::generateShim(func, shims);
   }
-  
+  return shims.str();
+}
+
+void writeShims(vector<Stmt> funcs, string path, string prefix) {
   ofstream shims_file;
   shims_file.open(path+prefix+"_shims.c");
-  shims_file << "#include \"" << path << prefix << ".h\"\n";
-  shims_file << shims.str();
+  shims_file << "#include \"" << prefix << ".h\"\n";
+  shims_file << generateShims(funcs);
   shims_file.close();
 }
 
+string readFile(string path) {
+  ifstream file(path);
+  if (!file.is_open()) {
+    return "";
+  }
+  stringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+/// Returns true iff the C compiler can build OpenMP code. Each compiler is
+/// probed once per process.
+bool supportsOpenMP(string cc) {
+  static mutex probedMutex;
+  static map<string,bool> probed;
+  lock_guard<mutex> lock(probedMutex);
+  if (probed.count(cc) == 0) {
+    string prefix = util::getTmpdir() + "openmp_probe";
+    ofstream source_file;
+    source_file.open(prefix + ".c");
+    source_file << "#include <omp.h>\n"
+                << "int openmp_probe() { return omp_get_max_threads(); }\n";
+    source_file.close();
+    string cmd = cc + " -fopenmp -shared -fPIC " + prefix + ".c " +
+                 "-o " + prefix + ".so > /dev/null 2>&1";
+    probed[cc] = (system(cmd.data()) == 0);
+    remove((prefix + ".c").c_str());
+    remove((prefix + ".so").c_str());
+  }
+  return probed.at(cc);
+}
+
 } // anonymous namespace
 
-string Module::compile() {
-  string prefix = tmpdir+libname;
-  string fullpath = prefix + ".so";
-  
+/// Returns the pool that runs background compiler invocations. The number of
+/// concurrent compiler processes is bounded by TACO_COMPILE_THREADS, which
+/// defaults to the number of hardware threads.
+util::ThreadPool& getCompilePool() {
+  static util::ThreadPool compilePool([]() {
+    string numThreads = util::getFromEnv("TACO_COMPILE_THREADS", "");
+    return (numThreads != "") ? (size_t)stoul(numThreads)
+                              : (size_t)thread::hardware_concurrency();
+  }());
+  return compilePool;
+}
+
+string Module::getCFlags(string cc) {
+  string cflags = util::getFromEnv("TACO_CFLAGS", "-O3 -ffast-math -std=c99");
+  if (supportsOpenMP(cc)) {
+    cflags += " -fopenmp";
+  }
+  return cflags;
+}
+
+void Module::compileToStaticLibrary(string path, string prefix) {
+  taco_uassert(!moduleFromUserSource)
+      << "Modules with user provided source cannot be compiled to a static "
+      << "library";
+
+  compileToSource(path, prefix);
+  writeShims(funcs, path, prefix);
+
+  // The shims are the entry points of the library, so declare them in the
+  // header next to the kernels.
+  ofstream header_file;
+  header_file.open(path+prefix+".h", ios::app);
+  for (auto& func : funcs) {
+    header_file << "int _shim_" << func.as<Function>()->name
+                << "(void** parameterPack);\n";
+  }
+  header_file.close();
+
   string cc = util::getFromEnv("TACO_CC", "cc");
-  string cflags = util::getFromEnv("TACO_CFLAGS",
-    "-O3 -ffast-math -std=c99") + " -shared -fPIC";
-  
+  string cflags = getCFlags(cc) + " -fPIC -c";
+  string ar = util::getFromEnv("TACO_AR", "ar");
+
   string cmd = cc + " " + cflags + " " +
-    prefix + ".c " +
-    prefix + "_shims.c " +
-    "-o " + prefix + ".so";
+    path + prefix + ".c -o " + path + prefix + ".o && " +
+    cc + " " + cflags + " " +
+    path + prefix + "_shims.c -o " + path + prefix + "_shims.o && " +
+    "rm -f " + path + prefix + ".a && " +
+    ar + " rcs " + path + prefix + ".a " +
+    path + prefix + ".o " + path + prefix + "_shims.o";
+
+  int err = system(cmd.data());
+  taco_uassert(err == 0) << "Compilation command failed:\n" << cmd
+    << "\nreturned " << err;
+
+  remove((path + prefix + ".o").c_str());
+  remove((path + prefix + "_shims.o").c_str());
+}
+
+void Module::setFunc(string name, void* func) {
+  externalFuncs[name] = func;
+
+  // Precompiled kernels use the OpenMP runtime linked into the program
+  if (setNumThreadsFunc == nullptr) {
+    setNumThreadsFunc = dlsym(RTLD_DEFAULT, "omp_set_num_threads");
+  }
+}
+
+string Module::getCacheKey(string cc, string cflags) {
+  // The shims include a header from the per-process tmpdir, so we key on the
+  // generated shim code rather than on the shim file.
+  stringstream key;
+  key << source.str() << "\n"
+      << generateShims(funcs) << "\n"
+      << "// cc: " << cc << "\n"
+      << "// cflags: " << cflags << "\n"
+      << "// target: " << target.arch << "-" << target.os << "\n";
+  return key.str();
+}
+
+string Module::compile() {
+  compiled = shared_future<void>();
+  return buildLibrary(generateLibrary());
+}
+
+bool Module::tryCompile() {
+  compiled = shared_future<void>();
+  bool succeeded = true;
+  buildLibrary(generateLibrary(), &succeeded);
+  return succeeded;
+}
+
+shared_future<void> Module::compileAsync() {
+  // Code generation is not thread safe, so we generate the source on the
+  // calling thread and only run the compiler in the background.
+  LibraryBuild build = generateLibrary();
+  compiled = getCompilePool().submit([this, build]() {
+    buildLibrary(build);
+  }).share();
+  return compiled;
+}
+
+Module::LibraryBuild Module::generateLibrary() {
+  LibraryBuild build;
+  build.prefix = tmpdir+libname;
+  build.fullpath = build.prefix + ".so";
+  
+  build.cc = util::getFromEnv("TACO_CC", "cc");
+  build.cflags = getCFlags(build.cc) + " -shared -fPIC";
 
   // open the output file & write out the source
   compileToSource(tmpdir, libname);
   
   // write out the shims
   writeShims(funcs, tmpdir, libname);
-  
+
+  // Libraries are cached by a hash of their source and compiler flags, and
+  // the key is stored next to the library to guard against hash collisions.
+  string cachedir = util::getCachedir();
+  if (cachedir != "") {
+    build.key = getCacheKey(build.cc, build.cflags);
+    build.cacheprefix = cachedir + util::hash(build.key);
+  }
+  return build;
+}
+
+string Module::buildLibrary(const LibraryBuild& build, bool* succeeded) {
+  string fullpath = build.fullpath;
+  const string& cacheprefix = build.cacheprefix;
+
+  // Cached libraries that cannot be loaded, such as truncated ones, are
+  // compiled again and replaced
+  if (cacheprefix != "" &&
+      access((cacheprefix + ".so").c_str(), R_OK) == 0 &&
+      readFile(cacheprefix + ".key") == build.key) {
+    lib_handle = dlopen((cacheprefix + ".so").data(), RTLD_NOW | RTLD_LOCAL);
+    if (lib_handle != nullptr) {
+      setNumThreadsFunc = dlsym(lib_handle, "omp_set_num_threads");
+      return cacheprefix + ".so";
+    }
+  }
+
+  // Compile into a file that is unique to this module, so that other
+  // processes never see a partially written library in the cache.
+  string unique = "." + to_string(getpid()) + "." + libname;
+  string output = (cacheprefix != "") ? cacheprefix + unique + ".so"
+                                      : fullpath;
+  string cmd = build.cc + " " + build.cflags + " " +
+    build.prefix + ".c " +
+    build.prefix + "_shims.c " +
+    "-o " + output;
+
   // now compile it
   int err = system(cmd.data());
+  if (err != 0 && succeeded != nullptr) {
+    *succeeded = false;
+    return "";
+  }
   taco_uassert(err == 0) << "Compilation command failed:\n" << cmd
     << "\nreturned " << err;
 
+  // move the library into the cache
+  if (cacheprefix != "") {
+    ofstream key_file;
+    key_file.open(cacheprefix + unique + ".key");
+    key_file << build.key;
+    key_file.close();
+    if (rename((cacheprefix + unique + ".key").c_str(),
+               (cacheprefix + ".key").c_str()) == 0 &&
+        rename(output.c_str(), (cacheprefix + ".so").c_str()) == 0) {
+      fullpath = cacheprefix + ".so";
+    }
+    else {
+      fullpath = output;
+    }
+  }
+
   // use dlsym() to open the compiled library
   lib_handle = dlopen(fullpath.data(), RTLD_NOW | RTLD_LOCAL);
+  if (lib_handle == nullptr && succeeded != nullptr) {
+    *succeeded = false;
+    return "";
+  }
+  taco_uassert(lib_handle != nullptr) << "Error loading " << fullpath << ": "
+    << dlerror();
+  setNumThreadsFunc = dlsym(lib_handle, "omp_set_num_threads");
 
   return fullpath;
 }
@@ -126,16 +326,34 @@ string Module::getSource() {
 }
 
 void* Module::getFunc(std::string name) {
+  if (externalFuncs.count(name) > 0) {
+    return externalFuncs.at(name);
+  }
+  if (compiled.valid()) {
+    compiled.wait();
+  }
   return dlsym(lib_handle, name.data());
 }
 
-int Module::callFuncPackedRaw(std::string name, void** args) {
+int Module::callFuncPackedRaw(std::string name, void** args,
+                              int numThreads) {
+  return callFunc(getFunc(name), args, numThreads);
+}
+
+int Module::callFunc(void* v_func_ptr, void** args, int numThreads) {
   typedef int (*fnptr_t)(void**);
   static_assert(sizeof(void*) == sizeof(fnptr_t),
     "Unable to cast dlsym() returned void pointer to function pointer");
-  void* v_func_ptr = getFunc(name);
   fnptr_t func_ptr;
   *reinterpret_cast<void**>(&func_ptr) = v_func_ptr;
+
+  // The OpenMP thread count is per calling thread, so set it on every call
+  if (setNumThreadsFunc != nullptr) {
+    typedef void (*setnumthreads_t)(int);
+    setnumthreads_t setNumThreads;
+    *reinterpret_cast<void**>(&setNumThreads) = setNumThreadsFunc;
+    setNumThreads((numThreads > 0) ? numThreads : taco::getNumThreads());
+  }
   return func_ptr(args);
 }
 
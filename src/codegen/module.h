@@ -5,25 +5,51 @@
 #include <vector>
 #include <string>
 #include <utility>
+#include <future>
 
 #include "taco/target.h"
 #include "taco/ir/ir.h"
 #include "codegen_c.h"
 
 namespace taco {
+namespace util {
+class ThreadPool;
+}
 namespace ir {
 
+/// Returns the pool that runs background compiler invocations. The pool runs
+/// tasks in the order they are submitted.
+util::ThreadPool& getCompilePool();
+
 class Module {
 public:
   /// Create a module for some target
   Module(Target target=getTargetFromEnvironment())
-    : moduleFromUserSource(false), target(target) {
+    : lib_handle(nullptr), setNumThreadsFunc(nullptr),
+      moduleFromUserSource(false), target(target) {
     setJITLibname();
     setJITTmpdir();
   }
 
-  /// Compile the source into a library, returning its full path
+  /// Waits for background compilation to finish before destroying the module.
+  ~Module();
+
+  /// Compile the source into a library, returning its full path. The library
+  /// is compiled with OpenMP if the C compiler supports it. Libraries
+  /// are cached on disk in `util::getCachedir()`, keyed by their source,
+  /// compiler, compiler flags and target, so a module with the same source
+  /// as a previously compiled one skips the compiler.
   std::string compile();
+
+  /// Compile the source into a library like `compile`, but return false
+  /// instead of failing if the C compiler cannot build or load it.
+  bool tryCompile();
+
+  /// Compile the source into a library on a background thread. The source
+  /// is generated before this function returns, and the returned future is
+  /// ready when the library has been compiled and loaded.  Calls to
+  /// `getFunc` wait for the library.
+  std::shared_future<void> compileAsync();
   
   /// Compile the module into a source file located
   /// at the specified location path and prefix.  The generated
@@ -32,7 +58,8 @@ public:
   
   /// Compile the module into a static library located
   /// at the specified location path and prefix.  The generated
-  /// library will be path/prefix.a
+  /// library will be path/prefix.a, and path/prefix.h declares the kernels
+  /// and their `_shim_` entry points.
   void compileToStaticLibrary(std::string path, std::string prefix);
   
   /// Add a lowered function to this module */
@@ -47,24 +74,37 @@ public:
   /// returned.
   void *getFunc(std::string name);
   
-  /// Call a raw function in this module and return the result
-  int callFuncPackedRaw(std::string name, void** args);
+  /// Provide a function that is already linked into the program, such as
+  /// one from a library built by `compileToStaticLibrary`. `getFunc` returns
+  /// it instead of looking it up in the compiled library.
+  void setFunc(std::string name, void* func);
+
+  /// Call a function returned by `getFunc` with raw arguments and return the
+  /// result. Parallel loops run with `numThreads` threads, or with
+  /// `taco::getNumThreads()` threads if it is zero.
+  int callFunc(void* func, void** args, int numThreads=0);
+
+  /// Call a raw function in this module and return the result, like
+  /// `callFunc`.
+  int callFuncPackedRaw(std::string name, void** args, int numThreads=0);
   
   /// Call a raw function in this module and return the result
-  int callFuncPackedRaw(std::string name, std::vector<void*> args) {
-    return callFuncPackedRaw(name, args.data());
+  int callFuncPackedRaw(std::string name, std::vector<void*> args,
+                        int numThreads=0) {
+    return callFuncPackedRaw(name, args.data(), numThreads);
   }
   
   /// Call a function using the taco_tensor_t interface and return
   /// the result
-  int callFuncPacked(std::string name, void** args) {
-    return callFuncPackedRaw("_shim_"+name, args);
+  int callFuncPacked(std::string name, void** args, int numThreads=0) {
+    return callFuncPackedRaw("_shim_"+name, args, numThreads);
   }
   
   /// Call a function using the taco_tensor_t interface and return
   /// the result
-  int callFuncPacked(std::string name, std::vector<void*> args) {
-    return callFuncPacked(name, args.data());
+  int callFuncPacked(std::string name, std::vector<void*> args,
+                     int numThreads=0) {
+    return callFuncPacked(name, args.data(), numThreads);
   }
   
   /// Set the source of the module
@@ -76,7 +116,10 @@ private:
   std::string libname;
   std::string tmpdir;
   void* lib_handle;
+  void* setNumThreadsFunc;
   std::vector<Stmt> funcs;
+  std::map<std::string, void*> externalFuncs;
+  std::shared_future<void> compiled;
   
   // true iff the module was created from user-provided source
   bool moduleFromUserSource;
@@ -85,6 +128,31 @@ private:
   
   void setJITLibname();
   void setJITTmpdir();
+
+  /// Returns the string that identifies this module in the kernel cache.
+  std::string getCacheKey(std::string cc, std::string cflags);
+
+  /// The generated files and commands needed to build a library.
+  struct LibraryBuild {
+    std::string prefix;
+    std::string fullpath;
+    std::string cc;
+    std::string cflags;
+    std::string key;
+    std::string cacheprefix;
+  };
+
+  /// Write the module source to the tmpdir.
+  LibraryBuild generateLibrary();
+
+  /// Returns the C compiler flags.
+  std::string getCFlags(std::string cc);
+
+  /// Compile (or find in the cache) and load a generated library, returning
+  /// its full path. If `succeeded` is given, a failed build sets it to false
+  /// and returns an empty path instead of failing.
+  std::string buildLibrary(const LibraryBuild& build,
+                           bool* succeeded=nullptr);
 };
 
 } // namespace ir
@@ -114,6 +114,10 @@ const Schedule& TensorVar::getSchedule() const {
   return content->schedule;
 }
 
+void TensorVar::setSchedule(const Schedule& schedule) {
+  content->schedule.setParallelSchedule(schedule.getParallelSchedule(),
+                                        schedule.getChunkSize());
+}
 
 void TensorVar::setIndexExpression(vector<IndexVar> freeVars,
                                    IndexExpr indexExpr, bool accumulate) {
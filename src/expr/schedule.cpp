@@ -5,6 +5,7 @@
 #include "taco/expr/expr.h"
 #include "taco/util/collections.h"
 #include "taco/util/strings.h"
+#include "taco/error.h"
 
 using namespace std;
 
@@ -49,9 +50,29 @@ std::ostream& operator<<(std::ostream& os, const OperatorSplit& split) {
 }
 
 
+std::ostream& operator<<(std::ostream& os,
+                         const ParallelSchedule& parallelSchedule) {
+  switch (parallelSchedule) {
+    case ParallelSchedule::Default:
+      return os << "default";
+    case ParallelSchedule::Static:
+      return os << "static";
+    case ParallelSchedule::Dynamic:
+      return os << "dynamic";
+    case ParallelSchedule::Guided:
+      return os << "guided";
+    case ParallelSchedule::Balanced:
+      return os << "balanced";
+  }
+  return os;
+}
+
+
 // class Schedule
 struct Schedule::Content {
   map<IndexExpr, vector<OperatorSplit>> operatorSplits;
+  ParallelSchedule parallelSchedule = ParallelSchedule::Default;
+  int chunkSize = 0;
 };
 
 Schedule::Schedule() : content(new Content) {
@@ -80,11 +101,35 @@ void Schedule::clearOperatorSplits() {
   content->operatorSplits.clear();
 }
 
+void Schedule::setParallelSchedule(ParallelSchedule parallelSchedule,
+                                   int chunkSize) {
+  taco_uassert(chunkSize >= 0) << "The chunk size must not be negative";
+  content->parallelSchedule = parallelSchedule;
+  content->chunkSize = chunkSize;
+}
+
+ParallelSchedule Schedule::getParallelSchedule() const {
+  return content->parallelSchedule;
+}
+
+int Schedule::getChunkSize() const {
+  return content->chunkSize;
+}
+
 std::ostream& operator<<(std::ostream& os, const Schedule& schedule) {
   auto operatorSplits = schedule.getOperatorSplits();
   if (operatorSplits.size() > 0) {
     os << "Operator Splits:" << endl << util::join(operatorSplits, "\n");
   }
+  if (schedule.getParallelSchedule() != ParallelSchedule::Default) {
+    if (operatorSplits.size() > 0) {
+      os << endl;
+    }
+    os << "Parallel Schedule: " << schedule.getParallelSchedule();
+    if (schedule.getChunkSize() > 0) {
+      os << ", " << schedule.getChunkSize();
+    }
+  }
   return os;
 }
 
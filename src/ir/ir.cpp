@@ -351,7 +351,7 @@ Stmt Case::make(std::vector<std::pair<Expr,Stmt>> clauses, bool alwaysMatch) {
 
 // For loop
 Stmt For::make(Expr var, Expr start, Expr end, Expr increment, Stmt contents,
-  LoopKind kind, int vec_width) {
+  LoopKind kind, int vec_width, int chunk_size, Expr balance_pos) {
   For *loop = new For;
   loop->var = var;
   loop->start = start;
@@ -360,6 +360,8 @@ Stmt For::make(Expr var, Expr start, Expr end, Expr increment, Stmt contents,
   loop->contents = Scope::make(contents);
   loop->kind = kind;
   loop->vec_width = vec_width;
+  loop->chunk_size = chunk_size;
+  loop->balance_pos = balance_pos;
   return loop;
 }
 
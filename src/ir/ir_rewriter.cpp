@@ -217,13 +217,15 @@ void IRRewriter::visit(const For* op) {
   Expr end       = rewrite(op->end);
   Expr increment = rewrite(op->increment);
   Stmt contents  = rewrite(op->contents);
+  Expr balancePos = rewrite(op->balance_pos);
   if (var == op->var && start == op->start && end == op->end &&
-      increment == op->increment && contents == op->contents) {
+      increment == op->increment && contents == op->contents &&
+      balancePos == op->balance_pos) {
     stmt = op;
   }
   else {
     stmt = For::make(var, start, end, increment, contents, op->kind,
-                     op->vec_width);
+                     op->vec_width, op->chunk_size, balancePos);
   }
 }
 
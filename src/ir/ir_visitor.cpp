@@ -141,6 +141,9 @@ void IRVisitor::visit(const For* op) {
   op->start.accept(this);
   op->end.accept(this);
   op->increment.accept(this);
+  if (op->balance_pos.defined()) {
+    op->balance_pos.accept(this);
+  }
   op->contents.accept(this);
 }
 
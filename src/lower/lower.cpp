@@ -8,6 +8,7 @@
 
 #include "taco/ir/ir.h"
 #include "taco/ir/ir_visitor.h"
+#include "taco/ir/ir_rewriter.h"
 #include "ir/ir_codegen.h"
 
 #include "lower_codegen.h"
@@ -45,6 +46,9 @@ struct Context {
   /// The size of initial memory allocations
   Expr                 allocSize;
 
+  /// The schedule that determines how parallel loops are distributed
+  Schedule             schedule;
+
   /// Maps tensor (scalar) temporaries to IR variables.
   /// (Not clear if this approach to temporaries is too hacky.)
   map<TensorVar,Expr> temporaries;
@@ -168,8 +172,11 @@ static void emitComputeExpr(const Target& target, const IndexVar& indexVar,
   }
 }
 
+/// Returns the kind of the loop over `indexVar`, or `LoopKind::Serial` if the
+/// loop can't be parallelized. If the loop is balanced then `balancePos` is
+/// set to the pos array of the sparse level below it.
 static LoopKind doParallelize(const IndexVar& indexVar, const Expr& tensor, 
-                              const Context& ctx) {
+                              const Context& ctx, Expr* balancePos) {
   if (ctx.iterationGraph.getAncestors(indexVar).size() != 1 ||
       ctx.iterationGraph.isReduction(indexVar)) {
     return LoopKind::Serial;
@@ -193,6 +200,30 @@ static LoopKind doParallelize(const IndexVar& indexVar, const Expr& tensor,
     return TensorPath();
   }();
 
+  switch (ctx.schedule.getParallelSchedule()) {
+    case ParallelSchedule::Static:
+      return LoopKind::Static;
+    case ParallelSchedule::Dynamic:
+      return LoopKind::Dynamic;
+    case ParallelSchedule::Guided:
+      return LoopKind::Guided;
+    case ParallelSchedule::Balanced: {
+      // The sparse level below a loop over the first level of a tensor is
+      // segmented by a pos array indexed by the loop variable.
+      if (parallelizedAccess.getSize() >= 2 &&
+          parallelizedAccess.getStep(0).getStep() == 0) {
+        Iterator next = ctx.iterators[parallelizedAccess.getStep(1)];
+        if (!next.isDense() && isa<Load>(next.begin())) {
+          *balancePos = to<Load>(next.begin())->arr;
+          return LoopKind::Balanced;
+        }
+      }
+      return LoopKind::Static;
+    }
+    case ParallelSchedule::Default:
+      break;
+  }
+
   if (parallelizedAccess.getSize() <= 2) {
     return LoopKind::Static;
   }
@@ -487,9 +518,12 @@ static vector<Stmt> lower(const Target&    target,
     }
     else {
       Iterator iter = lp.getRangeIterators()[0];
+      Expr balancePos;
+      LoopKind kind = doParallelize(indexVar, iter.getTensor(), ctx,
+                                    &balancePos);
       loop = For::make(iter.getIteratorVar(), iter.begin(), iter.end(), 1,
-                       Block::make(loopBody), 
-                       doParallelize(indexVar, iter.getTensor(), ctx));
+                       Block::make(loopBody), kind, 0,
+                       ctx.schedule.getChunkSize(), balancePos);
     }
     loops.push_back(loop);
   }
@@ -507,6 +541,196 @@ static vector<Stmt> lower(const Target&    target,
   return code;
 }
 
+/// Removes stores to, and resizes of, the index arrays of a result level.
+struct RemoveResultIndexStores : public IRRewriter {
+  Expr tensor;
+  int mode;
+  bool removePos;
+  bool removeIdx;
+
+  bool isIndexArray(const Expr& arr, int index) {
+    const GetProperty* property = arr.as<GetProperty>();
+    return property != nullptr && property->tensor == tensor &&
+           property->property == TensorProperty::Indices &&
+           property->mode == mode && property->index == index;
+  }
+
+  static bool isEmpty(const Stmt& stmt) {
+    if (!stmt.defined()) {
+      return true;
+    }
+    if (isa<Scope>(stmt)) {
+      return isEmpty(to<Scope>(stmt)->scopedStmt);
+    }
+    if (isa<Block>(stmt)) {
+      for (auto& content : to<Block>(stmt)->contents) {
+        if (!isEmpty(content)) {
+          return false;
+        }
+      }
+      return true;
+    }
+    return false;
+  }
+
+  using IRRewriter::visit;
+
+  void visit(const Store* op) {
+    if ((removePos && isIndexArray(op->arr, 0)) ||
+        (removeIdx && isIndexArray(op->arr, 1))) {
+      stmt = Stmt();
+    }
+    else {
+      stmt = op;
+    }
+  }
+
+  void visit(const Allocate* op) {
+    if (op->is_realloc && (isIndexArray(op->var, 0) ||
+                           isIndexArray(op->var, 1))) {
+      stmt = Stmt();
+    }
+    else {
+      stmt = op;
+    }
+  }
+
+  void visit(const IfThenElse* op) {
+    Stmt then = rewrite(op->then);
+    Stmt otherwise = rewrite(op->otherwise);
+    if (isEmpty(then) && isEmpty(otherwise)) {
+      stmt = Stmt();
+    }
+    else if (then == op->then && otherwise == op->otherwise) {
+      stmt = op;
+    }
+    else {
+      stmt = IfThenElse::make(op->cond, isEmpty(then) ? Block::make() : then,
+                              otherwise);
+    }
+  }
+};
+
+/// Returns the dense iterator of the first level of a tensor that the loop
+/// iterates over, or an undefined iterator if the loop is over a sparse level.
+static Iterator getDenseRowIterator(const For* loop, const Context& ctx) {
+  for (auto& path : ctx.iterationGraph.getTensorPaths()) {
+    if (path.getSize() == 0) {
+      continue;
+    }
+    Iterator iterator = ctx.iterators[path.getStep(0)];
+    if (iterator.getIteratorVar() == loop->var) {
+      return iterator.isDense() ? iterator : Iterator();
+    }
+  }
+  return Iterator();
+}
+
+/// Parallelizes the loop over the rows of a result whose first level is
+/// dense and whose second level is sparse (e.g. CSR). Rows are independent
+/// once each starts at its own position in the result, so the compute loop
+/// starts every row at its segment in the result `pos` array. Assembly is
+/// split into a parallel pass that counts the size of every row, a prefix
+/// sum over the counts that yields the `pos` array, and a parallel pass that
+/// fills the exactly sized `idx` array. Returns the loop nest unchanged if
+/// the result or loop nest does not have this form.
+static vector<Stmt> parallelizeSparseOutput(const vector<Stmt>& loopNest,
+                                            const Context& ctx) {
+  bool emitCompute  = util::contains(ctx.properties, Compute);
+  bool emitAssemble = util::contains(ctx.properties, Assemble);
+  const TensorPath& resultPath = ctx.iterationGraph.getResultTensorPath();
+  if (emitCompute == emitAssemble ||
+      util::contains(ctx.properties, Accumulate) ||
+      resultPath.getSize() != 2 ||
+      ctx.iterationGraph.getRoots().size() != 1 ||
+      ctx.iterationGraph.getRoots()[0] != resultPath.getVariables()[0] ||
+      loopNest.size() != 1 || !isa<For>(loopNest[0])) {
+    return loopNest;
+  }
+
+  Iterator rows = ctx.iterators[resultPath.getStep(0)];
+  Iterator cols = ctx.iterators[resultPath.getStep(1)];
+  const For* loop = to<For>(loopNest[0]);
+  if (!rows.isDense() || cols.isDense() || !isa<Load>(cols.begin()) ||
+      !getDenseRowIterator(loop, ctx).defined()) {
+    return loopNest;
+  }
+
+  Expr pos = cols.getPtrVar();
+  Expr posArr = to<Load>(cols.begin())->arr;
+  Expr numRows = rows.end();
+
+  LoopKind kind = LoopKind::Dynamic;
+  Expr balancePos;
+  switch (ctx.schedule.getParallelSchedule()) {
+    case ParallelSchedule::Static:
+      kind = LoopKind::Static;
+      break;
+    case ParallelSchedule::Guided:
+      kind = LoopKind::Guided;
+      break;
+    case ParallelSchedule::Balanced:
+      // Only the compute loop knows the size of the rows up front
+      if (emitCompute) {
+        kind = LoopKind::Balanced;
+        balancePos = posArr;
+      }
+      break;
+    case ParallelSchedule::Default:
+    case ParallelSchedule::Dynamic:
+      break;
+  }
+  int chunkSize = ctx.schedule.getChunkSize();
+
+  RemoveResultIndexStores removeStores;
+  removeStores.tensor = rows.getTensor();
+  removeStores.mode = resultPath.getStep(1).getStep();
+
+  vector<Stmt> code;
+  if (emitCompute) {
+    // Start every row at its segment of the assembled result
+    removeStores.removePos = false;
+    removeStores.removeIdx = false;
+    Stmt body = Block::make({VarAssign::make(pos, Load::make(posArr, loop->var),
+                                             true),
+                             removeStores.rewrite(loop->contents)});
+    code.push_back(For::make(loop->var, loop->start, loop->end,
+                             loop->increment, body, kind, 0, chunkSize,
+                             balancePos));
+  }
+  else {
+    // Count the size of every row into `pos`
+    code.push_back(cols.resizePtrStorage(Add::make(numRows, 1)));
+    removeStores.removePos = false;
+    removeStores.removeIdx = true;
+    Stmt countBody = Block::make({VarAssign::make(pos, 0, true),
+                                  removeStores.rewrite(loop->contents)});
+    code.push_back(For::make(loop->var, loop->start, loop->end,
+                             loop->increment, countBody, kind, 0, chunkSize));
+
+    // Prefix sum the counts
+    Expr row = Var::make("r" + to<Var>(rows.getTensor())->name,
+                         DataType(DataType::Int));
+    Stmt sum = Store::make(posArr, Add::make(row, 1),
+                           Add::make(Load::make(posArr, Add::make(row, 1)),
+                                     Load::make(posArr, row)));
+    code.push_back(For::make(row, 0, numRows, 1, sum));
+    code.push_back(cols.resizeIdxStorage(Load::make(posArr, numRows)));
+
+    // Fill the index of every row
+    removeStores.removePos = true;
+    removeStores.removeIdx = false;
+    Stmt fillBody = Block::make({VarAssign::make(pos,
+                                                 Load::make(posArr, loop->var),
+                                                 true),
+                                 removeStores.rewrite(loop->contents)});
+    code.push_back(For::make(loop->var, loop->start, loop->end,
+                             loop->increment, fillBody, kind, 0, chunkSize));
+    code.push_back(VarAssign::make(pos, Load::make(posArr, numRows)));
+  }
+  return code;
+}
+
 Stmt lower(TensorVar tensorVar, string functionName, set<Property> properties,
            int allocSize) {
   const bool emitAssemble = util::contains(properties, Assemble);
@@ -528,6 +752,7 @@ Stmt lower(TensorVar tensorVar, string functionName, set<Property> properties,
 
   IterationGraph iterationGraph = IterationGraph::make(tensorVar);
   Context ctx(iterationGraph, properties, tensorVars);
+  ctx.schedule = schedule;
 
   vector<Stmt> init, body;
 
@@ -627,7 +852,7 @@ Stmt lower(TensorVar tensorVar, string functionName, set<Property> properties,
     if (emitLoops) {
       for (auto& root : roots) {
         auto loopNest = lower::lower(target, indexExpr, root, ctx);
-        util::append(body, loopNest);
+        util::append(body, parallelizeSparseOutput(loopNest, ctx));
       }
     }
 
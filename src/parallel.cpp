@@ -0,0 +1,34 @@
+#include "taco/parallel.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "taco/error.h"
+#include "taco/util/env.h"
+
+using namespace std;
+
+namespace taco {
+
+static atomic<int>& numThreads() {
+  static atomic<int> numThreads([]() {
+    string numThreads = util::getFromEnv("TACO_NUM_THREADS", "");
+    int defaultNumThreads = (numThreads != "")
+                            ? stoi(numThreads)
+                            : (int)thread::hardware_concurrency();
+    return (defaultNumThreads > 0) ? defaultNumThreads : 1;
+  }());
+  return numThreads;
+}
+
+void setNumThreads(int num) {
+  taco_uassert(num > 0) << "The number of threads must be positive";
+  numThreads() = num;
+}
+
+int getNumThreads() {
+  return numThreads();
+}
+
+}
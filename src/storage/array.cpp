@@ -15,9 +15,10 @@ namespace storage {
 
 struct Array::Content : util::Uncopyable {
   DataType   type;
-  void*  data;
-  size_t size;
+  void*  data = nullptr;
+  size_t size = 0;
   Policy policy = Array::UserOwns;
+  std::shared_ptr<void> owner;
 
   ~Content() {
     switch (policy) {
@@ -93,6 +94,14 @@ Array::Array(DataType type, void* data, size_t size, Policy policy) : Array() {
   content->policy = policy;
 }
 
+Array::Array(DataType type, void* data, size_t size,
+             std::shared_ptr<void> owner) : Array() {
+  content->type = type;
+  content->data = data;
+  content->size = size;
+  content->owner = owner;
+}
+
 const DataType& Array::getType() const {
   return content->type;
 }
@@ -0,0 +1,153 @@
+#ifndef TACO_STORAGE_COMPONENT_OPS_H
+#define TACO_STORAGE_COMPONENT_OPS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+
+#include "taco/type.h"
+#include "taco/error.h"
+
+namespace taco {
+namespace storage {
+
+/// The largest errors between two arrays of components, and the position of
+/// the first pair of components that are not within the tolerance.
+struct ComponentErrors {
+  size_t firstMismatch = SIZE_MAX;
+  double maxAbsError = 0.0;
+  double maxRelError = 0.0;
+};
+
+/// True iff `a` and `b` are within `absTolerance + relTolerance * max(|a|,|b|)`
+/// of each other. Equal components, including NaNs and infinities of the same
+/// sign, have no error, while NaNs compared to other components have infinite
+/// error.
+inline bool isWithinTolerance(double a, double b, double relTolerance,
+                              double absTolerance, double* absError,
+                              double* relError) {
+  bool isSame = (a == b) || (a != a && b != b);
+  double scale = std::max(std::fabs(a), std::fabs(b));
+  double error = isSame ? 0.0 : std::fabs(a - b);
+  error = (error == error) ? error : INFINITY;
+  *absError = error;
+  *relError = (error == 0.0 || error == INFINITY) ? error : error / scale;
+  return isSame ||
+         (error != INFINITY && error <= absTolerance + relTolerance * scale);
+}
+
+/// Type-erased operations on tensor components, used to pack coordinates of
+/// any component type.
+struct ComponentOps {
+  /// Store `value` converted to the component type at `component`.
+  void (*store)(char* component, double value);
+
+  /// Add `summand` to `sum`.
+  void (*add)(char* sum, const char* summand);
+
+  /// Compare the `size` components at `a` with those at `b`.
+  ComponentErrors (*compare)(const char* a, const char* b, size_t size,
+                             double relTolerance, double absTolerance);
+
+  /// Print the component at `component`, with 8-bit integers as numbers.
+  void (*print)(std::ostream& os, const char* component);
+};
+
+/// Compares arrays of components in a branch-free loop that the compiler can
+/// vectorize, and only looks for the first mismatch if there is one.
+template <typename T>
+ComponentErrors compareComponents(const char* a, const char* b, size_t size,
+                                  double relTolerance, double absTolerance) {
+  const T* x = reinterpret_cast<const T*>(a);
+  const T* y = reinterpret_cast<const T*>(b);
+  ComponentErrors errors;
+  size_t numMismatches = 0;
+  for (size_t i = 0; i < size; i++) {
+    double absError, relError;
+    numMismatches += !isWithinTolerance((double)x[i], (double)y[i],
+                                        relTolerance, absTolerance,
+                                        &absError, &relError);
+    errors.maxAbsError = std::max(errors.maxAbsError, absError);
+    errors.maxRelError = std::max(errors.maxRelError, relError);
+  }
+  for (size_t i = 0; numMismatches > 0 && i < size; i++) {
+    double absError, relError;
+    if (!isWithinTolerance((double)x[i], (double)y[i], relTolerance,
+                           absTolerance, &absError, &relError)) {
+      errors.firstMismatch = i;
+      break;
+    }
+  }
+  return errors;
+}
+
+template <typename T>
+ComponentOps getComponentOps() {
+  ComponentOps ops;
+  ops.store = [](char* component, double value) {
+    T converted = (T)value;
+    memcpy(component, &converted, sizeof(T));
+  };
+  ops.add = [](char* sum, const char* summand) {
+    T a, b;
+    memcpy(&a, sum, sizeof(T));
+    memcpy(&b, summand, sizeof(T));
+    a = (T)(a + b);
+    memcpy(sum, &a, sizeof(T));
+  };
+  ops.compare = compareComponents<T>;
+  ops.print = [](std::ostream& os, const char* component) {
+    T value;
+    memcpy(&value, component, sizeof(T));
+    os << +value;
+  };
+  return ops;
+}
+
+inline ComponentOps getComponentOps(const DataType& type) {
+  switch (type.getKind()) {
+    case DataType::Bool:
+      return getComponentOps<bool>();
+    case DataType::UInt:
+      switch (type.getNumBits()) {
+        case 8:
+          return getComponentOps<uint8_t>();
+        case 16:
+          return getComponentOps<uint16_t>();
+        case 32:
+          return getComponentOps<uint32_t>();
+        case 64:
+          return getComponentOps<uint64_t>();
+      }
+      break;
+    case DataType::Int:
+      switch (type.getNumBits()) {
+        case 8:
+          return getComponentOps<int8_t>();
+        case 16:
+          return getComponentOps<int16_t>();
+        case 32:
+          return getComponentOps<int32_t>();
+        case 64:
+          return getComponentOps<int64_t>();
+      }
+      break;
+    case DataType::Float:
+      switch (type.getNumBits()) {
+        case 32:
+          return getComponentOps<float>();
+        case 64:
+          return getComponentOps<double>();
+      }
+      break;
+    case DataType::Undefined:
+      break;
+  }
+  taco_ierror << "Unsupported component type " << type;
+  return getComponentOps<double>();
+}
+
+}}
+#endif
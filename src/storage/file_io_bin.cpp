@@ -0,0 +1,315 @@
+#include "taco/storage/file_io_bin.h"
+
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "taco/tensor.h"
+#include "taco/error.h"
+#include "taco/storage/index.h"
+#include "taco/storage/array.h"
+#include "taco/storage/array_util.h"
+#include "taco/util/files.h"
+#include "taco/util/parallel_for.h"
+
+using namespace std;
+
+using namespace taco::storage;
+
+namespace taco {
+
+static const char   binMagic[8]  = {'T','A','C','O','B','I','N','\0'};
+static const size_t binVersion   = 1;
+static const size_t binAlignment = 64;
+
+/// The header of a binary tensor file is a sequence of 64-bit words: the
+/// magic bytes, the version, the order, the component type kind and bits,
+/// the dimension of every mode, the type and ordering of every level, the
+/// number of arrays and the offset and size of every array. The arrays are
+/// the index arrays of every level followed by the value array.
+static size_t getHeaderSize(size_t order, size_t numArrays) {
+  size_t numWords = 1 + 4 + order + 2 * order + 1 + 2 * numArrays;
+  return numWords * sizeof(uint64_t);
+}
+
+static size_t alignOffset(size_t offset) {
+  return (offset + binAlignment - 1) / binAlignment * binAlignment;
+}
+
+/// Returns the number of index arrays of a level.
+static size_t getNumIndexArrays(ModeType modeType) {
+  return (modeType == Dense) ? 1 : 2;
+}
+
+/// Returns true iff the `size` coordinates at `idx` are in [0, dimension),
+/// checking blocks of them in parallel.
+static bool isInBounds(const int* idx, size_t size, size_t dimension) {
+  const size_t numBlocks = util::getNumBlocks(size, 1 << 16);
+  vector<char> isBlockInBounds(numBlocks, true);
+  util::parallelFor(numBlocks, [&](size_t block) {
+    size_t end = util::getBlockBegin(size, numBlocks, block + 1);
+    for (size_t i = util::getBlockBegin(size, numBlocks, block); i < end; i++) {
+      isBlockInBounds[block] &= (idx[i] >= 0 && (size_t)idx[i] < dimension);
+    }
+  });
+  return std::find(isBlockInBounds.begin(), isBlockInBounds.end(), false) ==
+         isBlockInBounds.end();
+}
+
+/// Builds a tensor from a binary tensor image at `data` that is kept alive by
+/// `owner`, wrapping its arrays in place.
+static TensorBase readImage(char* data, size_t size,
+                            const shared_ptr<void>& owner,
+                            const Format& format) {
+  taco_uassert(size >= 2 * sizeof(uint64_t) &&
+               memcmp(data, binMagic, sizeof(binMagic)) == 0) <<
+      "Not a taco binary tensor file";
+  const uint64_t* words = (const uint64_t*)data;
+  taco_uassert(words[1] == binVersion) <<
+      "Unsupported taco binary tensor version " << words[1];
+  taco_uassert(size >= getHeaderSize(0, 0)) << "Truncated binary tensor file";
+  const size_t order = words[2];
+  const size_t maxWords = size / sizeof(uint64_t);
+  taco_uassert(order <= maxWords && size >= getHeaderSize(order, 0)) <<
+      "Truncated binary tensor file";
+  const uint64_t kind = words[3];
+  const uint64_t bits = words[4];
+  taco_uassert((kind == DataType::Bool && bits == sizeof(bool)) ||
+               ((kind == DataType::UInt || kind == DataType::Int) &&
+                (bits == 8 || bits == 16 || bits == 32 || bits == 64)) ||
+               (kind == DataType::Float && (bits == 32 || bits == 64))) <<
+      "Unsupported component type in binary tensor file (kind " << kind <<
+      ", " << bits << " bits)";
+  DataType ctype((DataType::Kind)kind, bits);
+  const uint64_t* word = &words[5];
+
+  vector<int> dimensions;
+  for (size_t i = 0; i < order; i++) {
+    taco_uassert(*word <= INT_MAX) << "Corrupt binary tensor file";
+    dimensions.push_back((int)*word++);
+  }
+  vector<ModeType> modeTypes;
+  vector<size_t> modeOrdering;
+  vector<bool> isOrdered(order, false);
+  for (size_t i = 0; i < order; i++) {
+    taco_uassert(word[0] <= Fixed && word[1] < order && !isOrdered[word[1]]) <<
+        "Corrupt binary tensor file";
+    modeTypes.push_back((ModeType)*word++);
+    modeOrdering.push_back(*word++);
+    isOrdered[modeOrdering.back()] = true;
+  }
+  const size_t numArrays = *word++;
+  taco_uassert(numArrays <= maxWords &&
+               size >= getHeaderSize(order, numArrays)) <<
+      "Truncated binary tensor file";
+
+  // Check that every array lies within the image
+  vector<pair<const char*,size_t>> images;
+  for (size_t i = 0; i < numArrays; i++) {
+    size_t offset = *word++;
+    size_t arraySize = *word++;
+    size_t numBytes = (i + 1 < numArrays) ? sizeof(int) : ctype.getNumBytes();
+    taco_uassert(offset <= size && arraySize <= (size - offset) / numBytes) <<
+        "Truncated binary tensor file";
+    images.push_back({data + offset, arraySize});
+  }
+
+  // Check that the index arrays of every level fit the arrays below it and
+  // that their coordinates are within the dimensions, so that no position or
+  // coordinate points outside of them
+  size_t array = 0;
+  size_t numPositions = 1;
+  for (size_t i = 0; i < order; i++) {
+    taco_uassert(array + getNumIndexArrays(modeTypes[i]) < numArrays) <<
+        "Corrupt binary tensor file";
+    const int* first = (const int*)images[array].first;
+    const size_t firstSize = images[array].second;
+    const size_t dimension = dimensions[modeOrdering[i]];
+    switch (modeTypes[i]) {
+      case Dense:
+        taco_uassert(firstSize >= 1 && first[0] >= 0 &&
+                     (size_t)first[0] == dimension) <<
+            "Corrupt binary tensor file";
+        taco_uassert(dimension == 0 || numPositions <= SIZE_MAX / dimension) <<
+            "Corrupt binary tensor file";
+        numPositions *= dimension;
+        break;
+      case Sparse: {
+        taco_uassert(numPositions < firstSize && first[0] == 0) <<
+            "Corrupt binary tensor file";
+        for (size_t p = 0; p < numPositions; p++) {
+          taco_uassert(first[p] <= first[p + 1]) << "Corrupt binary tensor file";
+        }
+        taco_uassert((size_t)first[numPositions] <= images[array + 1].second) <<
+            "Corrupt binary tensor file";
+        numPositions = first[numPositions];
+        taco_uassert(isInBounds((const int*)images[array + 1].first,
+                                numPositions, dimension)) <<
+            "Coordinate in binary tensor file is out of bounds";
+        break;
+      }
+      case Fixed:
+        taco_uassert(firstSize >= 1 && first[0] >= 0 &&
+                     (first[0] == 0 ||
+                      numPositions <= images[array + 1].second / first[0])) <<
+            "Corrupt binary tensor file";
+        numPositions *= first[0];
+        taco_uassert(isInBounds((const int*)images[array + 1].first,
+                                numPositions, dimension)) <<
+            "Coordinate in binary tensor file is out of bounds";
+        break;
+    }
+    array += getNumIndexArrays(modeTypes[i]);
+  }
+  taco_uassert(array + 1 == numArrays &&
+               numPositions <= images[array].second) <<
+      "Corrupt binary tensor file";
+
+  // Wrap every array where it lies in the image
+  vector<Array> arrays;
+  for (size_t i = 0; i < numArrays; i++) {
+    DataType arrayType = (i + 1 < numArrays) ? type<int>() : ctype;
+    arrays.push_back(Array(arrayType, (char*)images[i].first, images[i].second,
+                           owner));
+  }
+
+  Format storedFormat(modeTypes, modeOrdering);
+  vector<ModeIndex> modeIndices;
+  array = 0;
+  for (size_t i = 0; i < order; i++) {
+    vector<Array> indexArrays;
+    for (size_t j = 0; j < getNumIndexArrays(modeTypes[i]); j++) {
+      indexArrays.push_back(arrays[array++]);
+    }
+    modeIndices.push_back(ModeIndex(indexArrays));
+  }
+
+  TensorBase tensor(ctype, dimensions, storedFormat);
+  tensor.getStorage().setIndex(Index(storedFormat, modeIndices));
+  tensor.getStorage().setValues(arrays[array]);
+  return (storedFormat == format) ? tensor : convert(tensor, format);
+}
+
+TensorBase readBIN(std::string filename, const Format& format, bool pack) {
+  string path = util::sanitizePath(filename);
+  int fd = open(path.c_str(), O_RDONLY);
+  taco_uassert(fd != -1) << "Error opening file: " << filename;
+  struct stat status;
+  taco_uassert(fstat(fd, &status) == 0) << "Error reading file: " << filename;
+  size_t size = status.st_size;
+
+  // Pages are mapped copy-on-write, so tensors read from a file can be
+  // modified without changing the file
+  void* data = (size > 0) ? mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE, fd, 0)
+                          : MAP_FAILED;
+  close(fd);
+  taco_uassert(data != MAP_FAILED) << "Error mapping file: " << filename;
+  shared_ptr<void> mapping(data, [size](void* data) { munmap(data, size); });
+  return readImage((char*)data, size, mapping, format);
+}
+
+TensorBase readBIN(std::istream& stream, const Format& format, bool pack) {
+  vector<char> image((istreambuf_iterator<char>(stream)),
+                     istreambuf_iterator<char>());
+  void* data = malloc(image.size());
+  taco_uassert(data != nullptr || image.empty()) <<
+      "Error allocating " << image.size() << " bytes";
+  if (!image.empty()) {
+    memcpy(data, image.data(), image.size());
+  }
+  shared_ptr<void> buffer(data, free);
+  return readImage((char*)data, image.size(), buffer, format);
+}
+
+void writeBIN(std::string filename, const TensorBase& tensor) {
+  std::fstream file;
+  util::openStream(file, filename, fstream::out | fstream::binary);
+  writeBIN(file, tensor);
+  file.close();
+}
+
+void writeBIN(std::ostream& stream, const TensorBase& tensor) {
+  TensorBase packed = tensor.getPacked();
+  const Storage& storage = packed.getStorage();
+  const Format& format = storage.getFormat();
+  const size_t order = format.getOrder();
+  const DataType& ctype = tensor.getComponentType();
+
+  // Collect the used part of every index array and of the value array
+  vector<pair<const void*,size_t>> arrays;
+  size_t size = 1;
+  for (size_t i = 0; i < order; i++) {
+    const ModeIndex modeIndex = storage.getIndex().getModeIndex(i);
+    const int* first = (const int*)modeIndex.getIndexArray(0).getData();
+    switch (format.getModeTypes()[i]) {
+      case Dense:
+        arrays.push_back({first, 1});
+        size *= first[0];
+        break;
+      case Sparse:
+        arrays.push_back({first, size + 1});
+        size = first[size];
+        break;
+      case Fixed:
+        arrays.push_back({first, 1});
+        size *= first[0];
+        break;
+    }
+    if (format.getModeTypes()[i] != Dense) {
+      arrays.push_back({modeIndex.getIndexArray(1).getData(), size});
+    }
+  }
+  arrays.push_back({storage.getValues().getData(), size});
+
+  vector<uint64_t> header(getHeaderSize(order, arrays.size()) /
+                          sizeof(uint64_t));
+  memcpy(header.data(), binMagic, sizeof(binMagic));
+  uint64_t* word = &header[1];
+  *word++ = binVersion;
+  *word++ = order;
+  *word++ = ctype.getKind();
+  *word++ = ctype.getNumBits();
+  for (size_t i = 0; i < order; i++) {
+    *word++ = tensor.getDimension(i);
+  }
+  for (size_t i = 0; i < order; i++) {
+    *word++ = format.getModeTypes()[i];
+    *word++ = format.getModeOrdering()[i];
+  }
+  *word++ = arrays.size();
+  size_t offset = header.size() * sizeof(uint64_t);
+  for (size_t i = 0; i < arrays.size(); i++) {
+    size_t numBytes = (i + 1 < arrays.size()) ? sizeof(int)
+                                              : ctype.getNumBytes();
+    offset = alignOffset(offset);
+    *word++ = offset;
+    *word++ = arrays[i].second;
+    offset += arrays[i].second * numBytes;
+  }
+
+  stream.write((const char*)header.data(), header.size() * sizeof(uint64_t));
+  offset = header.size() * sizeof(uint64_t);
+  const char padding[binAlignment] = {};
+  for (size_t i = 0; i < arrays.size(); i++) {
+    size_t numBytes = (i + 1 < arrays.size()) ? sizeof(int)
+                                              : ctype.getNumBytes();
+    stream.write(padding, alignOffset(offset) - offset);
+    offset = alignOffset(offset);
+    stream.write((const char*)arrays[i].first, arrays[i].second * numBytes);
+    offset += arrays[i].second * numBytes;
+  }
+  taco_uassert(stream.good()) << "Error writing binary tensor";
+}
+
+}
@@ -0,0 +1,298 @@
+#include "storage/file_io_gzip.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef TACO_ZLIB
+#include <zlib.h>
+#endif
+
+#include "taco/error.h"
+#include "taco/util/files.h"
+
+using namespace std;
+
+namespace taco {
+
+bool isGzipFile(const std::string& filename) {
+  std::ifstream file(util::sanitizePath(filename), ios::binary);
+  unsigned char magic[2] = {0, 0};
+  file.read((char*)magic, sizeof(magic));
+  return file.gcount() == sizeof(magic) && magic[0] == 0x1f && magic[1] == 0x8b;
+}
+
+bool hasGzipExtension(const std::string& filename) {
+  return filename.size() > 3 && filename.substr(filename.size() - 3) == ".gz";
+}
+
+bool isGzipSupported() {
+#ifdef TACO_ZLIB
+  return true;
+#else
+  return false;
+#endif
+}
+
+#ifdef TACO_ZLIB
+namespace {
+
+/// A bounded queue of blocks that are passed from one thread to another.
+class BlockQueue {
+public:
+  BlockQueue() : isClosed(false), isCancelled(false) {}
+
+  /// Adds a block, waiting while the queue is full. Returns false if the
+  /// queue has been cancelled.
+  bool push(vector<char>&& block) {
+    unique_lock<mutex> lock(blocksMutex);
+    notFull.wait(lock, [&]{ return blocks.size() < capacity || isCancelled; });
+    if (isCancelled) {
+      return false;
+    }
+    blocks.push_back(std::move(block));
+    notEmpty.notify_one();
+    return true;
+  }
+
+  /// Removes the next block, waiting while the queue is empty. Returns false
+  /// if the queue is closed and empty.
+  bool pop(vector<char>& block) {
+    unique_lock<mutex> lock(blocksMutex);
+    notEmpty.wait(lock, [&]{ return !blocks.empty() || isClosed; });
+    if (blocks.empty()) {
+      return false;
+    }
+    block = std::move(blocks.front());
+    blocks.pop_front();
+    notFull.notify_one();
+    return true;
+  }
+
+  /// No more blocks will be pushed.
+  void close() {
+    lock_guard<mutex> lock(blocksMutex);
+    isClosed = true;
+    notEmpty.notify_all();
+  }
+
+  /// No more blocks will be popped.
+  void cancel() {
+    lock_guard<mutex> lock(blocksMutex);
+    isCancelled = true;
+    notFull.notify_all();
+  }
+
+private:
+  static const size_t capacity = 4;
+
+  mutex              blocksMutex;
+  condition_variable notEmpty;
+  condition_variable notFull;
+  deque<vector<char>> blocks;
+  bool               isClosed;
+  bool               isCancelled;
+};
+
+const size_t blockSize = 1 << 20;
+
+}
+
+class GzipInputStream::Buffer : public std::streambuf {
+public:
+  explicit Buffer(const std::string& filename) : filename(filename),
+                                                 hasError(false) {
+    file = gzopen(util::sanitizePath(filename).c_str(), "rb");
+    taco_uassert(file != nullptr) << "Error opening file: " << filename;
+    gzbuffer(file, blockSize);
+    reader = thread([this]() {
+      while (true) {
+        vector<char> block(blockSize);
+        int size = gzread(file, block.data(), (unsigned)block.size());
+        if (size <= 0) {
+          hasError = (size < 0);
+          break;
+        }
+        block.resize(size);
+        if (!blocks.push(std::move(block))) {
+          break;
+        }
+      }
+      blocks.close();
+    });
+  }
+
+  ~Buffer() {
+    blocks.cancel();
+    reader.join();
+    gzclose(file);
+  }
+
+protected:
+  int_type underflow() {
+    if (gptr() < egptr()) {
+      return traits_type::to_int_type(*gptr());
+    }
+    if (!blocks.pop(block)) {
+      taco_uassert(!hasError) << "Error decompressing file: " << filename;
+      return traits_type::eof();
+    }
+    setg(block.data(), block.data(), block.data() + block.size());
+    return traits_type::to_int_type(*gptr());
+  }
+
+private:
+  string       filename;
+  gzFile       file;
+  thread       reader;
+  BlockQueue   blocks;
+  vector<char> block;
+  bool         hasError;
+};
+
+class GzipOutputStream::Buffer : public std::streambuf {
+public:
+  explicit Buffer(const std::string& filename) : filename(filename),
+                                                 hasError(false),
+                                                 isClosed(false) {
+    file = gzopen(util::sanitizePath(filename).c_str(), "wb");
+    taco_uassert(file != nullptr) << "Error opening file: " << filename;
+    gzbuffer(file, blockSize);
+    writer = thread([this]() {
+      vector<char> block;
+      while (blocks.pop(block)) {
+        if (!hasError && gzwrite(file, block.data(), (unsigned)block.size()) !=
+                         (int)block.size()) {
+          hasError = true;
+        }
+      }
+    });
+    newBlock();
+  }
+
+  ~Buffer() {
+    close();
+  }
+
+  /// Compresses the remaining blocks and finishes the file.
+  bool close() {
+    if (isClosed) {
+      return !hasError;
+    }
+    isClosed = true;
+    pushBlock();
+    blocks.close();
+    writer.join();
+    hasError = (gzclose(file) != Z_OK) || hasError;
+    return !hasError;
+  }
+
+  const string& getFilename() const {
+    return filename;
+  }
+
+protected:
+  int_type overflow(int_type c) {
+    if (isClosed) {
+      return traits_type::eof();
+    }
+    pushBlock();
+    newBlock();
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+
+  std::streamsize xsputn(const char* s, std::streamsize n) {
+    std::streamsize written = 0;
+    while (written < n) {
+      if (pptr() == epptr() && traits_type::eq_int_type(overflow(
+          traits_type::eof()), traits_type::eof())) {
+        break;
+      }
+      std::streamsize size = std::min(n - written,
+                                      (std::streamsize)(epptr() - pptr()));
+      memcpy(pptr(), s + written, size);
+      pbump((int)size);
+      written += size;
+    }
+    return written;
+  }
+
+private:
+  void newBlock() {
+    block.resize(blockSize);
+    setp(block.data(), block.data() + block.size());
+  }
+
+  void pushBlock() {
+    block.resize(pptr() - pbase());
+    if (!block.empty()) {
+      blocks.push(std::move(block));
+    }
+    block = vector<char>();
+    setp(nullptr, nullptr);
+  }
+
+  string       filename;
+  gzFile       file;
+  thread       writer;
+  BlockQueue   blocks;
+  vector<char> block;
+  bool         hasError;
+  bool         isClosed;
+};
+
+GzipInputStream::GzipInputStream(const std::string& filename)
+    : std::istream(nullptr), buffer(new Buffer(filename)) {
+  rdbuf(buffer.get());
+}
+
+GzipOutputStream::GzipOutputStream(const std::string& filename)
+    : std::ostream(nullptr), buffer(new Buffer(filename)) {
+  rdbuf(buffer.get());
+}
+
+void GzipOutputStream::close() {
+  flush();
+  taco_uassert(buffer->close()) <<
+      "Error compressing file: " << buffer->getFilename();
+}
+
+#else
+
+class GzipInputStream::Buffer {};
+class GzipOutputStream::Buffer {};
+
+GzipInputStream::GzipInputStream(const std::string& filename)
+    : std::istream(nullptr) {
+  taco_uerror << "Cannot read the compressed file " << filename <<
+      " since taco was built without zlib (see TACO_ZLIB)";
+}
+
+GzipOutputStream::GzipOutputStream(const std::string& filename)
+    : std::ostream(nullptr) {
+  taco_uerror << "Cannot write the compressed file " << filename <<
+      " since taco was built without zlib (see TACO_ZLIB)";
+}
+
+void GzipOutputStream::close() {
+}
+
+#endif
+
+GzipInputStream::~GzipInputStream() {
+}
+
+GzipOutputStream::~GzipOutputStream() {
+  close();
+}
+
+}
@@ -0,0 +1,53 @@
+#ifndef TACO_STORAGE_FILE_IO_GZIP_H
+#define TACO_STORAGE_FILE_IO_GZIP_H
+
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <string>
+
+#include "taco/util/uncopyable.h"
+
+namespace taco {
+
+/// Returns true if the file starts with the gzip magic bytes.
+bool isGzipFile(const std::string& filename);
+
+/// Returns true if the file name ends with `.gz`.
+bool hasGzipExtension(const std::string& filename);
+
+/// Returns true if taco was built with zlib (see `TACO_ZLIB`), so that gzip
+/// compressed files can be read and written.
+bool isGzipSupported();
+
+/// A stream that reads a gzip compressed file. The file is read and
+/// decompressed on a thread of its own, a few blocks ahead of the reader, so
+/// decompression overlaps with parsing.
+class GzipInputStream : public std::istream, util::Uncopyable {
+public:
+  explicit GzipInputStream(const std::string& filename);
+  ~GzipInputStream();
+
+private:
+  class Buffer;
+  std::unique_ptr<Buffer> buffer;
+};
+
+/// A stream that writes a gzip compressed file. Written blocks are compressed
+/// and written on a thread of its own. The file is complete once `close` is
+/// called or the stream is destroyed.
+class GzipOutputStream : public std::ostream, util::Uncopyable {
+public:
+  explicit GzipOutputStream(const std::string& filename);
+  ~GzipOutputStream();
+
+  void close();
+
+private:
+  class Buffer;
+  std::unique_ptr<Buffer> buffer;
+};
+
+}
+#endif
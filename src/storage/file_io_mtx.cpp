@@ -5,6 +5,9 @@
 #include <sstream>
 #include <cstdlib>
 #include <climits>
+#include <cctype>
+#include <cstring>
+#include <iterator>
 
 #include "taco/tensor.h"
 #include "taco/format.h"
@@ -12,29 +15,19 @@
 #include "taco/util/strings.h"
 #include "taco/util/timers.h"
 #include "taco/util/files.h"
+#include "storage/file_io_parser.h"
+#include "storage/file_io_writer.h"
 
 using namespace std;
 
 namespace taco {
 
-TensorBase readMTX(std::string filename, const Format& format, bool pack) {
-  std::fstream file;
-  util::openStream(file, filename, fstream::in);
-  TensorBase tensor = readMTX(file, format, pack);
-  file.close();
-  return tensor;
-}
-
-TensorBase readMTX(std::istream& stream, const Format& format, bool pack) {
-  string line;
-  if (!std::getline(stream, line)) {
-    return TensorBase();
-  }
-
-  // Read Header
+/// Checks the header line of a MatrixMarket file and returns its format
+/// (coordinate or array) and whether it is symmetric.
+static void readHeader(const string& line, string* formats, bool* symm) {
   std::stringstream lineStream(line);
-  string head, type, formats, field, symmetry;
-  lineStream >> head >> type >> formats >> field >> symmetry;
+  string head, type, field, symmetry;
+  lineStream >> head >> type >> *formats >> field >> symmetry;
   taco_uassert(head=="%%MatrixMarket") << "Unknown header of MatrixMarket";
   // type = [matrix tensor]
   taco_uassert((type=="matrix") || (type=="tensor"))
@@ -46,89 +39,123 @@ TensorBase readMTX(std::istream& stream, const Format& format, bool pack) {
   taco_uassert((symmetry=="general") || (symmetry=="symmetric"))
                                        << "MatrixMarket symmetry not available";
 
-  bool symm = (symmetry=="symmetric");
-
-  TensorBase tensor;
-  if (formats=="coordinate")
-    tensor = readSparse(stream,format,symm);
-  else if (formats=="array")
-    tensor = readDense(stream,format,symm);
-  else
-    taco_uerror << "MatrixMarket format not available";
-
-  if (pack) {
-    tensor.pack();
-  }
-
-  return tensor;
+  *symm = (symmetry=="symmetric");
 }
 
-TensorBase readSparse(std::istream& stream, const Format& format, bool symm) {
-  string line;
-  std::getline(stream,line);
-
+/// Reads the coordinates of a MatrixMarket coordinate file in [begin, end),
+/// which starts after the header line, parsing them in parallel.
+static TensorBase readSparse(const char* begin, const char* end,
+                             const Format& format, bool symm) {
   // Skip comments at the top of the file
-  string token;
+  const char* line = begin;
+  const char* lineEnd = begin;
   do {
-    std::stringstream lineStream(line);
-    lineStream >> token;
-    if (token[0] != '%') {
+    lineEnd = (const char*)memchr(line, '\n', end - line);
+    lineEnd = (lineEnd != nullptr) ? lineEnd : end;
+    const char* token = line;
+    while (token < lineEnd && isspace(*token)) {
+      token++;
+    }
+    if (token < lineEnd && *token != '%') {
       break;
     }
-  } while (std::getline(stream, line));
+    line = (lineEnd < end) ? lineEnd + 1 : end;
+  } while (line < end);
 
   // The first non-comment line is the header with dimensions
   vector<int> dimensions;
-  char* linePtr = (char*)line.data();
+  string header(line, lineEnd);
+  char* linePtr = (char*)header.data();
   while (size_t dimension = strtoul(linePtr, &linePtr, 10)) {
     taco_uassert(dimension <= INT_MAX) << "Dimension exceeds INT_MAX";
     dimensions.push_back(static_cast<int>(dimension));
   }
+  taco_uassert(dimensions.size() >= 2) << "MatrixMarket size line is missing";
   size_t nnz = dimensions[dimensions.size()-1];
   dimensions.pop_back();
   if (symm)
     taco_uassert(dimensions.size()==2) << "Symmetry only available for matrix";
 
-  vector<int> coordinates;
-  vector<double> values;
-  coordinates.reserve(nnz*dimensions.size());
-  values.reserve(nnz);
+  // Parse the coordinates in parallel
+  const char* data = (lineEnd < end) ? lineEnd + 1 : end;
+  vector<CoordinateChunk> chunks = parseCoordinates(data, end,
+                                                    dimensions.size());
 
-  while (std::getline(stream, line)) {
-    linePtr = (char*)line.data();
-    for (size_t i=0; i < dimensions.size(); i++) {
-      long index = strtol(linePtr, &linePtr, 10);
-      taco_uassert(index <= INT_MAX) << "Index exceeds INT_MAX";
-      coordinates.push_back(static_cast<int>(index));
-    }
-    double val = strtod(linePtr, &linePtr);
-    values.push_back(val);
+  size_t numParsed = 0;
+  for (auto& chunk : chunks) {
+    numParsed += chunk.values.size();
   }
+  taco_uassert(numParsed == nnz) << "MatrixMarket file has " << numParsed <<
+      " entries but its size line gives " << nnz;
 
-  // Create matrix
+  // Create matrix and insert coordinates
   TensorBase tensor(type<double>(), dimensions, format);
-  if (symm)
-    tensor.reserve(2*nnz);
+  insertCoordinates(tensor, chunks, symm);
+
+  return tensor;
+}
+
+TensorBase readMTX(std::string filename, const Format& format, bool pack) {
+  MappedFile file(filename);
+  if (file.begin() == file.end()) {
+    return TensorBase();
+  }
+  const char* lineEnd = (const char*)memchr(file.begin(), '\n',
+                                            file.end() - file.begin());
+  lineEnd = (lineEnd != nullptr) ? lineEnd : file.end();
+
+  string formats;
+  bool symm;
+  readHeader(string(file.begin(), lineEnd), &formats, &symm);
+
+  // Dense arrays are read from a stream
+  if (formats!="coordinate") {
+    std::fstream stream;
+    util::openStream(stream, filename, fstream::in);
+    TensorBase tensor = readMTX(stream, format, pack);
+    stream.close();
+    return tensor;
+  }
+
+  const char* data = (lineEnd < file.end()) ? lineEnd + 1 : file.end();
+  TensorBase tensor = readSparse(data, file.end(), format, symm);
+  if (pack) {
+    tensor.pack();
+  }
+  return tensor;
+}
+
+TensorBase readMTX(std::istream& stream, const Format& format, bool pack) {
+  string line;
+  if (!std::getline(stream, line)) {
+    return TensorBase();
+  }
+
+  // Read Header
+  string formats;
+  bool symm;
+  readHeader(line, &formats, &symm);
+
+  TensorBase tensor;
+  if (formats=="coordinate")
+    tensor = readSparse(stream,format,symm);
+  else if (formats=="array")
+    tensor = readDense(stream,format,symm);
   else
-    tensor.reserve(nnz);
+    taco_uerror << "MatrixMarket format not available";
 
-  // Insert coordinates
-  std::vector<int> coord;
-  for (size_t i = 0; i < nnz; i++) {
-    coord.clear();
-    for (size_t mode = 0; mode < dimensions.size(); mode++) {
-      coord.push_back(coordinates[i*dimensions.size() + mode] -1);
-    }
-    tensor.insert(coord, values[i]);
-    if (symm && coord.front() != coord.back()) {
-      std::reverse(coord.begin(), coord.end());
-      tensor.insert(coord, values[i]);
-    }
+  if (pack) {
+    tensor.pack();
   }
 
   return tensor;
 }
 
+TensorBase readSparse(std::istream& stream, const Format& format, bool symm) {
+  string text((istreambuf_iterator<char>(stream)), istreambuf_iterator<char>());
+  return readSparse(text.data(), text.data() + text.size(), format, symm);
+}
+
 TensorBase readDense(std::istream& stream, const Format& format, bool symm) {
   string line;
   std::getline(stream,line);
@@ -213,12 +240,16 @@ void writeSparse(std::ostream& stream, const TensorBase& tensor) {
   stream << "%"                                             << std::endl;
   stream << util::join(tensor.getDimensions(), " ") << " ";
   stream << tensor.getStorage().getIndex().getSize() << endl;
-  for (auto& value : iterate<double>(tensor)) {
-    for (int coord : value.first) {
-      stream << coord+1 << " ";
+  writeComponents(stream, tensor, [](TextBuffer& buffer,
+                                     const vector<int>& coordinate,
+                                     double value) {
+    for (int coord : coordinate) {
+      buffer.appendInt(coord+1);
+      buffer.append(' ');
     }
-    stream << value.second << endl;
-  }
+    buffer.appendDouble(value);
+    buffer.append('\n');
+  });
 }
 
 void writeDense(std::ostream& stream, const TensorBase& tensor) {
@@ -228,9 +259,11 @@ void writeDense(std::ostream& stream, const TensorBase& tensor) {
     stream << "%%MatrixMarket tensor array real general" << std::endl;
   stream << "%"                                        << std::endl;
   stream << util::join(tensor.getDimensions(), " ") << " " << endl;
-  for (auto& value : iterate<double>(tensor)) {
-    stream << value.second << endl;
-  }
+  writeComponents(stream, tensor, [](TextBuffer& buffer,
+                                     const vector<int>&, double value) {
+    buffer.appendDouble(value);
+    buffer.append('\n');
+  });
 }
 
 }
@@ -0,0 +1,329 @@
+#include "storage/file_io_parser.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "taco/tensor.h"
+#include "taco/error.h"
+#include "taco/util/files.h"
+#include "taco/util/parallel_for.h"
+
+using namespace std;
+
+namespace taco {
+
+MappedFile::MappedFile(const std::string& filename) : data(nullptr), size(0) {
+  int fd = open(util::sanitizePath(filename).c_str(), O_RDONLY);
+  taco_uassert(fd != -1) << "Error opening file: " << filename;
+  struct stat status;
+  taco_uassert(fstat(fd, &status) == 0) << "Error reading file: " << filename;
+  size = status.st_size;
+  if (size > 0) {
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    taco_uassert(mapping != MAP_FAILED) << "Error mapping file: " << filename;
+    madvise(mapping, size, MADV_SEQUENTIAL);
+    data = (char*)mapping;
+  }
+  close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (data != nullptr) {
+    munmap(data, size);
+  }
+}
+
+static inline const char* skipBlanks(const char* p, const char* end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+    p++;
+  }
+  return p;
+}
+
+static inline const char* skipLine(const char* p, const char* end) {
+  const char* newline = (const char*)memchr(p, '\n', end - p);
+  return (newline != nullptr) ? newline + 1 : end;
+}
+
+static inline bool isDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+static inline const char* parseInt(const char* p, const char* end,
+                                   long* value) {
+  p = skipBlanks(p, end);
+  bool negative = (p < end && *p == '-');
+  p += (p < end && (*p == '-' || *p == '+'));
+  long result = 0;
+  for (; p < end && isDigit(*p); p++) {
+    taco_uassert(result <= (LONG_MAX - 9) / 10) << "Coordinate is too large";
+    result = result * 10 + (*p - '0');
+  }
+  *value = negative ? -result : result;
+  return p;
+}
+
+/// Parses a floating point number. Numbers with at most 15 significant digits
+/// and small exponents are computed exactly from their digits, which is
+/// correctly rounded, and all others are parsed by strtod.
+static const char* parseDouble(const char* p, const char* end,
+                               double* value) {
+  static const double powersOf10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+  p = skipBlanks(p, end);
+  const char* start = p;
+  bool negative = (p < end && *p == '-');
+  p += (p < end && (*p == '-' || *p == '+'));
+
+  // Digits beyond the 19 that fit in the mantissa only count towards
+  // numDigits, which sends the number to strtod
+  uint64_t mantissa = 0;
+  int numDigits = 0;
+  int exponent = 0;
+  bool hasDigits = false;
+  for (; p < end && isDigit(*p); p++) {
+    hasDigits = true;
+    if (mantissa > 0 || *p != '0') {
+      numDigits++;
+    }
+    if (numDigits <= 19) {
+      mantissa = mantissa * 10 + (*p - '0');
+    }
+  }
+  if (p < end && *p == '.') {
+    for (p++; p < end && isDigit(*p); p++) {
+      hasDigits = true;
+      if (mantissa > 0 || *p != '0') {
+        numDigits++;
+      }
+      if (numDigits <= 19) {
+        mantissa = mantissa * 10 + (*p - '0');
+        exponent--;
+      }
+    }
+  }
+  if (hasDigits && p < end && (*p == 'e' || *p == 'E' || *p == 'd' ||
+                                *p == 'D')) {
+    long e = 0;
+    const char* q = p + 1;
+    bool negativeExponent = (q < end && *q == '-');
+    q += (q < end && (*q == '-' || *q == '+'));
+    if (q < end && isDigit(*q)) {
+      for (; q < end && isDigit(*q) && e < 100000; q++) {
+        e = e * 10 + (*q - '0');
+      }
+      exponent += negativeExponent ? -(int)e : (int)e;
+      p = q;
+    }
+  }
+
+  bool isDelimiter = (p == end || *p == ' ' || *p == '\t' || *p == '\r' ||
+                      *p == '\n');
+  if (hasDigits && isDelimiter && numDigits <= 15 &&
+      exponent >= -22 && exponent <= 22) {
+    double result = (double)mantissa;
+    result = (exponent < 0) ? result / powersOf10[-exponent]
+                            : result * powersOf10[exponent];
+    *value = negative ? -result : result;
+    return p;
+  }
+
+  // Fall back to strtod on a terminated copy of the token
+  const char* tokenEnd = start;
+  while (tokenEnd < end && *tokenEnd != ' ' && *tokenEnd != '\t' &&
+         *tokenEnd != '\r' && *tokenEnd != '\n') {
+    tokenEnd++;
+  }
+  string token(start, tokenEnd);
+  std::replace(token.begin(), token.end(), 'd', 'e');
+  std::replace(token.begin(), token.end(), 'D', 'e');
+  *value = strtod(token.c_str(), nullptr);
+  return tokenEnd;
+}
+
+/// Returns the beginning of the first line that starts at or after `p`.
+static const char* alignToLine(const char* begin, const char* p,
+                               const char* end) {
+  if (p == begin || p[-1] == '\n') {
+    return p;
+  }
+  return skipLine(p, end);
+}
+
+static void parseChunk(const char* p, const char* end, size_t order,
+                       CoordinateChunk& chunk) {
+  chunk.dimensions.assign(order, 0);
+  while (p < end) {
+    p = skipBlanks(p, end);
+    if (p == end) {
+      break;
+    }
+    if (*p == '\n' || *p == '#' || *p == '%') {
+      p = skipLine(p, end);
+      continue;
+    }
+    for (size_t mode = 0; mode < order; mode++) {
+      long index;
+      p = parseInt(p, end, &index);
+      taco_uassert(index >= 1 && index <= INT_MAX) <<
+          "Coordinate " << index << " in file is out of range";
+      chunk.coordinates.push_back((int)index - 1);
+      chunk.dimensions[mode] = std::max(chunk.dimensions[mode], (int)index);
+    }
+    double value = 0.0;
+    p = skipBlanks(p, end);
+    if (p < end && *p != '\n') {
+      p = parseDouble(p, end, &value);
+    }
+    chunk.values.push_back(value);
+    p = skipLine(p, end);
+  }
+}
+
+vector<CoordinateChunk> parseCoordinates(const char* begin, const char* end,
+                                         size_t order) {
+  const size_t size = end - begin;
+  const size_t numChunks = util::getNumBlocks(size, 1 << 20);
+  vector<CoordinateChunk> chunks(numChunks);
+  util::parallelFor(numChunks, [&](size_t chunk) {
+    const char* chunkBegin = alignToLine(begin, begin +
+        util::getBlockBegin(size, numChunks, chunk), end);
+    const char* chunkEnd = alignToLine(begin, begin +
+        util::getBlockBegin(size, numChunks, chunk + 1), end);
+    if (chunkBegin < chunkEnd) {
+      parseChunk(chunkBegin, chunkEnd, order, chunks[chunk]);
+    }
+    else {
+      chunks[chunk].dimensions.assign(order, 0);
+    }
+  });
+  return chunks;
+}
+
+static inline bool isSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/// Returns the beginning of the first token that starts at or after `p`.
+static const char* alignToToken(const char* begin, const char* p,
+                                const char* end) {
+  while (p > begin && p < end && !isSpace(p[-1])) {
+    p++;
+  }
+  return p;
+}
+
+/// Parses the whitespace separated tokens in [begin, end) in parallel with
+/// `parse(token, end, number)`. Chunks first count their tokens, so that
+/// every chunk knows where its numbers go, and then parse them.
+template <typename T, typename Parse>
+static size_t parseNumbers(const char* begin, const char* end, T* numbers,
+                           size_t maxNumbers, Parse parse) {
+  const size_t size = end - begin;
+  const size_t numChunks = util::getNumBlocks(size, 1 << 20);
+  vector<const char*> bounds(numChunks + 1);
+  for (size_t chunk = 0; chunk <= numChunks; chunk++) {
+    bounds[chunk] = alignToToken(begin, begin +
+        util::getBlockBegin(size, numChunks, chunk), end);
+  }
+
+  vector<size_t> offsets(numChunks + 1, 0);
+  util::parallelFor(numChunks, [&](size_t chunk) {
+    size_t numTokens = 0;
+    for (const char* p = bounds[chunk]; p < bounds[chunk + 1]; p++) {
+      numTokens += !isSpace(*p) && (p == begin || isSpace(p[-1]));
+    }
+    offsets[chunk + 1] = numTokens;
+  });
+  for (size_t chunk = 0; chunk < numChunks; chunk++) {
+    offsets[chunk + 1] += offsets[chunk];
+  }
+  taco_uassert(offsets[numChunks] <= maxNumbers) << "Expected " <<
+      maxNumbers << " numbers but found " << offsets[numChunks];
+
+  util::parallelFor(numChunks, [&](size_t chunk) {
+    T* number = &numbers[offsets[chunk]];
+    const char* chunkEnd = bounds[chunk + 1];
+    for (const char* p = bounds[chunk]; p < chunkEnd;) {
+      if (isSpace(*p)) {
+        p++;
+        continue;
+      }
+      p = parse(p, chunkEnd, number++);
+      while (p < chunkEnd && !isSpace(*p)) {
+        p++;
+      }
+    }
+  });
+  return offsets[numChunks];
+}
+
+size_t parseIntegers(const char* begin, const char* end, int* numbers,
+                     size_t maxNumbers) {
+  return parseNumbers(begin, end, numbers, maxNumbers,
+                      [](const char* p, const char* end, int* number) {
+    long value;
+    p = parseInt(p, end, &value);
+    taco_uassert(value >= INT_MIN && value <= INT_MAX) <<
+        "Integer " << value << " in file is out of range";
+    *number = (int)value;
+    return p;
+  });
+}
+
+size_t parseDoubles(const char* begin, const char* end, double* numbers,
+                    size_t maxNumbers) {
+  return parseNumbers(begin, end, numbers, maxNumbers, parseDouble);
+}
+
+vector<int> getDimensions(const vector<CoordinateChunk>& chunks,
+                          size_t order) {
+  vector<int> dimensions(order, 0);
+  for (auto& chunk : chunks) {
+    for (size_t mode = 0; mode < order; mode++) {
+      dimensions[mode] = std::max(dimensions[mode], chunk.dimensions[mode]);
+    }
+  }
+  return dimensions;
+}
+
+void insertCoordinates(TensorBase& tensor, vector<CoordinateChunk>& chunks,
+                       bool symmetric) {
+  const size_t order = tensor.getOrder();
+  vector<TensorBase::Inserter> inserters;
+  for (size_t i = 0; i < chunks.size(); i++) {
+    inserters.push_back(tensor.inserter());
+  }
+  util::parallelFor(chunks.size(), [&](size_t i) {
+    CoordinateChunk& chunk = chunks[i];
+    inserters[i].insertBulk(chunk.coordinates.data(), chunk.values.data(),
+                            chunk.values.size());
+    if (symmetric) {
+      vector<int> transposed;
+      vector<double> values;
+      for (size_t k = 0; k < chunk.values.size(); k++) {
+        const int* coordinate = &chunk.coordinates[k * order];
+        if (coordinate[0] != coordinate[order - 1]) {
+          transposed.insert(transposed.end(), coordinate, coordinate + order);
+          std::reverse(transposed.end() - order, transposed.end());
+          values.push_back(chunk.values[k]);
+        }
+      }
+      inserters[i].insertBulk(transposed.data(), values.data(),
+                              values.size());
+    }
+    vector<int>().swap(chunk.coordinates);
+    vector<double>().swap(chunk.values);
+  });
+}
+
+}
@@ -0,0 +1,66 @@
+#ifndef TACO_STORAGE_FILE_IO_PARSER_H
+#define TACO_STORAGE_FILE_IO_PARSER_H
+
+#include <string>
+#include <vector>
+
+#include "taco/util/uncopyable.h"
+
+namespace taco {
+class TensorBase;
+
+/// A file that is memory mapped for reading.
+class MappedFile : util::Uncopyable {
+public:
+  explicit MappedFile(const std::string& filename);
+  ~MappedFile();
+
+  const char* begin() const {return data;}
+  const char* end() const {return data + size;}
+
+private:
+  char*  data;
+  size_t size;
+};
+
+/// The coordinates and values parsed from one chunk of a text file.
+struct CoordinateChunk {
+  /// The zero-based coordinates of the entries one after the other.
+  std::vector<int>    coordinates;
+  std::vector<double> values;
+
+  /// One more than the largest coordinate of every mode.
+  std::vector<int>    dimensions;
+};
+
+/// Parses lines of `order` one-based integer coordinates followed by a value
+/// from the text in [begin, end). The text is split into chunks at line
+/// boundaries, and the chunks are parsed in parallel. Empty lines and lines
+/// that start with `#` or `%` are skipped.
+std::vector<CoordinateChunk> parseCoordinates(const char* begin,
+                                              const char* end, size_t order);
+
+/// Parses the whitespace separated integers in [begin, end) into `numbers`,
+/// which has room for `maxNumbers` integers. The text is split into chunks
+/// that are parsed in parallel. Returns the number of integers parsed.
+size_t parseIntegers(const char* begin, const char* end, int* numbers,
+                     size_t maxNumbers);
+
+/// Parses the whitespace separated floating point numbers in [begin, end) into
+/// `numbers`, like `parseIntegers`. Fortran `D` exponents are accepted.
+size_t parseDoubles(const char* begin, const char* end, double* numbers,
+                    size_t maxNumbers);
+
+/// Inserts the parsed chunks into a tensor in parallel, each chunk through an
+/// inserter of its own, and frees them. The entries of symmetric matrices are
+/// also inserted at their transposed coordinates, except on the diagonal.
+void insertCoordinates(TensorBase& tensor, std::vector<CoordinateChunk>& chunks,
+                       bool symmetric=false);
+
+/// Returns the dimensions of a tensor that holds the coordinates of all the
+/// chunks.
+std::vector<int> getDimensions(const std::vector<CoordinateChunk>& chunks,
+                               size_t order);
+
+}
+#endif
@@ -14,6 +14,8 @@
 #include "taco/storage/array_util.h"
 #include "taco/util/files.h"
 #include "taco/util/collections.h"
+#include "storage/file_io_parser.h"
+#include "storage/file_io_writer.h"
 
 using namespace std;
 
@@ -40,19 +42,19 @@ void readFile(std::istream &hbfile,
     free(*colptr);
   }
   (*colptr) = (int*)malloc((*ncol+1) * sizeof(int));
-  readIndices(hbfile, ptrcrd, *colptr);
+  readIndices(hbfile, ptrcrd, *ncol+1, *colptr);
 
   if (*rowind) {
     free(*rowind);
   }
   (*rowind) = (int*)malloc(nnzero * sizeof(int));
-  readIndices(hbfile, indcrd, *rowind);
+  readIndices(hbfile, indcrd, nnzero, *rowind);
 
   if (*values) {
     free(*values);
   }
   (*values) = (double*)malloc(nnzero * sizeof(double));
-  readValues(hbfile, valcrd, *values);
+  readValues(hbfile, valcrd, nnzero, *values);
 
   readRHS();
 }
@@ -213,57 +215,52 @@ void writeHeader(std::ostream &hbfile,
   // Last line useless for taco
 }
 
-void readIndices(std::istream &hbfile, int linesize, int indices[]){
+/// Reads `linesize` lines of a stream into one string.
+static string readLines(std::istream &hbfile, int linesize) {
+  string lines;
   std::string line;
-  std::string ptr;
-  int ptr_ind=0;
-  for (auto i = 0; i < linesize; i++) {
-    std::getline(hbfile,line);
-    std::istringstream iss(line);
-    while(iss >> ptr) {
-      indices[ptr_ind] = std::stoi(ptr) -1;
-      ptr_ind++;
-    }
+  for (auto i = 0; i < linesize && std::getline(hbfile,line); i++) {
+    lines += line;
+    lines += '\n';
+  }
+  return lines;
+}
+
+void readIndices(std::istream &hbfile, int linesize, int indsize,
+                 int indices[]){
+  string lines = readLines(hbfile, linesize);
+  size_t numIndices = parseIntegers(lines.data(), lines.data() + lines.size(),
+                                    indices, indsize);
+  taco_uassert(numIndices == (size_t)indsize) << "HBfile has " <<
+      numIndices << " indices where " << indsize << " were expected";
+  for (auto i = 0; i < indsize; i++) {
+    indices[i]--;
   }
 }
 
 void writeIndices(std::ostream &hbfile, int indsize,
                   int indperline, int indices[]){
-  for (auto i = 1; i <= indsize; i++) {
-    hbfile << indices[i-1] + 1 << " ";
-    if (i%indperline==0)
-      hbfile << "\n";
-  }
-  if (indsize%indperline != 0)
-    hbfile << "\n";
+  writeLines(hbfile, indsize, indperline, [&](TextBuffer& buffer, size_t i) {
+    buffer.appendInt(indices[i] + 1);
+    buffer.append(' ');
+  });
 }
 
-void readValues(std::istream &hbfile, int linesize, double values[]){
-  std::string line;
-  std::string ptr;
-  int ptr_ind=0;
-  for (auto i = 0; i < linesize; i++) {
-    std::getline(hbfile,line);
-    std::istringstream iss(line);
-    while(iss >> ptr) {
-      values[ptr_ind] = std::stod(ptr);
-      ptr_ind++;
-    }
-  }
+void readValues(std::istream &hbfile, int linesize, int valuesize,
+                double values[]){
+  string lines = readLines(hbfile, linesize);
+  size_t numValues = parseDoubles(lines.data(), lines.data() + lines.size(),
+                                  values, valuesize);
+  taco_uassert(numValues == (size_t)valuesize) << "HBfile has " <<
+      numValues << " values where " << valuesize << " were expected";
 }
 
 void writeValues(std::ostream &hbfile, int valuesize,
                  int valperline, double values[]){
-  for (auto i = 1; i <= valuesize; i++) {
-    if (std::floor(values[i-1]) == values[i-1])
-      hbfile << values[i-1] << ".0 ";
-    else
-      hbfile << values[i-1] << " ";
-    if (i%valperline==0)
-      hbfile << "\n";
-  }
-  if (valuesize%valperline != 0)
-    hbfile << "\n";
+  writeLines(hbfile, valuesize, valperline, [&](TextBuffer& buffer, size_t i) {
+    buffer.appendDouble(values[i]);
+    buffer.append((std::floor(values[i]) == values[i]) ? ".0 " : " ");
+  });
 }
 
 // Useless for Taco
@@ -287,9 +284,11 @@ TensorBase readRB(std::istream& stream, const Format& format, bool pack) {
 
   readFile(stream, &rows, &cols, &colptr, &rowidx, &vals);
 
-  taco_uassert(format == CSC) << "RB files must be loaded into a CSC matrix";
+  taco_uassert(format.getOrder() == 2) << "RB files must be loaded into a matrix";
   TensorBase tensor(type<double>(), {(int)rows,(int)cols}, CSC);
 
+  // The arrays in the file are the arrays of a CSC matrix, which is adopted
+  // as it is
   auto storage = tensor.getStorage();
   Index index(CSC,
               {ModeIndex({makeArray({(int)cols})}),
@@ -300,11 +299,7 @@ TensorBase readRB(std::istream& stream, const Format& format, bool pack) {
   storage.setIndex(index);
   storage.setValues(values);
 
-  if (pack) {
-    tensor.pack();
-  }
-
-  return tensor;
+  return (format == CSC) ? tensor : convert(tensor, format);
 }
 
 void writeRB(std::string filename, const TensorBase& tensor) {
@@ -3,77 +3,526 @@
 #include <iostream>
 #include <fstream>
 #include <cstdlib>
+#include <cctype>
 #include <algorithm>
 #include <vector>
-#include <cmath>
-#include <limits.h>
+#include <cstring>
+#include <iterator>
+#include <atomic>
+#include <memory>
+#include <queue>
+#include <string>
 
 #include "taco/tensor.h"
 #include "taco/format.h"
 #include "taco/error.h"
-#include "taco/util/strings.h"
+#include "taco/storage/array_util.h"
+#include "taco/util/env.h"
 #include "taco/util/files.h"
+#include "storage/file_io_parser.h"
+#include "storage/file_io_writer.h"
 
 using namespace std;
 
+using namespace taco::storage;
+
 namespace taco {
 
-TensorBase readTNS(std::string filename, const Format& format, bool pack) {
-  std::fstream file;
-  util::openStream(file, filename, fstream::in);
-  TensorBase tensor = readTNS(file, format, pack);
-  file.close();
+/// Infers the order of a tns tensor from the number of tokens on its first
+/// line of data. Returns false if the tns file in [begin, end) has no data.
+static bool inferOrder(const char* begin, const char* end, size_t* order) {
+  // Skip blank lines and comments, like parseCoordinates
+  const char* line = begin;
+  while (line < end) {
+    while (line < end && (*line == ' ' || *line == '\t' || *line == '\r')) {
+      line++;
+    }
+    if (line == end || (*line != '\n' && *line != '#' && *line != '%')) {
+      break;
+    }
+    const char* newline = (const char*)memchr(line, '\n', end - line);
+    line = (newline != nullptr) ? newline + 1 : end;
+  }
+  if (line == end) {
+    return false;
+  }
+  size_t numTokens = 0;
+  for (const char* p = line; p < end && *p != '\n'; p++) {
+    numTokens += !isspace(*p) && (p == line || isspace(p[-1]));
+  }
+  taco_uassert(numTokens >= 2) <<
+      "A tns line must have at least one coordinate and a value";
+  *order = numTokens-1;
+  return true;
+}
+
+/// Reads the lines of a tns file in [begin, end), parsing them in parallel.
+static TensorBase readTNS(const char* begin, const char* end,
+                          const Format& format, bool pack) {
+  // Infer tensor order from the first coordinate
+  size_t order;
+  if (!inferOrder(begin, end, &order)) {
+    return TensorBase();
+  }
+
+  // Load data
+  vector<CoordinateChunk> chunks = parseCoordinates(begin, end, order);
+  std::vector<int> dimensions = getDimensions(chunks, order);
+
+  // Create tensor
+  TensorBase tensor(type<double>(), dimensions, format);
+  insertCoordinates(tensor, chunks);
+
+  if (pack) {
+    tensor.pack();
+  }
+
   return tensor;
 }
 
+TensorBase readTNS(std::string filename, const Format& format, bool pack) {
+  MappedFile file(filename);
+  return readTNS(file.begin(), file.end(), format, pack);
+}
+
 TensorBase readTNS(std::istream& stream, const Format& format, bool pack) {
-  std::vector<int>    coordinates;
-  std::vector<double> values;
+  string text((istreambuf_iterator<char>(stream)), istreambuf_iterator<char>());
+  return readTNS(text.data(), text.data() + text.size(), format, pack);
+}
 
-  std::string line;
-  if (!std::getline(stream, line)) {
-    return TensorBase();
+namespace {
+
+/// A sorted run of tns entries whose coordinates are stored in level order.
+/// Each record is the coordinates of an entry followed by its value. Runs are
+/// either held in memory or read from a temporary file in small blocks.
+class SortedRun {
+public:
+  SortedRun(size_t order) : order(order), position(0) {}
+
+  /// Makes the run read the records of a temporary file, which it removes.
+  void spill(const string& filename) {
+    this->filename = filename;
+    std::ofstream out(filename, ios::binary);
+    out.write(records.data(), records.size());
+    taco_uassert(out.good()) << "Error writing temporary file " << filename;
+    out.close();
+    vector<char>().swap(records);
+    file.open(filename, ios::binary);
+    taco_uassert(file.is_open()) << "Error reading temporary file " << filename;
   }
 
-  // Infer tensor order from the first coordinate
-  vector<string> toks = util::split(line, " ");
-  size_t order = toks.size()-1;
-  std::vector<int> dimensions(order);
-  std::vector<int> coordinate(order);
+  ~SortedRun() {
+    if (!filename.empty()) {
+      file.close();
+      std::remove(filename.c_str());
+    }
+  }
 
-  // Load data
-  do {
-    char* linePtr = (char*)line.data();
-    for (size_t i = 0; i < order; i++) {
-      long idx = strtol(linePtr, &linePtr, 10);
-      taco_uassert(idx <= INT_MAX)<<"Coordinate in file is larger than INT_MAX";
-      coordinate[i] = (int)idx - 1;
-      dimensions[i] = std::max(dimensions[i], (int)idx);
+  size_t getRecordSize() const {
+    return order * sizeof(int) + sizeof(double);
+  }
+
+  /// Returns true if the run has a current record, reading the next block
+  /// of a spilled run if needed.
+  bool hasRecord() {
+    if (position < records.size()) {
+      return true;
     }
-    coordinates.insert(coordinates.end(), coordinate.begin(), coordinate.end());
-    double val = strtod(linePtr, &linePtr);
-    values.push_back(val);
+    if (!file.is_open()) {
+      return false;
+    }
+    records.resize(blockSize * getRecordSize());
+    file.read(records.data(), records.size());
+    records.resize(file.gcount());
+    position = 0;
+    return !records.empty();
+  }
 
-  } while (std::getline(stream, line));
+  const int* getCoordinates() const {
+    return (const int*)&records[position];
+  }
 
-  // Create tensor
-  const size_t nnz = values.size();
-  TensorBase tensor(type<double>(), dimensions, format);
-  tensor.reserve(nnz);
+  double getValue() const {
+    double value;
+    memcpy(&value, &records[position + order * sizeof(int)], sizeof(double));
+    return value;
+  }
+
+  void next() {
+    position += getRecordSize();
+  }
+
+  /// The records of the run, which are appended while the run is built.
+  vector<char> records;
+
+private:
+  static const size_t blockSize = 1 << 14;
+
+  size_t        order;
+  size_t        position;
+  string        filename;
+  std::ifstream file;
+};
+
+/// An array that grows like a vector, but that is allocated with malloc so
+/// that its memory can be handed to an `Array` without being copied.
+template <typename T>
+class GrowableArray {
+public:
+  GrowableArray() : data(nullptr), size(0), capacity(0) {}
+
+  GrowableArray(GrowableArray&& other) noexcept
+      : data(other.data), size(other.size), capacity(other.capacity) {
+    other.data = nullptr;
+    other.size = 0;
+    other.capacity = 0;
+  }
+
+  GrowableArray(const GrowableArray&) = delete;
+  GrowableArray& operator=(const GrowableArray&) = delete;
+
+  ~GrowableArray() {
+    free(data);
+  }
+
+  size_t getSize() const {
+    return size;
+  }
+
+  T& operator[](size_t i) {
+    return data[i];
+  }
 
-  // Insert coordinates (TODO add and use bulk insertion)
-  for (size_t i = 0; i < nnz; i++) {
-    for (size_t j = 0; j < order; j++) {
-      coordinate[j] = coordinates[i*order + j];
+  T& back() {
+    return data[size - 1];
+  }
+
+  void push_back(T value) {
+    if (size == capacity) {
+      reserve(std::max(2 * capacity, (size_t)16));
     }
-    tensor.insert(coordinate, values[i]);
+    data[size++] = value;
   }
 
-  if (pack) {
-    tensor.pack();
+  void resize(size_t newSize, T value) {
+    if (newSize > capacity) {
+      reserve(std::max(2 * capacity, newSize));
+    }
+    for (size_t i = size; i < newSize; i++) {
+      data[i] = value;
+    }
+    size = newSize;
   }
 
-  return tensor;
+  /// Returns an `Array` that takes over the elements and frees them.
+  Array release() {
+    reserve(std::max(size, (size_t)1));
+    Array array = makeArray(data, size, Array::Free);
+    data = nullptr;
+    size = 0;
+    capacity = 0;
+    return array;
+  }
+
+private:
+  void reserve(size_t newCapacity) {
+    T* newData = (T*)realloc(data, newCapacity * sizeof(T));
+    taco_uassert(newData != nullptr) <<
+        "Error allocating " << newCapacity * sizeof(T) << " bytes";
+    data = newData;
+    capacity = newCapacity;
+  }
+
+  T*     data;
+  size_t size;
+  size_t capacity;
+};
+
+/// Builds the index and values of a tensor from entries that are appended in
+/// increasing order of their level-ordered coordinates, with no duplicates.
+class StorageBuilder {
+public:
+  StorageBuilder(const vector<ModeType>& modeTypes,
+                 const vector<int>& dimensions)
+      : modeTypes(modeTypes), dimensions(dimensions),
+        pos(modeTypes.size()), idx(modeTypes.size()),
+        positions(modeTypes.size()), previous(modeTypes.size()),
+        isEmpty(true) {
+    for (auto& levelPos : pos) {
+      levelPos.push_back(0);
+    }
+  }
+
+  void append(const int* coordinate, double value) {
+    // Entries share the positions of the previous entry up to the first
+    // level where their coordinates differ
+    const size_t order = modeTypes.size();
+    size_t level = 0;
+    while (!isEmpty && level < order && coordinate[level] == previous[level]) {
+      level++;
+    }
+    taco_iassert(isEmpty || level < order) << "Duplicate coordinate";
+    size_t parent = (level > 0) ? positions[level-1] : 0;
+    for (; level < order; level++) {
+      if (modeTypes[level] == Dense) {
+        parent = parent * dimensions[level] + coordinate[level];
+      }
+      else {
+        while (pos[level].getSize() < parent + 2) {
+          pos[level].push_back((int)idx[level].getSize());
+        }
+        idx[level].push_back(coordinate[level]);
+        pos[level].back() = (int)idx[level].getSize();
+        parent = idx[level].getSize() - 1;
+      }
+      positions[level] = parent;
+      previous[level] = coordinate[level];
+    }
+    if (values.getSize() <= parent) {
+      values.resize(parent + 1, 0.0);
+    }
+    values[parent] = value;
+    isEmpty = false;
+  }
+
+  /// Stores the index and values in the storage of `tensor`, handing the
+  /// arrays over without copying them.
+  void finish(TensorBase& tensor) {
+    vector<ModeIndex> modeIndices;
+    size_t size = 1;
+    for (size_t level = 0; level < modeTypes.size(); level++) {
+      if (modeTypes[level] == Dense) {
+        modeIndices.push_back(ModeIndex({makeArray({dimensions[level]})}));
+        size *= dimensions[level];
+      }
+      else {
+        pos[level].resize(size + 1, (int)idx[level].getSize());
+        size = idx[level].getSize();
+        modeIndices.push_back(ModeIndex({pos[level].release(),
+                                         idx[level].release()}));
+      }
+    }
+    values.resize(size, 0.0);
+    Storage& storage = tensor.getStorage();
+    storage.setIndex(Index(storage.getFormat(), modeIndices));
+    storage.setValues(values.release());
+  }
+
+private:
+  vector<ModeType>           modeTypes;
+  vector<int>                dimensions;
+  vector<GrowableArray<int>> pos;
+  vector<GrowableArray<int>> idx;
+  GrowableArray<double>      values;
+  vector<size_t>             positions;
+  vector<int>                previous;
+  bool                       isEmpty;
+};
+
+}
+
+/// Sorts records of `order` coordinates and a value by their coordinates, in
+/// place. The sort is a quicksort that continues with the smaller part and
+/// finishes short ranges with insertion sort, so besides the records it needs
+/// two records of memory and a stack of O(log n) ranges.
+static void sortRecords(char* records, size_t numRecords, size_t order) {
+  const size_t recordSize = order * sizeof(int) + sizeof(double);
+  vector<char> temporary(recordSize);
+  vector<char> pivot(recordSize);
+  auto record = [&](size_t i) { return records + i * recordSize; };
+  auto isLess = [&](const char* a, const char* b) {
+    return std::lexicographical_compare((const int*)a, (const int*)a + order,
+                                        (const int*)b, (const int*)b + order);
+  };
+  auto swapRecords = [&](size_t i, size_t j) {
+    memcpy(temporary.data(), record(i), recordSize);
+    memcpy(record(i), record(j), recordSize);
+    memcpy(record(j), temporary.data(), recordSize);
+  };
+
+  vector<pair<size_t,size_t>> ranges = {{0, numRecords}};
+  while (!ranges.empty()) {
+    size_t begin = ranges.back().first;
+    size_t end = ranges.back().second;
+    ranges.pop_back();
+    while (end - begin > 16) {
+      // Partition around the median of the first, middle and last records
+      size_t middle = begin + (end - 1 - begin) / 2;
+      if (isLess(record(middle), record(begin))) swapRecords(middle, begin);
+      if (isLess(record(end-1), record(begin))) swapRecords(end-1, begin);
+      if (isLess(record(end-1), record(middle))) swapRecords(end-1, middle);
+      memcpy(pivot.data(), record(middle), recordSize);
+      size_t i = begin - 1;
+      size_t j = end;
+      while (true) {
+        do { i++; } while (isLess(record(i), pivot.data()));
+        do { j--; } while (isLess(pivot.data(), record(j)));
+        if (i >= j) {
+          break;
+        }
+        swapRecords(i, j);
+      }
+      size_t split = j + 1;
+      if (split - begin < end - split) {
+        ranges.push_back({split, end});
+        end = split;
+      }
+      else {
+        ranges.push_back({begin, split});
+        begin = split;
+      }
+    }
+    for (size_t i = begin + 1; i < end; i++) {
+      memcpy(temporary.data(), record(i), recordSize);
+      size_t j = i;
+      for (; j > begin && isLess(temporary.data(), record(j-1)); j--) {
+        memcpy(record(j), record(j-1), recordSize);
+      }
+      memcpy(record(j), temporary.data(), recordSize);
+    }
+  }
+}
+
+/// Sorts the entries of parsed chunks into a run, summing duplicates. Every
+/// chunk is freed as soon as its entries have been copied into the run, and
+/// the run is sorted and combined in place.
+static void sortRun(vector<CoordinateChunk>& chunks,
+                    const vector<size_t>& modeOrdering, SortedRun& run) {
+  const size_t order = modeOrdering.size();
+  const size_t recordSize = run.getRecordSize();
+  size_t numRecords = 0;
+  for (auto& chunk : chunks) {
+    numRecords += chunk.values.size();
+  }
+  run.records.resize(numRecords * recordSize);
+  char* record = run.records.data();
+  for (auto& chunk : chunks) {
+    for (size_t i = 0; i < chunk.values.size(); i++) {
+      int* coordinate = (int*)record;
+      for (size_t level = 0; level < order; level++) {
+        coordinate[level] = chunk.coordinates[i*order + modeOrdering[level]];
+      }
+      memcpy(record + order * sizeof(int), &chunk.values[i], sizeof(double));
+      record += recordSize;
+    }
+    vector<int>().swap(chunk.coordinates);
+    vector<double>().swap(chunk.values);
+  }
+
+  sortRecords(run.records.data(), numRecords, order);
+
+  // Sum the values of duplicate coordinates into the first of them
+  char* records = run.records.data();
+  size_t numUnique = 0;
+  for (size_t i = 0; i < numRecords; i++) {
+    char* current = records + i * recordSize;
+    char* last = (numUnique > 0) ? records + (numUnique - 1) * recordSize
+                                 : nullptr;
+    if (last != nullptr && std::equal((int*)current, (int*)current + order,
+                                      (int*)last)) {
+      double sum, value;
+      memcpy(&sum, last + order * sizeof(int), sizeof(double));
+      memcpy(&value, current + order * sizeof(int), sizeof(double));
+      sum += value;
+      memcpy(last + order * sizeof(int), &sum, sizeof(double));
+    }
+    else {
+      if (numUnique != i) {
+        memcpy(records + numUnique * recordSize, current, recordSize);
+      }
+      numUnique++;
+    }
+  }
+  run.records.resize(numUnique * recordSize);
+}
+
+TensorBase readTNSStreaming(std::string filename, const Format& format,
+                            size_t windowSize) {
+  static std::atomic<size_t> numSpilledRuns(0);
+  MappedFile file(filename);
+  size_t order;
+  if (!inferOrder(file.begin(), file.end(), &order)) {
+    return TensorBase();
+  }
+  taco_uassert(format.getOrder() == order) << "The format has order " <<
+      format.getOrder() << " but the tensor in " << filename << " has order " <<
+      order;
+  taco_uassert(windowSize > 0) << "The window size must be positive";
+  const vector<size_t>& modeOrdering = format.getModeOrdering();
+
+  // Parse and sort the file one window at a time, spilling every sorted run
+  // to a temporary file unless the whole file fits in one window
+  vector<unique_ptr<SortedRun>> runs;
+  vector<int> dimensions(order, 0);
+  for (const char* window = file.begin(); window < file.end();) {
+    const char* windowEnd = window + std::min(windowSize,
+                                              (size_t)(file.end() - window));
+    if (windowEnd < file.end() && windowEnd[-1] != '\n') {
+      const char* newline = (const char*)memchr(windowEnd, '\n',
+                                                file.end() - windowEnd);
+      windowEnd = (newline != nullptr) ? newline + 1 : file.end();
+    }
+    vector<CoordinateChunk> chunks = parseCoordinates(window, windowEnd, order);
+    vector<int> windowDimensions = getDimensions(chunks, order);
+    for (size_t i = 0; i < order; i++) {
+      dimensions[i] = std::max(dimensions[i], windowDimensions[i]);
+    }
+    runs.push_back(unique_ptr<SortedRun>(new SortedRun(order)));
+    sortRun(chunks, modeOrdering, *runs.back());
+    if (window != file.begin() || windowEnd != file.end()) {
+      runs.back()->spill(util::getTmpdir() + "tns_run_" +
+                         to_string(numSpilledRuns++) + ".bin");
+    }
+    window = windowEnd;
+  }
+
+  // Pack the entries with a k-way merge of the runs. Fixed levels are packed
+  // as sparse levels and then converted.
+  vector<ModeType> modeTypes = format.getModeTypes();
+  vector<int> levelDimensions;
+  for (size_t level = 0; level < order; level++) {
+    levelDimensions.push_back(dimensions[modeOrdering[level]]);
+    if (modeTypes[level] == Fixed) {
+      modeTypes[level] = Sparse;
+    }
+  }
+  StorageBuilder builder(modeTypes, levelDimensions);
+  auto isAfter = [&](size_t a, size_t b) {
+    return std::lexicographical_compare(
+        runs[b]->getCoordinates(), runs[b]->getCoordinates() + order,
+        runs[a]->getCoordinates(), runs[a]->getCoordinates() + order);
+  };
+  priority_queue<size_t, vector<size_t>, decltype(isAfter)> heap(isAfter);
+  for (size_t i = 0; i < runs.size(); i++) {
+    if (runs[i]->hasRecord()) {
+      heap.push(i);
+    }
+  }
+  vector<int> coordinate(order);
+  while (!heap.empty()) {
+    size_t run = heap.top();
+    coordinate.assign(runs[run]->getCoordinates(),
+                      runs[run]->getCoordinates() + order);
+    double value = 0.0;
+    while (!heap.empty() &&
+           std::equal(coordinate.begin(), coordinate.end(),
+                      runs[heap.top()]->getCoordinates())) {
+      run = heap.top();
+      heap.pop();
+      value += runs[run]->getValue();
+      runs[run]->next();
+      if (runs[run]->hasRecord()) {
+        heap.push(run);
+      }
+    }
+    builder.append(coordinate.data(), value);
+  }
+  runs.clear();
+
+  Format packedFormat(modeTypes, modeOrdering);
+  TensorBase tensor(type<double>(), dimensions, packedFormat);
+  builder.finish(tensor);
+  return (packedFormat == format) ? tensor : convert(tensor, format);
 }
 
 void writeTNS(std::string filename, const TensorBase& tensor) {
@@ -84,12 +533,16 @@ void writeTNS(std::string filename, const TensorBase& tensor) {
 }
 
 void writeTNS(std::ostream& stream, const TensorBase& tensor) {
-  for (auto& value : iterate<double>(tensor)) {
-    for (int coord : value.first) {
-      stream << coord+1 << " ";
+  writeComponents(stream, tensor, [](TextBuffer& buffer,
+                                     const vector<int>& coordinate,
+                                     double value) {
+    for (int coord : coordinate) {
+      buffer.appendInt(coord+1);
+      buffer.append(' ');
     }
-    stream << value.second << endl;
-  }
+    buffer.appendDouble(value);
+    buffer.append('\n');
+  });
 }
 
 }
@@ -0,0 +1,41 @@
+#include "storage/file_io_writer.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace taco {
+
+void TextBuffer::append(const char* str) {
+  text.insert(text.end(), str, str + strlen(str));
+}
+
+void TextBuffer::appendInt(long value) {
+  char digits[24];
+  char* end = digits + sizeof(digits);
+  char* begin = end;
+  unsigned long magnitude = (value < 0) ? 0ul - (unsigned long)value
+                                        : (unsigned long)value;
+  do {
+    *--begin = (char)('0' + magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude > 0);
+  if (value < 0) {
+    *--begin = '-';
+  }
+  text.insert(text.end(), begin, end);
+}
+
+void TextBuffer::appendDouble(double value) {
+  // Integers with at most six digits are formatted the same by %g
+  if (value == std::floor(value) && std::fabs(value) < 1e6 &&
+      !(value == 0.0 && std::signbit(value))) {
+    appendInt((long)value);
+    return;
+  }
+  char digits[32];
+  int size = snprintf(digits, sizeof(digits), "%g", value);
+  text.insert(text.end(), digits, digits + size);
+}
+
+}
@@ -0,0 +1,124 @@
+#ifndef TACO_STORAGE_FILE_IO_WRITER_H
+#define TACO_STORAGE_FILE_IO_WRITER_H
+
+#include <algorithm>
+#include <ostream>
+#include <vector>
+
+#include "taco/tensor.h"
+#include "taco/error.h"
+#include "taco/util/parallel_for.h"
+
+namespace taco {
+
+/// A buffer that text is formatted into before it is written to a stream.
+class TextBuffer {
+public:
+  void append(char c) {
+    text.push_back(c);
+  }
+
+  void append(const char* str);
+
+  /// Appends an integer.
+  void appendInt(long value);
+
+  /// Appends a floating point number the way `std::ostream` formats it by
+  /// default, with six significant digits.
+  void appendDouble(double value);
+
+  void clear() {
+    text.clear();
+  }
+
+  void write(std::ostream& stream) const {
+    stream.write(text.data(), text.size());
+  }
+
+private:
+  std::vector<char> text;
+};
+
+/// Formats `numBlocks` blocks of text with `formatBlock(block, buffer)` in
+/// parallel and writes them to the stream in order. Blocks are formatted one
+/// round of as many blocks as there are threads at a time, so only that many
+/// buffers are held in memory, and every buffer is written with one call.
+template <typename FormatBlock>
+void writeBlocks(std::ostream& stream, size_t numBlocks,
+                 FormatBlock formatBlock) {
+  std::vector<TextBuffer> buffers(util::getNumBlocks(numBlocks, 1));
+  for (size_t round = 0; round < numBlocks; round += buffers.size()) {
+    size_t numRoundBlocks = std::min(buffers.size(), numBlocks - round);
+    util::parallelFor(numRoundBlocks, [&](size_t i) {
+      buffers[i].clear();
+      formatBlock(round + i, buffers[i]);
+    });
+    for (size_t i = 0; i < numRoundBlocks; i++) {
+      buffers[i].write(stream);
+    }
+  }
+  taco_uassert(stream.good()) << "Error writing tensor";
+}
+
+/// Formats the elements [0, size) of an array with `formatElement(buffer, i)`
+/// and writes them `perLine` to a line, in blocks that are formatted in
+/// parallel.
+template <typename FormatElement>
+void writeLines(std::ostream& stream, size_t size, size_t perLine,
+                FormatElement formatElement) {
+  const size_t blockSize = perLine * 4096;
+  const size_t numBlocks = (size + blockSize - 1) / blockSize;
+  writeBlocks(stream, numBlocks, [&](size_t block, TextBuffer& buffer) {
+    size_t end = std::min((block + 1) * blockSize, size);
+    for (size_t i = block * blockSize; i < end; i++) {
+      formatElement(buffer, i);
+      if ((i + 1) % perLine == 0 || i + 1 == size) {
+        buffer.append('\n');
+      }
+    }
+  });
+}
+
+/// Formats every component of a packed tensor of doubles, in the order they
+/// are stored, with `formatComponent(buffer, coordinate, value)` and writes
+/// them to the stream. The components are split into blocks of positions of
+/// the first level that are formatted in parallel.
+template <typename FormatComponent>
+void writeComponents(std::ostream& stream, const TensorBase& tensor,
+                     FormatComponent formatComponent) {
+  taco_uassert(tensor.getComponentType() == type<double>()) <<
+      "Writing a tensor with " << tensor.getComponentType() <<
+      " components as text is not supported";
+  const storage::Storage& storage = tensor.getStorage();
+  const double* vals = static_cast<const double*>(storage.getValues().getData());
+  if (vals == nullptr) {
+    return;
+  }
+  if (tensor.getOrder() == 0) {
+    writeBlocks(stream, 1, [&](size_t, TextBuffer& buffer) {
+      formatComponent(buffer, std::vector<int>(), vals[0]);
+    });
+    return;
+  }
+
+  const size_t blockSize = 1 << 16;
+  std::vector<detail::NonzeroLevel> levels = detail::getNonzeroLevels(storage);
+  const size_t numPositions = detail::getNumFirstLevelPositions(levels);
+  const size_t numValues = storage.getIndex().getSize();
+  size_t numBlocks = std::max(numValues / blockSize, (size_t)1);
+  numBlocks = std::max(std::min(numBlocks, numPositions), (size_t)1);
+  writeBlocks(stream, numBlocks, [&](size_t block, TextBuffer& buffer) {
+    std::vector<int> coordinate(tensor.getOrder());
+    auto callback = [&](const std::vector<int>& coordinate, double value) {
+      formatComponent(buffer, coordinate, value);
+    };
+    detail::forEachNonzero(levels, 0,
+                           util::getBlockBegin(numPositions, numBlocks, block),
+                           util::getBlockBegin(numPositions, numBlocks,
+                                               block + 1),
+                           0, coordinate, vals, callback);
+  });
+}
+
+}
+#endif
@@ -1,6 +1,12 @@
 #include "taco/storage/pack.h"
 
+#include <algorithm>
 #include <climits>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
 
 #include "taco/format.h"
 #include "taco/error.h"
@@ -9,7 +15,12 @@
 #include "taco/storage/index.h"
 #include "taco/storage/array.h"
 #include "taco/storage/array_util.h"
+#include "taco/taco_tensor_t.h"
 #include "taco/util/collections.h"
+#include "taco/util/env.h"
+#include "taco/util/strings.h"
+#include "codegen/module.h"
+#include "storage/component_ops.h"
 
 using namespace std;
 
@@ -35,102 +46,176 @@ static vector<int> getUniqueEntries(const vector<int>::const_iterator& begin,
   return uniqueEntries;
 }
 
-#define PACK_NEXT_LEVEL(cend) {                                            \
-    if (i + 1 == modeTypes.size()) {                                       \
-      values->push_back((cbegin < cend) ? vals[cbegin] : 0.0);             \
-    } else {                                                               \
-      packTensor(dimensions, coords, vals, cbegin, (cend), modeTypes, i+1, \
-                 indices, values);                                         \
-    }                                                                      \
-}
+/// Packs sorted and unique tensor coordinates into an index structure and a
+/// value array in two passes over the coordinates. The first pass counts the
+/// size of every index array and of the value array, and the second pass
+/// fills arrays that have been allocated with those exact sizes. The
+/// coordinates can be merged with an already packed index and value array of
+/// the same format, whose segments are then merged with the coordinates.
+struct Packer {
+  const vector<int>&         dimensions;
+  const vector<const int*>&  coords;
+  const char*                values;
+  size_t                     valueSize;
+  const vector<ModeType>&    modeTypes;
+  const vector<size_t>&      fixedSizes;
 
-/// Pack tensor coordinates into an index structure and value array.  The
-/// indices consist of one index per tensor mode, and each index contains
-/// [0,2] index arrays.
-static void packTensor(const vector<int>& dimensions,
-                       const vector<vector<int>>& coords,
-                       const double* vals,
-                       size_t begin, size_t end,
-                       const vector<ModeType>& modeTypes, size_t i,
-                       std::vector<std::vector<std::vector<int>>>* indices,
-                       vector<double>* values) {
-  auto& modeType    = modeTypes[i];
-  auto& levelCoords = coords[i];
-  auto& index       = (*indices)[i];
-
-  switch (modeType) {
-    case Dense: {
-      // Iterate over each index value and recursively pack it's segment
-      size_t cbegin = begin;
-      for (int j=0; j < (int)dimensions[i]; ++j) {
-        // Scan to find segment range of children
-        size_t cend = cbegin;
-        while (cend < end && levelCoords[cend] == j) {
-          cend++;
+  /// The packed arrays to merge with, if any.
+  vector<const int*>         mergePos;
+  vector<const int*>         mergeIdx;
+  const char*                mergeVals = nullptr;
+  void                       (*add)(char*, const char*) = nullptr;
+
+  /// False while counting and true while filling.
+  bool                       fill = false;
+
+  /// The number of segments and index values stored for each mode, and the
+  /// number of values stored.
+  vector<size_t>             posSizes;
+  vector<size_t>             idxSizes;
+  size_t                     valsSize = 0;
+
+  /// The arrays to fill.
+  vector<int*>               pos;
+  vector<int*>               idx;
+  char*                      vals = nullptr;
+
+  /// The position of segments that are not in the packed arrays.
+  static const size_t        None = SIZE_MAX;
+
+  Packer(const vector<int>& dimensions, const vector<const int*>& coords,
+         const char* values, size_t valueSize,
+         const vector<ModeType>& modeTypes, const vector<size_t>& fixedSizes)
+      : dimensions(dimensions), coords(coords), values(values),
+        valueSize(valueSize), modeTypes(modeTypes), fixedSizes(fixedSizes),
+        mergePos(modeTypes.size(), nullptr),
+        mergeIdx(modeTypes.size(), nullptr),
+        posSizes(modeTypes.size(), 0), idxSizes(modeTypes.size(), 0),
+        pos(modeTypes.size(), nullptr), idx(modeTypes.size(), nullptr) {
+  }
+
+  /// Count or fill the arrays with the coordinates in [begin, end).
+  void pack(size_t begin, size_t end) {
+    std::fill(posSizes.begin(), posSizes.end(), 0);
+    std::fill(idxSizes.begin(), idxSizes.end(), 0);
+    valsSize = 0;
+    packMode(begin, end, (mergeVals != nullptr) ? 0 : None, 0);
+  }
+
+  /// Returns the end of the run of coordinates in [begin, end) that are
+  /// equal to the coordinate at `begin` in mode `i`.
+  size_t findSegmentEnd(size_t begin, size_t end, size_t i) const {
+    const int* modeCoords = coords[i];
+    size_t segmentEnd = begin;
+    while (segmentEnd < end && modeCoords[segmentEnd] == modeCoords[begin]) {
+      segmentEnd++;
+    }
+    return segmentEnd;
+  }
+
+  void storeIdx(size_t i, int coord) {
+    if (fill) {
+      idx[i][idxSizes[i]] = coord;
+    }
+    idxSizes[i]++;
+  }
+
+  void packNextMode(size_t begin, size_t end, size_t mergePosition, size_t i) {
+    if (i + 1 == modeTypes.size()) {
+      // Zeros are already stored since the value array is zero initialized
+      if (fill) {
+        char* value = &vals[valsSize * valueSize];
+        if (mergePosition != None) {
+          memcpy(value, &mergeVals[mergePosition * valueSize], valueSize);
+        }
+        if (begin < end) {
+          if (mergePosition != None) {
+            add(value, &values[begin * valueSize]);
+          }
+          else {
+            memcpy(value, &values[begin * valueSize], valueSize);
+          }
         }
-        PACK_NEXT_LEVEL(cend);
-        cbegin = cend;
       }
-      break;
+      valsSize++;
     }
-    case Sparse: {
-      auto indexValues = getUniqueEntries(levelCoords.begin()+begin,
-                                          levelCoords.begin()+end);
-
-      // Store segment end: the size of the stored segment is the number of
-      // unique values in the coordinate list
-      index[0].push_back((int)(index[1].size() + indexValues.size()));
-
-      // Store unique index values for this segment
-      index[1].insert(index[1].end(), indexValues.begin(), indexValues.end());
-
-      // Iterate over each index value and recursively pack it's segment
-      size_t cbegin = begin;
-      for (size_t j : indexValues) {
-        // Scan to find segment range of children
-        size_t cend = cbegin;
-        while (cend < end && levelCoords[cend] == (int)j) {
-          cend++;
+    else {
+      packMode(begin, end, mergePosition, i + 1);
+    }
+  }
+
+  void packMode(size_t begin, size_t end, size_t mergePosition, size_t i) {
+    const int* modeCoords = coords[i];
+    switch (modeTypes[i]) {
+      case Dense: {
+        // Iterate over each index value and recursively pack it's segment
+        size_t cbegin = begin;
+        for (int j = 0; j < dimensions[i]; ++j) {
+          size_t cend = (cbegin < end && modeCoords[cbegin] == j)
+                        ? findSegmentEnd(cbegin, end, i) : cbegin;
+          packNextMode(cbegin, cend, (mergePosition != None)
+                                     ? mergePosition * dimensions[i] + j
+                                     : None, i);
+          cbegin = cend;
         }
-        PACK_NEXT_LEVEL(cend);
-        cbegin = cend;
+        break;
       }
-      break;
-    }
-    case Fixed: {
-      size_t fixedValue = index[0][0];
-      auto indexValues = getUniqueEntries(levelCoords.begin()+begin,
-                                          levelCoords.begin()+end);
-
-      // Store segment end: the size of the stored segment is the number of
-      // unique values in the coordinate list
-      size_t segmentSize = indexValues.size() ;
-      // Store unique index values for this segment
-      size_t cbegin = begin;
-      if (segmentSize > 0) {
-        index[1].insert(index[1].end(), indexValues.begin(), indexValues.end());
-        for (size_t j : indexValues) {
-          // Scan to find segment range of children
+      case Sparse: {
+        // Store the unique index values of this segment, merged with those of
+        // the packed segment, and recursively pack their segments
+        size_t k = 0;
+        size_t kend = 0;
+        if (mergePosition != None) {
+          k = mergePos[i][mergePosition];
+          kend = mergePos[i][mergePosition + 1];
+        }
+        size_t cbegin = begin;
+        while (cbegin < end || k < kend) {
+          int coord = (cbegin < end) ? modeCoords[cbegin] : INT_MAX;
+          int mergeCoord = (k < kend) ? mergeIdx[i][k] : INT_MAX;
           size_t cend = cbegin;
-          while (cend < end && levelCoords[cend] == (int)j) {
-            cend++;
+          if (coord <= mergeCoord) {
+            cend = findSegmentEnd(cbegin, end, i);
+          }
+          else {
+            coord = mergeCoord;
           }
-          PACK_NEXT_LEVEL(cend);
+          storeIdx(i, coord);
+          packNextMode(cbegin, cend, (mergeCoord == coord) ? k++ : None, i);
           cbegin = cend;
         }
+
+        // Store segment end
+        if (fill) {
+          pos[i][posSizes[i] + 1] = (int)idxSizes[i];
+        }
+        posSizes[i]++;
+        break;
       }
-      // Complete index if necessary with the last index value
-      auto curSize=segmentSize;
-      while (curSize < fixedValue) {
-        index[1].insert(index[1].end(), 
-                        (segmentSize > 0) ? indexValues[segmentSize-1] : 0);
-        PACK_NEXT_LEVEL(cbegin);
-        curSize++;
+      case Fixed: {
+        taco_iassert(mergePosition == None);
+        size_t segmentSize = 0;
+        int lastCoord = 0;
+        size_t cbegin = begin;
+        while (cbegin < end) {
+          size_t cend = findSegmentEnd(cbegin, end, i);
+          lastCoord = modeCoords[cbegin];
+          storeIdx(i, lastCoord);
+          packNextMode(cbegin, cend, None, i);
+          cbegin = cend;
+          segmentSize++;
+        }
+
+        // Complete index if necessary with the last index value
+        for (; segmentSize < fixedSizes[i]; segmentSize++) {
+          storeIdx(i, lastCoord);
+          packNextMode(cbegin, cbegin, None, i);
+        }
+        break;
       }
-      break;
     }
   }
-}
+};
 
 static size_t findMaxFixedValue(const vector<int>& dimensions,
                                 const vector<vector<int>>& coords,
@@ -199,117 +284,442 @@ static size_t findMaxFixedValue(const vector<int>& dimensions,
   }
 }
 
-Storage pack(const std::vector<int>&              dimensions,
-             const Format&                        format,
-             const std::vector<std::vector<int>>& coordinates,
-             const std::vector<double>            values) {
+/// Packs the coordinates and, if `merged` is not null, merges them with the
+/// packed storage `merged` of the same format.
+static Storage packStorage(const std::vector<int>&        dimensions,
+                           const Format&                  format,
+                           const std::vector<const int*>& coordinates,
+                           const void*                    values,
+                           size_t                         numCoordinates,
+                           DataType                       datatype,
+                           const Storage*                 merged) {
   taco_iassert(dimensions.size() == format.getOrder());
 
   Storage storage(format);
 
   size_t order = dimensions.size();
-  size_t numCoordinates = values.size();
-
-  // Create vectors to store pointers to indices/index sizes
-  vector<vector<vector<int>>> indices;
-  indices.reserve(order);
+  const vector<ModeType>& modeTypes = format.getModeTypes();
 
-  for (size_t i=0; i < order; ++i) {
-    switch (format.getModeTypes()[i]) {
-      case Dense: {
-        indices.push_back({});
-        break;
+  // Compute the segment size of fixed modes
+  vector<size_t> fixedSizes(order, 0);
+  for (size_t i = 0; i < order; ++i) {
+    if (modeTypes[i] == Fixed) {
+      vector<vector<int>> coordinateVectors;
+      for (const int* modeCoordinates : coordinates) {
+        coordinateVectors.push_back(vector<int>(modeCoordinates,
+                                                modeCoordinates +
+                                                numCoordinates));
       }
-      case Sparse: {
-        // Sparse indices have two arrays: a segment array and an index array
-        indices.push_back({{}, {}});
+      fixedSizes[i] = (numCoordinates > 0)
+                      ? findMaxFixedValue(dimensions, coordinateVectors, order,
+                                          i, 0, numCoordinates)
+                      : 0;
+      taco_iassert(fixedSizes[i] <= INT_MAX);
+    }
+  }
 
-        // Add start of first segment
-        indices[i][0].push_back(0);
-        break;
-      }
-      case Fixed: {
-        // Fixed indices have two arrays: a segment array and an index array
-        indices.push_back({{}, {}});
-
-        // Add maximum size to segment array
-        size_t maxSize = findMaxFixedValue(dimensions, coordinates,
-                                           format.getOrder(), i, 0,
-                                           numCoordinates);
-        taco_iassert(maxSize <= INT_MAX);
-        indices[i][0].push_back(static_cast<int>(maxSize));
-        break;
+  // Count the size of every array
+  Packer packer(dimensions, coordinates, (const char*)values,
+                datatype.getNumBytes(), modeTypes, fixedSizes);
+  if (merged != nullptr && order > 0) {
+    for (size_t i = 0; i < order; i++) {
+      taco_iassert(modeTypes[i] != Fixed);
+      if (modeTypes[i] == Sparse) {
+        const ModeIndex modeIndex = merged->getIndex().getModeIndex(i);
+        packer.mergePos[i] = (const int*)modeIndex.getIndexArray(0).getData();
+        packer.mergeIdx[i] = (const int*)modeIndex.getIndexArray(1).getData();
       }
     }
+    packer.mergeVals = (const char*)merged->getValues().getData();
+    packer.add = getComponentOps(datatype).add;
   }
+  packer.pack(0, numCoordinates);
 
-  vector<double> vals;
-  packTensor(dimensions, coordinates, (const double*)values.data(), 0,
-             numCoordinates, format.getModeTypes(), 0, &indices, &vals);
-
-  // Create a tensor index
+  // Allocate every array once and fill them
   vector<ModeIndex> modeIndices;
   for (size_t i = 0; i < order; i++) {
-    ModeType modeType = format.getModeTypes()[i];
-    switch (modeType) {
+    switch (modeTypes[i]) {
       case ModeType::Dense: {
         Array size = makeArray({dimensions[i]});
         modeIndices.push_back(ModeIndex({size}));
         break;
       }
-      case ModeType::Sparse:
+      case ModeType::Sparse: {
+        Array pos = makeArray(type<int>(), packer.posSizes[i] + 1);
+        Array idx = makeArray(type<int>(), packer.idxSizes[i]);
+        packer.pos[i] = (int*)pos.getData();
+        packer.idx[i] = (int*)idx.getData();
+        packer.pos[i][0] = 0;
+        modeIndices.push_back(ModeIndex({pos, idx}));
+        break;
+      }
       case ModeType::Fixed: {
-        Array pos = makeArray(indices[i][0]);
-        Array idx = makeArray(indices[i][1]);
+        Array pos = makeArray({(int)fixedSizes[i]});
+        Array idx = makeArray(type<int>(), packer.idxSizes[i]);
+        packer.idx[i] = (int*)idx.getData();
         modeIndices.push_back(ModeIndex({pos, idx}));
         break;
       }
     }
   }
+  size_t valsSize = (order > 0) ? packer.valsSize : 1;
+  Array vals(datatype, calloc(valsSize, datatype.getNumBytes()), valsSize,
+             Array::Free);
+  packer.vals = (char*)vals.getData();
+  packer.fill = true;
+  if (order > 0) {
+    packer.pack(0, numCoordinates);
+  }
+  else if (numCoordinates > 0) {
+    memcpy(packer.vals, values, datatype.getNumBytes());
+  }
+  else if (merged != nullptr) {
+    memcpy(packer.vals, merged->getValues().getData(), datatype.getNumBytes());
+  }
+
   storage.setIndex(Index(format, modeIndices));
-  storage.setValues(makeArray(vals));
+  storage.setValues(vals);
   return storage;
 }
 
-ir::Stmt packCode(const Format& format) {
+Storage pack(const std::vector<int>&              dimensions,
+             const Format&                        format,
+             const std::vector<const int*>&       coordinates,
+             const void*                          values,
+             size_t                               numCoordinates,
+             DataType                             datatype) {
+  return packStorage(dimensions, format, coordinates, values, numCoordinates,
+                     datatype, nullptr);
+}
+
+Storage packMerged(const Storage&                   storage,
+                   const std::vector<int>&          dimensions,
+                   const Format&                    format,
+                   const std::vector<const int*>&   coordinates,
+                   const void*                      values,
+                   size_t                           numCoordinates,
+                   DataType                         datatype) {
+  taco_iassert(storage.getValues().getType() == datatype);
+  return packStorage(dimensions, format, coordinates, values, numCoordinates,
+                     datatype, &storage);
+}
+
+/// Returns pointers to the coordinates of every mode.
+static vector<const int*> getCoordinatePointers(
+    const vector<vector<int>>& coordinates) {
+  vector<const int*> pointers;
+  for (auto& modeCoordinates : coordinates) {
+    pointers.push_back(modeCoordinates.data());
+  }
+  return pointers;
+}
+
+Storage pack(const std::vector<int>&              dimensions,
+             const Format&                        format,
+             const std::vector<std::vector<int>>& coordinates,
+             const void*                          values,
+             size_t                               numCoordinates,
+             DataType                             datatype) {
+  return pack(dimensions, format, getCoordinatePointers(coordinates), values,
+              numCoordinates, datatype);
+}
+
+Storage pack(const std::vector<int>&              dimensions,
+             const Format&                        format,
+             const std::vector<std::vector<int>>& coordinates,
+             const std::vector<double>            values) {
+  return pack(dimensions, format, getCoordinatePointers(coordinates),
+              values.data(), values.size(), type<double>());
+}
+
+/// Generates the loops that fill mode `i` and the modes below it with the
+/// coordinates in [begin, end), whose parent position is `parentPos`.
+static ir::Stmt packModeCode(const vector<ModeType>& modeTypes, size_t i,
+                             ir::Expr begin, ir::Expr end, ir::Expr parentPos,
+                             const ir::Expr& tensor,
+                             const vector<ir::Expr>& coords,
+                             const ir::Expr& values,
+                             const vector<ir::Expr>& counters) {
   using namespace taco::ir;
 
+  // Store the value of the coordinate, or a zero if there is none
+  if (i == modeTypes.size()) {
+    Expr vals = GetProperty::make(tensor, TensorProperty::Values);
+    Stmt storeValue = Store::make(vals, parentPos, Load::make(values, begin));
+    if (modeTypes.back() == Sparse) {
+      return storeValue;
+    }
+    Expr zero = values.type().isFloat() ? Literal::make(0.0, values.type())
+                                        : Literal::make(0);
+    return IfThenElse::make(Lt::make(begin, end), storeValue,
+                            Store::make(vals, parentPos, zero));
+  }
+
+  string mode = util::toString(i + 1);
+  Expr coord = Var::make("j" + mode, DataType::Int);
+  Expr segmentBegin = Var::make("begin" + mode, DataType::Int);
+  Expr segmentEnd = Var::make("end" + mode, DataType::Int);
+
+  // Find the end of the segment of coordinates equal to `coord`
+  Stmt findSegmentEnd = While::make(
+      And::make(Lt::make(segmentEnd, end),
+                Eq::make(Load::make(coords[i], segmentEnd), coord)),
+      VarAssign::make(segmentEnd, Add::make(segmentEnd, 1)));
+
+  vector<Stmt> code;
+  code.push_back(VarAssign::make(segmentBegin, begin, true));
+  switch (modeTypes[i]) {
+    case Dense: {
+      Expr dimension = GetProperty::make(tensor, TensorProperty::Dimension,
+                                         (int)i);
+      Expr pos = Var::make("p" + mode, DataType::Int);
+      Stmt body = Block::make({
+          VarAssign::make(segmentEnd, segmentBegin, true),
+          findSegmentEnd,
+          VarAssign::make(pos, Add::make(Mul::make(parentPos, dimension),
+                                         coord), true),
+          packModeCode(modeTypes, i+1, segmentBegin, segmentEnd, pos, tensor,
+                       coords, values, counters),
+          VarAssign::make(segmentBegin, segmentEnd)});
+      code.push_back(For::make(coord, 0, dimension, 1, body));
+      break;
+    }
+    case Sparse: {
+      Expr posArray = GetProperty::make(tensor, TensorProperty::Indices, (int)i,
+                                        0, to<Var>(tensor)->name + mode +
+                                           "_pos");
+      Expr idxArray = GetProperty::make(tensor, TensorProperty::Indices, (int)i,
+                                        1, to<Var>(tensor)->name + mode +
+                                           "_idx");
+      Expr pos = counters[i];
+      Stmt body = Block::make({
+          VarAssign::make(coord, Load::make(coords[i], segmentBegin), true),
+          VarAssign::make(segmentEnd, Add::make(segmentBegin, 1), true),
+          findSegmentEnd,
+          Store::make(idxArray, pos, coord),
+          packModeCode(modeTypes, i+1, segmentBegin, segmentEnd, pos, tensor,
+                       coords, values, counters),
+          VarAssign::make(pos, Add::make(pos, 1)),
+          VarAssign::make(segmentBegin, segmentEnd)});
+      code.push_back(While::make(Lt::make(segmentBegin, end), body));
+      code.push_back(Store::make(posArray, Add::make(parentPos, 1), pos));
+      break;
+    }
+    case Fixed:
+      taco_not_supported_yet;
+      break;
+  }
+  return Block::make(code);
+}
+
+ir::Stmt packCode(const Format& format, DataType ctype) {
+  using namespace taco::ir;
+
+  const vector<ModeType>& modeTypes = format.getModeTypes();
+  const size_t order = modeTypes.size();
+  taco_iassert(order > 0);
+
+  Expr tensor = Var::make("A", ctype, format);
+  vector<Expr> coords;
+  for (size_t i = 0; i < order; i++) {
+    coords.push_back(Var::make("coord" + util::toString(i+1), DataType::Int,
+                               true));
+  }
+  Expr values = Var::make("values", ctype, true);
+  Expr numCoordinatesArg = Var::make("numCoordinates", DataType::Int, true);
+  Expr numCoordinates = Var::make("n", DataType::Int);
+
   vector<Stmt> packStmts;
+  packStmts.push_back(VarAssign::make(numCoordinates,
+                                      Load::make(numCoordinatesArg), true));
 
-  // Generate loops to count the size of each level.
-//  ir::Stmt countLoops;
-//  for (auto& level : util::reverse(format.getLevels())) {
-//    if (countLoops.defined()) {
-//
-//    }
-//  }
-
-  // Loops to insert index values
-  Stmt insertLoop;
-  for (ModeType modeType : util::reverse(format.getModeTypes())) {
-    Stmt body = insertLoop.defined()
-        ? insertLoop
-        : VarAssign::make(Var::make("test", DataType::Int), 1.0, true);
-
-    switch (modeType) {
-      case Dense: {
-        Expr dimension = 10;
-        Expr loopVar = Var::make("i", DataType::Int);
-        insertLoop = ir::For::make(loopVar, 0, dimension, 1, body);
-        break;
-      }
-      case Sparse: {
-        break;
-      }
-      case Fixed: {
-        taco_not_supported_yet;
-        break;
-      }
+  // Count the index values of every sparse mode, which is the number of
+  // distinct coordinate prefixes that end in the mode
+  vector<Expr> counters(order);
+  vector<Stmt> countStmts;
+  Expr k = Var::make("k", DataType::Int);
+  Expr differs;
+  for (size_t i = 0; i < order; i++) {
+    string mode = util::toString(i + 1);
+    Expr differsInMode = Neq::make(Load::make(coords[i], k),
+                                   Load::make(coords[i], Sub::make(k, 1)));
+    differs = differs.defined() ? Or::make(differs, differsInMode)
+                                : differsInMode;
+    if (modeTypes[i] == Fixed) {
+      taco_not_supported_yet;
     }
+    if (modeTypes[i] == Sparse) {
+      counters[i] = Var::make("size" + mode, DataType::Int);
+      packStmts.push_back(VarAssign::make(counters[i],
+                                          Min::make(numCoordinates, 1), true));
+      countStmts.push_back(IfThenElse::make(differs,
+          VarAssign::make(counters[i], Add::make(counters[i], 1))));
+    }
+  }
+  if (!countStmts.empty()) {
+    packStmts.push_back(For::make(k, 1, numCoordinates, 1,
+                                  Block::make(countStmts)));
+  }
+
+  // Allocate every array with its exact size
+  Expr numPositions = 1;
+  for (size_t i = 0; i < order; i++) {
+    string mode = util::toString(i + 1);
+    if (modeTypes[i] == Dense) {
+      numPositions = Mul::make(numPositions,
+                               GetProperty::make(tensor,
+                                                 TensorProperty::Dimension,
+                                                 (int)i));
+      continue;
+    }
+    Expr posArray = GetProperty::make(tensor, TensorProperty::Indices, (int)i,
+                                      0, to<Var>(tensor)->name + mode +
+                                         "_pos");
+    Expr idxArray = GetProperty::make(tensor, TensorProperty::Indices, (int)i,
+                                      1, to<Var>(tensor)->name + mode +
+                                         "_idx");
+    packStmts.push_back(Allocate::make(posArray, Add::make(numPositions, 1)));
+    packStmts.push_back(Store::make(posArray, 0, 0));
+    packStmts.push_back(Allocate::make(idxArray, counters[i]));
+    numPositions = counters[i];
+  }
+  packStmts.push_back(Allocate::make(GetProperty::make(tensor,
+                                                       TensorProperty::Values),
+                                     numPositions));
+
+  // Reuse the counters as the positions to insert the next index values at
+  for (size_t i = 0; i < order; i++) {
+    if (modeTypes[i] == Sparse) {
+      packStmts.push_back(VarAssign::make(counters[i], 0));
+    }
+  }
+
+  // Loops to insert index values and values
+  packStmts.push_back(packModeCode(modeTypes, 0, 0, numCoordinates, 0, tensor,
+                                   coords, values, counters));
+
+  vector<Expr> inputs = coords;
+  inputs.push_back(values);
+  inputs.push_back(numCoordinatesArg);
+  return Function::make("pack", inputs, {tensor}, Block::make(packStmts));
+}
+
+/// Returns true if `packCode` can generate a pack kernel for the format and
+/// component type.
+static bool hasPackCode(const Format& format, const DataType& ctype) {
+  if (format.getOrder() == 0 ||
+      util::contains(format.getModeTypes(), ModeType::Fixed)) {
+    return false;
+  }
+  return ctype == Float(64) || ctype == Float(32) || ctype == Int(32);
+}
+
+/// Returns the module with the compiled pack kernel for the format and
+/// component type, or nullptr if the C compiler cannot build it. Modules are
+/// compiled once per compiler and shared by all packs.
+static shared_ptr<ir::Module> getPackModule(const Format& format,
+                                            const DataType& ctype) {
+  static mutex modulesMutex;
+  static map<string, shared_ptr<ir::Module>> modules;
+
+  stringstream key;
+  key << format << ":" << ctype << ":" << util::getFromEnv("TACO_CC", "cc");
+  lock_guard<mutex> lock(modulesMutex);
+  if (!util::contains(modules, key.str())) {
+    auto module = make_shared<ir::Module>();
+    module->addFunction(packCode(format, ctype));
+    if (!module->tryCompile()) {
+      module = nullptr;
+    }
+    modules.insert({key.str(), module});
   }
-  packStmts.push_back(insertLoop);
+  return modules.at(key.str());
+}
+
+Storage packCompiled(const std::vector<int>&              dimensions,
+                     const Format&                        format,
+                     const std::vector<const int*>&       coordinates,
+                     const void*                          values,
+                     size_t                               numCoordinates,
+                     DataType                             datatype) {
+  if (!hasPackCode(format, datatype) || numCoordinates > INT_MAX) {
+    return pack(dimensions, format, coordinates, values, numCoordinates,
+                datatype);
+  }
+  shared_ptr<ir::Module> module = getPackModule(format, datatype);
+  if (module == nullptr) {
+    return pack(dimensions, format, coordinates, values, numCoordinates,
+                datatype);
+  }
+
+  const size_t order = format.getOrder();
+  const vector<ModeType>& modeTypes = format.getModeTypes();
+
+  // Describe the result to the kernel, which allocates its arrays
+  vector<int32_t> modeDimensions(dimensions.begin(), dimensions.end());
+  vector<int32_t> modeOrdering(order);
+  vector<taco_mode_t> tensorModeTypes(order);
+  vector<uint8_t*> modeIndices(2 * order, nullptr);
+  vector<uint8_t**> indices(order);
+  for (size_t i = 0; i < order; i++) {
+    modeOrdering[i] = (int32_t)format.getModeOrdering()[i];
+    tensorModeTypes[i] = (modeTypes[i] == Dense) ? taco_mode_dense
+                                                 : taco_mode_sparse;
+    indices[i] = &modeIndices[2 * i];
+    if (modeTypes[i] == Dense) {
+      modeIndices[2 * i] = (uint8_t*)&modeDimensions[i];
+    }
+  }
+  taco_tensor_t tensorData;
+  tensorData.order = (int32_t)order;
+  tensorData.dimensions = modeDimensions.data();
+  tensorData.csize = (int32_t)datatype.getNumBits();
+  tensorData.mode_ordering = modeOrdering.data();
+  tensorData.mode_types = tensorModeTypes.data();
+  tensorData.indices = indices.data();
+  tensorData.vals = nullptr;
+
+  int32_t numCoords = (int32_t)numCoordinates;
+  vector<void*> arguments;
+  arguments.push_back(&tensorData);
+  for (size_t i = 0; i < order; i++) {
+    arguments.push_back((void*)coordinates[i]);
+  }
+  arguments.push_back(const_cast<void*>(values));
+  arguments.push_back(&numCoords);
+  module->callFuncPacked("pack", arguments.data());
+
+  // Adopt the arrays allocated by the kernel
+  Storage storage(format);
+  vector<ModeIndex> modeIndexArrays;
+  size_t numPositions = 1;
+  for (size_t i = 0; i < order; i++) {
+    if (modeTypes[i] == Dense) {
+      modeIndexArrays.push_back(ModeIndex({makeArray({dimensions[i]})}));
+      numPositions *= dimensions[i];
+      continue;
+    }
+    int* pos = (int*)indices[i][0];
+    size_t numIndexValues = pos[numPositions];
+    modeIndexArrays.push_back(ModeIndex({
+        makeArray(pos, numPositions + 1, Array::Free),
+        makeArray((int*)indices[i][1], numIndexValues, Array::Free)}));
+    numPositions = numIndexValues;
+  }
+  storage.setIndex(Index(format, modeIndexArrays));
+  storage.setValues(Array(datatype, tensorData.vals, numPositions,
+                          Array::Free));
+  return storage;
+}
 
-  return ir::Block::make(packStmts);
+Storage packCompiled(const std::vector<int>&              dimensions,
+                     const Format&                        format,
+                     const std::vector<std::vector<int>>& coordinates,
+                     const void*                          values,
+                     size_t                               numCoordinates,
+                     DataType                             datatype) {
+  return packCompiled(dimensions, format, getCoordinatePointers(coordinates),
+                      values, numCoordinates, datatype);
 }
 
 }}
@@ -1,8 +1,14 @@
 #include "taco/tensor.h"
 
 #include <set>
+#include <algorithm>
+#include <list>
+#include <map>
+#include <mutex>
+#include <cstdint>
 #include <cstring>
 #include <fstream>
+#include <functional>
 #include <sstream>
 #include <limits.h>
 
@@ -11,6 +17,7 @@
 #include "taco/expr/expr.h"
 #include "taco/expr/expr_nodes.h"
 #include "taco/expr/expr_visitor.h"
+#include "taco/expr/schedule.h"
 #include "taco/storage/storage.h"
 #include "taco/storage/index.h"
 #include "taco/storage/array.h"
@@ -19,14 +26,21 @@
 #include "taco/ir/ir.h"
 #include "taco/lower/lower.h"
 #include "lower/iteration_graph.h"
+#include "storage/component_ops.h"
+#include "storage/file_io_gzip.h"
 #include "codegen/module.h"
+#include "taco/util/thread_pool.h"
 #include "taco/taco_tensor_t.h"
 #include "taco/storage/file_io_tns.h"
 #include "taco/storage/file_io_mtx.h"
 #include "taco/storage/file_io_rb.h"
+#include "taco/storage/file_io_bin.h"
+#include "taco/util/env.h"
 #include "taco/util/strings.h"
+#include "taco/util/collections.h"
 #include "taco/util/timers.h"
 #include "taco/util/name_generator.h"
+#include "taco/util/parallel_for.h"
 #include "error/error_messages.h"
 #include "error/error_checks.h"
 
@@ -46,7 +60,24 @@ struct TensorBase::Content {
   storage::Storage      storage;
 
   TensorVar             tensorVar;
+  vector<TensorBase>    operands;
   vector<void*>         arguments;
+  taco_tensor_t*        tensorData = nullptr;
+
+  // The descriptors this tensor's kernels are called with for its operands,
+  // which are separate from the operands' own descriptors so that tensors
+  // that share operands can be computed concurrently
+  vector<taco_tensor_t*> operandData;
+
+  // The coordinate buffers of inserters, which are forgotten by the first
+  // pack after their inserter is destroyed
+  mutex                 insertersMutex;
+  vector<shared_ptr<vector<char>>> inserterBuffers;
+
+  // Caller-owned coordinates and values that the next pack packs
+  vector<const int*>    adoptedCoordinates;
+  const void*           adoptedValues = nullptr;
+  size_t                numAdoptedCoordinates = 0;
 
   size_t                allocSize;
   size_t                valuesSize;
@@ -55,6 +86,14 @@ struct TensorBase::Content {
   Stmt                  computeFunc;
   bool                  assembleWhileCompute;
   shared_ptr<Module>    module;
+  int                   numThreads = 0;
+
+  ~Content() {
+    free(tensorData);
+    for (taco_tensor_t* data : operandData) {
+      free(data);
+    }
+  }
 };
 
 TensorBase::TensorBase() : TensorBase(Float(64)) {
@@ -159,40 +198,133 @@ void TensorBase::reserve(size_t numCoordinates) {
   this->coordinateBuffer->resize(newSize);
 }
 
-void TensorBase::insert(const initializer_list<int>& coordinate, double value) {
-  taco_uassert(coordinate.size() == getOrder()) <<
+char* TensorBase::appendCoordinate(const int* coordinate, size_t order) {
+  taco_uassert(order == getOrder()) <<
       "Wrong number of indices";
-  taco_uassert(getComponentType() == Float(64)) <<
-      "Cannot insert a value of type '" << Float(64) << "' " <<
-      "into a tensor with component type " << getComponentType();
   if ((coordinateBuffer->size() - coordinateBufferUsed) < coordinateSize) {
     coordinateBuffer->resize(coordinateBuffer->size() + coordinateSize);
   }
   int* coordLoc = (int*)&coordinateBuffer->data()[coordinateBufferUsed];
-  for (int idx : coordinate) {
-    *coordLoc = idx;
-    coordLoc++;
+  for (size_t mode = 0; mode < order; mode++) {
+    taco_uassert(coordinate[mode] >= 0 &&
+                 coordinate[mode] < getDimension(mode)) <<
+        "Coordinate " << coordinate[mode] << " is out of bounds";
+    coordLoc[mode] = coordinate[mode];
   }
-  *((double*)coordLoc) = value;
   coordinateBufferUsed += coordinateSize;
+  return (char*)(coordLoc + order);
+}
+
+void TensorBase::insert(const initializer_list<int>& coordinate, double value) {
+  char* valueLoc = appendCoordinate(coordinate.begin(), coordinate.size());
+  getComponentOps(getComponentType()).store(valueLoc, value);
 }
 
 void TensorBase::insert(const std::vector<int>& coordinate, double value) {
-  taco_uassert(coordinate.size() == getOrder()) <<
-      "Wrong number of indices";
-  taco_uassert(getComponentType() == Float(64)) <<
-      "Cannot insert a value of type '" << Float(64) << "' " <<
-      "into a tensor with component type " << getComponentType();
-  if ((coordinateBuffer->size() - coordinateBufferUsed) < coordinateSize) {
-    coordinateBuffer->resize(coordinateBuffer->size() + coordinateSize);
+  char* valueLoc = appendCoordinate(coordinate.data(), coordinate.size());
+  getComponentOps(getComponentType()).store(valueLoc, value);
+}
+
+void TensorBase::insertBulk(const int* coordinates, const double* values,
+                            size_t numCoordinates) {
+  const size_t order = getOrder();
+  reserve(numCoordinates - std::min(numCoordinates,
+                                    (coordinateBuffer->size() -
+                                     coordinateBufferUsed) / coordinateSize));
+  ComponentOps ops = getComponentOps(getComponentType());
+  for (size_t i = 0; i < numCoordinates; i++) {
+    ops.store(appendCoordinate(&coordinates[i * order], order), values[i]);
   }
-  int* coordLoc = (int*)&coordinateBuffer->data()[coordinateBufferUsed];
-  for (int idx : coordinate) {
-    *coordLoc = idx;
-    coordLoc++;
+}
+
+TensorBase::Inserter::Inserter(const TensorBase& tensor,
+                               shared_ptr<vector<char>> buffer)
+    : dimensions(tensor.getDimensions()),
+      coordinateSize(tensor.coordinateSize),
+      storeValue(getComponentOps(tensor.getComponentType()).store),
+      buffer(buffer) {
+}
+
+void TensorBase::Inserter::insert(const int* coordinate, size_t order,
+                                  double value) {
+  taco_uassert(order == dimensions.size()) << "Wrong number of indices";
+  size_t used = buffer->size();
+  buffer->resize(used + coordinateSize);
+  int* coordLoc = (int*)&(*buffer)[used];
+  for (size_t mode = 0; mode < order; mode++) {
+    taco_uassert(coordinate[mode] >= 0 &&
+                 coordinate[mode] < dimensions[mode]) <<
+        "Coordinate " << coordinate[mode] << " is out of bounds";
+    coordLoc[mode] = coordinate[mode];
   }
-  *((double*)coordLoc) = value;
-  coordinateBufferUsed += coordinateSize;
+  storeValue((char*)(coordLoc + order), value);
+}
+
+void TensorBase::Inserter::insert(const initializer_list<int>& coordinate,
+                                  double value) {
+  insert(coordinate.begin(), coordinate.size(), value);
+}
+
+void TensorBase::Inserter::insert(const vector<int>& coordinate,
+                                  double value) {
+  insert(coordinate.data(), coordinate.size(), value);
+}
+
+void TensorBase::Inserter::insertBulk(const int* coordinates,
+                                      const double* values,
+                                      size_t numCoordinates) {
+  const size_t order = dimensions.size();
+  size_t used = buffer->size();
+  buffer->resize(used + numCoordinates * coordinateSize);
+  char* coordLoc = &(*buffer)[used];
+  for (size_t i = 0; i < numCoordinates; i++) {
+    const int* coordinate = &coordinates[i * order];
+    for (size_t mode = 0; mode < order; mode++) {
+      taco_uassert(coordinate[mode] >= 0 &&
+                   coordinate[mode] < dimensions[mode]) <<
+          "Coordinate " << coordinate[mode] << " is out of bounds";
+    }
+    memcpy(coordLoc, coordinate, order * sizeof(int));
+    storeValue(coordLoc + order * sizeof(int), values[i]);
+    coordLoc += coordinateSize;
+  }
+}
+
+TensorBase::Inserter TensorBase::inserter() {
+  auto buffer = make_shared<vector<char>>();
+  lock_guard<mutex> lock(content->insertersMutex);
+  content->inserterBuffers.push_back(buffer);
+  return Inserter(*this, buffer);
+}
+
+void TensorBase::adoptCoordinates(const std::vector<const int*>& coordinates,
+                                  const void* values, size_t numCoordinates) {
+  const size_t order = getOrder();
+  taco_uassert(coordinates.size() == order) << "Wrong number of indices";
+  taco_uassert(content->adoptedValues == nullptr) <<
+      "The tensor must be packed before it adopts more coordinates";
+  taco_uassert(values != nullptr) << "The values must not be null";
+
+  // Check that the coordinates are in bounds
+  const size_t numBlocks = util::getNumBlocks(numCoordinates, 1 << 16);
+  vector<char> isInBounds(numBlocks, true);
+  util::parallelFor(numBlocks, [&](size_t block) {
+    size_t end = util::getBlockBegin(numCoordinates, numBlocks, block + 1);
+    for (size_t mode = 0; mode < order; mode++) {
+      int dimension = getDimension(mode);
+      for (size_t i = util::getBlockBegin(numCoordinates, numBlocks, block);
+           i < end; i++) {
+        isInBounds[block] &= (coordinates[mode][i] >= 0 &&
+                              coordinates[mode][i] < dimension);
+      }
+    }
+  });
+  taco_uassert(std::find(isInBounds.begin(), isInBounds.end(), false) ==
+               isInBounds.end()) << "Coordinate is out of bounds";
+
+  content->adoptedCoordinates = coordinates;
+  content->adoptedValues = values;
+  content->numAdoptedCoordinates = numCoordinates;
 }
 
 const DataType& TensorBase::getComponentType() const {
@@ -221,36 +353,402 @@ size_t TensorBase::getAllocSize() const {
   return content->allocSize;
 }
 
-static size_t numIntegersToCompare = 0;
-static int lexicographicalCmp(const void* a, const void* b) {
-  for (size_t i = 0; i < numIntegersToCompare; i++) {
-    int diff = ((int*)a)[i] - ((int*)b)[i];
-    if (diff != 0) {
-      return diff;
+/// Returns the number of bits needed to represent coordinates in [0, dim).
+static int getNumCoordinateBits(int dimension) {
+  int numBits = 0;
+  while (numBits < 32 && (uint64_t(1) << numBits) < (uint64_t)dimension) {
+    numBits++;
+  }
+  return numBits;
+}
+
+/// Stably sorts `keys`, and permutes `indices` along with them, by the low
+/// `numBits` bits of the keys. This is a least significant digit radix sort
+/// where every digit is counted and scattered by blocks of keys in parallel.
+template <typename Index>
+static void radixSort(vector<uint64_t>& keys, vector<Index>& indices,
+                      int numBits) {
+  const int    digitBits  = 8;
+  const size_t numBuckets = size_t(1) << digitBits;
+  const size_t size       = keys.size();
+  const size_t numBlocks  = util::getNumBlocks(size, 1 << 16);
+
+  vector<uint64_t> sortedKeys(size);
+  vector<Index>    sortedIndices(size);
+  vector<size_t>   offsets(numBlocks * numBuckets);
+  for (int shift = 0; shift < numBits; shift += digitBits) {
+    // Count the digits of every block
+    util::parallelFor(numBlocks, [&](size_t block) {
+      size_t* counts = &offsets[block * numBuckets];
+      std::fill(counts, counts + numBuckets, 0);
+      size_t end = util::getBlockBegin(size, numBlocks, block + 1);
+      for (size_t i = util::getBlockBegin(size, numBlocks, block); i < end;
+           i++) {
+        counts[(keys[i] >> shift) & (numBuckets - 1)]++;
+      }
+    });
+
+    // Turn counts into the offsets every block scatters its digits to, and
+    // skip the digit if all keys share it
+    size_t offset = 0;
+    bool isShared = false;
+    for (size_t bucket = 0; bucket < numBuckets; bucket++) {
+      size_t bucketBegin = offset;
+      for (size_t block = 0; block < numBlocks; block++) {
+        size_t count = offsets[block * numBuckets + bucket];
+        offsets[block * numBuckets + bucket] = offset;
+        offset += count;
+      }
+      isShared |= (offset - bucketBegin == size);
+    }
+    if (isShared) {
+      continue;
     }
+
+    util::parallelFor(numBlocks, [&](size_t block) {
+      size_t* blockOffsets = &offsets[block * numBuckets];
+      size_t end = util::getBlockBegin(size, numBlocks, block + 1);
+      for (size_t i = util::getBlockBegin(size, numBlocks, block); i < end;
+           i++) {
+        size_t position = blockOffsets[(keys[i] >> shift) & (numBuckets-1)]++;
+        sortedKeys[position]    = keys[i];
+        sortedIndices[position] = indices[i];
+      }
+    });
+    keys.swap(sortedKeys);
+    indices.swap(sortedIndices);
   }
-  return 0;
+}
+
+/// Coordinates and values that are laid out with a fixed stride between
+/// consecutive coordinates of a mode and between consecutive values. This
+/// describes both the coordinate buffer, where every coordinate is followed by
+/// its value, and coordinates stored as one array per mode.
+struct StridedCoordinates {
+  /// The first coordinate of every mode, in the storage mode ordering.
+  vector<const char*> modes;
+  size_t              modeStride;
+  const char*         values;
+  size_t              valueStride;
+  size_t              size;
+
+  int coordinate(size_t index, size_t mode) const {
+    return *(const int*)&modes[mode][index * modeStride];
+  }
+
+  const char* value(size_t index) const {
+    return &values[index * valueStride];
+  }
+
+  /// Returns -1, 0 or 1 if coordinate `a` is less than, equal to or greater
+  /// than coordinate `b`.
+  int compare(size_t a, size_t b) const {
+    for (size_t mode = 0; mode < modes.size(); mode++) {
+      int diff = coordinate(a, mode) - coordinate(b, mode);
+      if (diff != 0) {
+        return (diff < 0) ? -1 : 1;
+      }
+    }
+    return 0;
+  }
+};
+
+/// Returns true if the coordinates are sorted, and sets `isUnique` to whether
+/// none of them are duplicates.
+static bool isSorted(const StridedCoordinates& coordinates, bool* isUnique) {
+  const size_t numBlocks = util::getNumBlocks(coordinates.size, 1 << 16);
+  vector<int> maxComparison(numBlocks, -1);
+  util::parallelFor(numBlocks, [&](size_t block) {
+    size_t end = util::getBlockBegin(coordinates.size, numBlocks, block + 1);
+    size_t i = util::getBlockBegin(coordinates.size, numBlocks, block);
+    for (i = (i > 0) ? i : 1; i < end && maxComparison[block] < 1; i++) {
+      maxComparison[block] = std::max(maxComparison[block],
+                                      coordinates.compare(i - 1, i));
+    }
+  });
+  int comparison = *std::max_element(maxComparison.begin(),
+                                     maxComparison.end());
+  *isUnique = (comparison < 0);
+  return (comparison < 1);
+}
+
+/// Sorts coordinates lexicographically and returns them as one vector per
+/// mode with the values of duplicate coordinates summed. The values are
+/// returned as raw components of type `ctype`. Coordinates are sorted by radix
+/// sorting a permutation of them, by as many modes at a time as fit in a
+/// 64-bit key, starting with the last mode. Coordinates that are already
+/// sorted are only deduplicated.
+template <typename Index>
+static void sortCoordinates(const StridedCoordinates& source,
+                            const vector<int>& dimensions,
+                            const DataType& ctype,
+                            vector<vector<int>>& coordinates,
+                            vector<char>& values) {
+  const size_t order = source.modes.size();
+  const size_t numCoordinates = source.size;
+  const size_t numBlocks = util::getNumBlocks(numCoordinates, 1 << 16);
+  auto coordinate = [&](Index index, size_t mode) {
+    return source.coordinate(index, mode);
+  };
+
+  vector<Index> indices(numCoordinates);
+  util::parallelFor(numBlocks, [&](size_t block) {
+    size_t end = util::getBlockBegin(numCoordinates, numBlocks, block + 1);
+    for (size_t i = util::getBlockBegin(numCoordinates, numBlocks, block);
+         i < end; i++) {
+      indices[i] = (Index)i;
+    }
+  });
+
+  bool isUnique;
+  vector<uint64_t> keys(isSorted(source, &isUnique) ? 0 : numCoordinates);
+  size_t lastMode = keys.empty() ? 0 : order;
+  while (lastMode > 0) {
+    // Pack the coordinates of modes [firstMode, lastMode) into the keys
+    size_t firstMode = lastMode;
+    int numBits = 0;
+    while (firstMode > 0 &&
+           numBits + getNumCoordinateBits(dimensions[firstMode-1]) <= 64) {
+      firstMode--;
+      numBits += getNumCoordinateBits(dimensions[firstMode]);
+    }
+    util::parallelFor(numBlocks, [&](size_t block) {
+      size_t end = util::getBlockBegin(numCoordinates, numBlocks, block + 1);
+      for (size_t i = util::getBlockBegin(numCoordinates, numBlocks, block);
+           i < end; i++) {
+        uint64_t key = 0;
+        for (size_t mode = firstMode; mode < lastMode; mode++) {
+          key = (key << getNumCoordinateBits(dimensions[mode])) |
+                (uint32_t)coordinate(indices[i], mode);
+        }
+        keys[i] = key;
+      }
+    });
+    radixSort(keys, indices, numBits);
+    lastMode = firstMode;
+  }
+  vector<uint64_t>().swap(keys);
+
+  // Remove duplicates and sum their values. Every block copies the runs of
+  // equal coordinates that start in it, including the tail of its last run.
+  auto isFirstInRun = [&](size_t i) {
+    if (i == 0) {
+      return true;
+    }
+    for (size_t mode = 0; mode < order; mode++) {
+      if (coordinate(indices[i], mode) != coordinate(indices[i-1], mode)) {
+        return true;
+      }
+    }
+    return false;
+  };
+  vector<size_t> blockOffsets(numBlocks + 1, 0);
+  util::parallelFor(numBlocks, [&](size_t block) {
+    size_t end = util::getBlockBegin(numCoordinates, numBlocks, block + 1);
+    for (size_t i = util::getBlockBegin(numCoordinates, numBlocks, block);
+         i < end; i++) {
+      blockOffsets[block + 1] += isFirstInRun(i);
+    }
+  });
+  for (size_t block = 0; block < numBlocks; block++) {
+    blockOffsets[block + 1] += blockOffsets[block];
+  }
+
+  const size_t numUnique = blockOffsets[numBlocks];
+  coordinates.assign(order, vector<int>(numUnique));
+  const size_t valueSize = ctype.getNumBytes();
+  const ComponentOps ops = getComponentOps(ctype);
+  values.resize(numUnique * valueSize);
+  util::parallelFor(numBlocks, [&](size_t block) {
+    size_t i = util::getBlockBegin(numCoordinates, numBlocks, block);
+    size_t end = util::getBlockBegin(numCoordinates, numBlocks, block + 1);
+    while (i < end && !isFirstInRun(i)) {
+      i++;
+    }
+    size_t j = blockOffsets[block];
+    while (i < end) {
+      for (size_t mode = 0; mode < order; mode++) {
+        coordinates[mode][j] = coordinate(indices[i], mode);
+      }
+      char* value = &values[j * valueSize];
+      memcpy(value, source.value(indices[i]), valueSize);
+      for (i++; i < numCoordinates && !isFirstInRun(i); i++) {
+        ops.add(value, source.value(indices[i]));
+      }
+      j++;
+    }
+  });
+}
+
+/// Returns the number of coordinates from which tensors are packed by compiled
+/// pack kernels. It can be set with the TACO_JIT_PACK_THRESHOLD environment
+/// variable.
+static size_t getJITPackThreshold() {
+  string threshold = util::getFromEnv("TACO_JIT_PACK_THRESHOLD", "");
+  return (threshold != "") ? stoull(threshold) : (size_t(1) << 20);
+}
+
+/// Pack sorted and unique coordinates, with one array per mode, and their
+/// values into a format. Large tensors are packed by a pack kernel that is
+/// compiled for the format.
+static Storage packSorted(const vector<int>& dimensions, const Format& format,
+                          const vector<const int*>& coordinates,
+                          const void* values, size_t numCoordinates,
+                          const DataType& ctype) {
+  if (numCoordinates >= getJITPackThreshold()) {
+    return storage::packCompiled(dimensions, format, coordinates, values,
+                                 numCoordinates, ctype);
+  }
+  return storage::pack(dimensions, format, coordinates, values,
+                       numCoordinates, ctype);
 }
 
 /// Pack coordinates into a data structure given by the tensor format.
 void TensorBase::pack() {
-  taco_tassert(getComponentType().getKind() == DataType::Float &&
-               getComponentType().getNumBits() == 64)
-      << "make the packing machinery work with other primitive types later. "
-      << "Right now we're specializing to doubles so that we can use a "
-      << "resizable vector, but eventually we should use a two pass pack "
-      << "algorithm that figures out sizes first, and then packs the data";
+  packCoordinates(false);
+}
+
+void TensorBase::packIncremental() {
+  const vector<ModeType>& modeTypes = getFormat().getModeTypes();
+  taco_uassert(std::find(modeTypes.begin(), modeTypes.end(),
+                         ModeType::Fixed) == modeTypes.end()) <<
+      "Tensors with fixed modes cannot be packed incrementally";
+  packCoordinates(true);
+}
+
+TensorBase TensorBase::getPacked() const {
+  lock_guard<mutex> lock(content->insertersMutex);
+  bool hasNewCoordinates = (coordinateBufferUsed > 0 ||
+                            content->adoptedValues != nullptr);
+  for (auto& buffer : content->inserterBuffers) {
+    hasNewCoordinates = hasNewCoordinates || !buffer->empty();
+  }
+  if (content->storage.getValues().getData() != nullptr && !hasNewCoordinates) {
+    return *this;
+  }
+
+  TensorBase packed(getName(), getComponentType(), getDimensions(),
+                    getFormat());
+  vector<char>& packedBuffer = *packed.coordinateBuffer;
+  packedBuffer.assign(coordinateBuffer->begin(),
+                      coordinateBuffer->begin() + coordinateBufferUsed);
+  for (auto& buffer : content->inserterBuffers) {
+    packedBuffer.insert(packedBuffer.end(), buffer->begin(), buffer->end());
+  }
+  packed.coordinateBufferUsed = packedBuffer.size();
+  if (content->adoptedValues != nullptr) {
+    packed.adoptCoordinates(content->adoptedCoordinates,
+                            content->adoptedValues,
+                            content->numAdoptedCoordinates);
+  }
+  packed.pack();
+  return packed;
+}
 
+void TensorBase::packCoordinates(bool merge) {
   const size_t order = getOrder();
+  const DataType& ctype = getComponentType();
+
+  // Gather the coordinates inserted through inserters, copying the buffer of
+  // every inserter in parallel
+  {
+    lock_guard<mutex> lock(content->insertersMutex);
+    vector<size_t> offsets = {coordinateBufferUsed};
+    for (auto& buffer : content->inserterBuffers) {
+      offsets.push_back(offsets.back() + buffer->size());
+    }
+    if (offsets.back() > coordinateBufferUsed) {
+      coordinateBuffer->resize(std::max(coordinateBuffer->size(),
+                                        offsets.back()));
+      size_t numBuffers = content->inserterBuffers.size();
+      size_t numBlocks = util::getNumBlocks(numBuffers, 1);
+      util::parallelFor(numBlocks, [&](size_t block) {
+        size_t end = util::getBlockBegin(numBuffers, numBlocks, block + 1);
+        for (size_t i = util::getBlockBegin(numBuffers, numBlocks, block);
+             i < end; i++) {
+          vector<char>& buffer = *content->inserterBuffers[i];
+          if (!buffer.empty()) {
+            memcpy(&(*coordinateBuffer)[offsets[i]], buffer.data(),
+                   buffer.size());
+          }
+          vector<char>().swap(buffer);
+        }
+      });
+      coordinateBufferUsed = offsets.back();
+    }
+
+    // Forget the buffers of inserters that no longer exist, which are empty
+    auto& buffers = content->inserterBuffers;
+    buffers.erase(std::remove_if(buffers.begin(), buffers.end(),
+                                 [](const shared_ptr<vector<char>>& buffer) {
+                                   return buffer.use_count() == 1;
+                                 }), buffers.end());
+  }
 
+  // Coordinates adopted from the caller are packed from where they are,
+  // unless they have to be combined with inserted coordinates
+  if (content->adoptedValues != nullptr && coordinateBufferUsed > 0) {
+    vector<int> coordinate(order);
+    for (size_t i = 0; i < content->numAdoptedCoordinates; i++) {
+      for (size_t mode = 0; mode < order; mode++) {
+        coordinate[mode] = content->adoptedCoordinates[mode][i];
+      }
+      memcpy(appendCoordinate(coordinate.data(), order),
+             (const char*)content->adoptedValues + i * ctype.getNumBytes(),
+             ctype.getNumBytes());
+    }
+    content->adoptedCoordinates.clear();
+    content->adoptedValues = nullptr;
+    content->numAdoptedCoordinates = 0;
+  }
+
+  // Tensors that are packed incrementally keep their components when there
+  // are no new coordinates, and merge new coordinates into them otherwise
+  bool isPacked = (content->storage.getValues().getData() != nullptr);
+  bool hasNewCoordinates = (coordinateBufferUsed > 0 ||
+                            content->adoptedValues != nullptr);
+  if (merge && isPacked && !hasNewCoordinates) {
+    return;
+  }
+  merge = merge && isPacked;
 
-  // Pack scalars
+  // Pack scalars, adding every new value to the packed one when merging.
+  // Scalars without a new value keep the packed one, or are zero.
   if (order == 0) {
-    char* coordLoc = this->coordinateBuffer->data();
-    double scalarValue = *(double*)&coordLoc[this->coordinateSize -
-                                             getComponentType().getNumBytes()];
-    content->storage.setValues(makeArray({scalarValue}));
+    Array value = makeArray(ctype, 1);
+    if (content->adoptedValues != nullptr) {
+      memcpy(value.getData(), content->adoptedValues, ctype.getNumBytes());
+    }
+    else if (coordinateBufferUsed > 0) {
+      memcpy(value.getData(), &this->coordinateBuffer->data()[
+          this->coordinateSize - ctype.getNumBytes()], ctype.getNumBytes());
+    }
+    else if (isPacked) {
+      memcpy(value.getData(), content->storage.getValues().getData(),
+             ctype.getNumBytes());
+    }
+    else {
+      memset(value.getData(), 0, ctype.getNumBytes());
+    }
+    if (merge) {
+      ComponentOps ops = getComponentOps(ctype);
+      memcpy(value.getData(), content->storage.getValues().getData(),
+             ctype.getNumBytes());
+      for (size_t offset = 0; offset < coordinateBufferUsed;
+           offset += coordinateSize) {
+        ops.add((char*)value.getData(), &this->coordinateBuffer->data()[
+            offset + coordinateSize - ctype.getNumBytes()]);
+      }
+      if (content->adoptedValues != nullptr) {
+        ops.add((char*)value.getData(),
+                (const char*)content->adoptedValues);
+      }
+    }
+    content->storage.setValues(value);
+    content->adoptedValues = nullptr;
+    content->numAdoptedCoordinates = 0;
     this->coordinateBuffer->clear();
+    this->coordinateBufferUsed = 0;
     return;
   }
 
@@ -266,85 +764,82 @@ void TensorBase::pack() {
     permutedDimensions[i] = dimensions[permutation[i]];
   }
 
-  taco_iassert((this->coordinateBufferUsed % this->coordinateSize) == 0);
-  size_t numCoordinates = this->coordinateBufferUsed / this->coordinateSize;
-  const size_t coordSize = this->coordinateSize;
-
-  char* coordinatesPtr = coordinateBuffer->data();
-  vector<int> permuteBuffer(order);
-  for (size_t i=0; i < numCoordinates; ++i) {
-    int* coordinate = (int*)coordinatesPtr;
-    for (size_t j = 0; j < order; j++) {
-      permuteBuffer[j] = coordinate[permutation[j]];
+  StridedCoordinates source;
+  if (content->adoptedValues != nullptr) {
+    for (size_t i = 0; i < order; ++i) {
+      source.modes.push_back(
+          (const char*)content->adoptedCoordinates[permutation[i]]);
     }
-    for (size_t j = 0; j < order; j++) {
-      coordinate[j] = permuteBuffer[j];
+    source.modeStride = sizeof(int);
+    source.values = (const char*)content->adoptedValues;
+    source.valueStride = ctype.getNumBytes();
+    source.size = content->numAdoptedCoordinates;
+  }
+  else {
+    taco_iassert((this->coordinateBufferUsed % this->coordinateSize) == 0);
+    const char* buffer = coordinateBuffer->data();
+    for (size_t i = 0; i < order; ++i) {
+      source.modes.push_back(&buffer[permutation[i] * sizeof(int)]);
     }
-    coordinatesPtr += this->coordinateSize;
+    source.modeStride = coordinateSize;
+    source.values = &buffer[order * sizeof(int)];
+    source.valueStride = coordinateSize;
+    source.size = this->coordinateBufferUsed / this->coordinateSize;
   }
-  coordinatesPtr = coordinateBuffer->data();
-
-
-  // The pack code expects the coordinates to be sorted
-  numIntegersToCompare = order;
-  qsort(coordinatesPtr, numCoordinates, coordSize, lexicographicalCmp);
-
 
-  // Move coords into separate arrays and remove duplicates
-  std::vector<std::vector<int>> coordinates(order);
-  for (size_t i=0; i < order; ++i) {
-    coordinates[i] = std::vector<int>(numCoordinates);
-  }
-  std::vector<double> values(numCoordinates);
-  // Copy first coordinate-value pair
-  int* lastCoord = (int*)malloc(order * sizeof(int));
-  if (numCoordinates >= 1) {
-    int* coordComponent = (int*)coordinatesPtr;
-    for (size_t d=0; d < order; ++d) {
-      coordinates[d][0] = *coordComponent;
-      lastCoord[d] = *coordComponent;
-      coordComponent++;
+  // Adopted coordinates that are already sorted in the storage mode ordering
+  // and unique are packed without copying them
+  bool isUnique = false;
+  if (!merge && content->adoptedValues != nullptr &&
+      isSorted(source, &isUnique) && isUnique) {
+    vector<const int*> coordinates;
+    for (const char* mode : source.modes) {
+      coordinates.push_back((const int*)mode);
     }
-    values[0] = *((double*)coordComponent);
+    content->storage = packSorted(permutedDimensions, getFormat(), coordinates,
+                                  source.values, source.size, ctype);
+    content->adoptedCoordinates.clear();
+    content->adoptedValues = nullptr;
+    content->numAdoptedCoordinates = 0;
+    return;
   }
-  // Copy remaining coordinate-value pairs, removing duplicates
-  int j = 1;
-  int* coord = (int*)malloc(order * sizeof(int));
-  for (size_t i=1; i < numCoordinates; ++i) {
-    int* coordLoc = (int*)&coordinatesPtr[i*coordSize];
-    for (size_t d=0; d < order; ++d) {
-      coord[d] = *coordLoc;;
-      coordLoc++;
-    }
-    double value = *((double*)coordLoc);
-    if (memcmp(coord, lastCoord, order*sizeof(int)) != 0) {
-      for (size_t d = 0; d < order; d++) {
-        coordinates[d][j] = coord[d];
-      }
-      values[j] = value;
-      j++;
-    }
-    else {
-      values[j-1] += value;
-    }
+
+  // Sort the coordinates in the storage mode ordering and remove duplicates
+  std::vector<std::vector<int>> coordinates;
+  std::vector<char> values;
+  if (source.size <= UINT32_MAX) {
+    sortCoordinates<uint32_t>(source, permutedDimensions, ctype, coordinates,
+                              values);
   }
-  free(coord);
-  free(lastCoord);
-  if (numCoordinates > 0) {
-    for (size_t i=0; i < order; ++i) {
-      coordinates[i].resize(j);
-    }
-    values.resize(j);
+  else {
+    sortCoordinates<size_t>(source, permutedDimensions, ctype, coordinates,
+                            values);
   }
+
   taco_iassert(coordinates.size() > 0);
   this->coordinateBuffer->clear();
+  this->coordinateBuffer->shrink_to_fit();
   this->coordinateBufferUsed = 0;
+  content->adoptedCoordinates.clear();
+  content->adoptedValues = nullptr;
+  content->numAdoptedCoordinates = 0;
 
   // Pack indices and values
-  content->storage = storage::pack(permutedDimensions, getFormat(),
-                                   coordinates, values);
-
-//  std::cout << storage::packCode(getFormat()) << std::endl;
+  vector<const int*> coordinatePointers;
+  for (auto& modeCoordinates : coordinates) {
+    coordinatePointers.push_back(modeCoordinates.data());
+  }
+  if (merge) {
+    content->storage = storage::packMerged(content->storage,
+                                           permutedDimensions, getFormat(),
+                                           coordinatePointers, values.data(),
+                                           coordinates[0].size(), ctype);
+  }
+  else {
+    content->storage = packSorted(permutedDimensions, getFormat(),
+                                  coordinatePointers, values.data(),
+                                  coordinates[0].size(), ctype);
+  }
 }
 
 void TensorBase::zero() {
@@ -374,67 +869,364 @@ Access TensorBase::operator()(const std::vector<IndexVar>& indices) {
   return Access(new AccessTensorNode(*this, indices));
 }
 
-void TensorBase::compile(bool assembleWhileCompute) {
-  taco_uassert(getTensorVar().getIndexExpr().defined())
-      << error::compile_without_expr;
+/// Prints a canonical form of a tensor's index expression, where tensors and
+/// index variables are named by the order they are first encountered. Two
+/// tensors with the same canonical form compile to interchangeable kernels.
+struct CanonicalPrinter : public ExprVisitorStrict {
+  using ExprVisitorStrict::visit;
+
+  stringstream os;
+  map<TensorVar,string> tensorNames;
+  map<IndexVar,string> indexVarNames;
+
+  string getName(const TensorVar& tensorVar) {
+    if (!util::contains(tensorNames, tensorVar)) {
+      string name = "t" + to_string(tensorNames.size());
+      tensorNames.insert({tensorVar, name});
+      os << name << ":" << tensorVar.getType() << tensorVar.getFormat() << ";";
+    }
+    return tensorNames.at(tensorVar);
+  }
+
+  string getName(const IndexVar& indexVar) {
+    if (!util::contains(indexVarNames, indexVar)) {
+      indexVarNames.insert({indexVar, "i" + to_string(indexVarNames.size())});
+    }
+    return indexVarNames.at(indexVar);
+  }
+
+  void print(const TensorVar& tensorVar) {
+    string name = getName(tensorVar);
+    os << name << "(";
+    for (auto& indexVar : tensorVar.getFreeVars()) {
+      os << getName(indexVar) << ",";
+    }
+    os << ")" << (tensorVar.isAccumulating() ? "+=" : "=");
+    tensorVar.getIndexExpr().accept(this);
+    const Schedule& schedule = tensorVar.getSchedule();
+    os << ";parallel:" << schedule.getParallelSchedule() << ","
+       << schedule.getChunkSize();
+  }
+
+  void visit(const AccessNode* op) {
+    vector<string> indexVars;
+    for (auto& indexVar : op->indexVars) {
+      indexVars.push_back(getName(indexVar));
+    }
+    string name = getName(op->tensorVar);
+    os << name << "(" << util::join(indexVars, ",") << ")";
+  }
+
+  void visit(const NegNode* op) {
+    os << "-(";
+    op->a.accept(this);
+    os << ")";
+  }
+
+  void visit(const SqrtNode* op) {
+    os << "sqrt(";
+    op->a.accept(this);
+    os << ")";
+  }
+
+  void visitBinary(const BinaryExprNode* op, string opstr) {
+    os << "(";
+    op->a.accept(this);
+    os << opstr;
+    op->b.accept(this);
+    os << ")";
+    for (auto& split : op->getOperatorSplits()) {
+      os << "{" << getName(split.getOld()) << "->" << getName(split.getLeft())
+         << "," << getName(split.getRight()) << "}";
+    }
+  }
+
+  void visit(const AddNode* op) {
+    visitBinary(op, "+");
+  }
+
+  void visit(const SubNode* op) {
+    visitBinary(op, "-");
+  }
+
+  void visit(const MulNode* op) {
+    visitBinary(op, "*");
+  }
+
+  void visit(const DivNode* op) {
+    visitBinary(op, "/");
+  }
+
+  void visit(const IntImmNode* op) {
+    os << op->val;
+  }
+
+  void visit(const FloatImmNode* op) {
+    os << op->val << "f";
+  }
+
+  void visit(const DoubleImmNode* op) {
+    os.precision(17);
+    os << op->val;
+  }
+};
+
+/// A compiled kernel that is shared by all tensors whose expressions have the
+/// same canonical form.
+struct CompiledKernel {
+  Stmt                   assembleFunc;
+  Stmt                   computeFunc;
+  shared_ptr<Module>     module;
+  shared_future<void>    compiled;
+  list<string>::iterator use;
+};
 
-  std::set<lower::Property> assembleProperties, computeProperties;
+static map<string,CompiledKernel> compiledKernels;
+static mutex compiledKernelsMutex;
+
+// The keys of the compiled kernels from the most to the least recently used
+static list<string> kernelUses;
+
+/// Returns the number of compiled kernels that are kept for reuse, which can
+/// be set with the TACO_KERNEL_CACHE_SIZE environment variable. The least
+/// recently used kernels are forgotten first, and their modules are released
+/// with the last tensor or kernel that uses them.
+static size_t getKernelCacheSize() {
+  static const size_t size = []() {
+    string size = util::getFromEnv("TACO_KERNEL_CACHE_SIZE", "");
+    return (size != "") ? (size_t)stoull(size) : (size_t)256;
+  }();
+  return size;
+}
+
+static string getKernelKey(const TensorBase& tensor, bool assembleWhileCompute) {
+  CanonicalPrinter printer;
+  printer.os << "assembleWhileCompute:" << assembleWhileCompute << ";"
+             << "allocSize:" << tensor.getAllocSize() << ";";
+  printer.print(tensor.getTensorVar());
+  return printer.os.str();
+}
+
+static inline vector<TensorBase> getTensors(const IndexExpr& expr) {
+  struct GetOperands : public ExprVisitor {
+    using ExprVisitor::visit;
+    set<TensorBase> inserted;
+    vector<TensorBase> operands;
+    void visit(const AccessNode* node) {
+      taco_iassert(isa<AccessTensorNode>(node)) << "Unknown subexpression";
+      TensorBase tensor = to<AccessTensorNode>(node)->tensor;
+      if (!util::contains(inserted, tensor)) {
+        inserted.insert(tensor);
+        operands.push_back(tensor);
+      }
+    }
+  };
+  GetOperands getOperands;
+  expr.accept(&getOperands);
+  return getOperands.operands;
+}
+
+/// Lower the assemble and compute functions of a tensor's expression.
+static void lowerKernel(const TensorBase& tensor, bool assembleWhileCompute,
+                        string assembleName, string computeName,
+                        Stmt* assembleFunc, Stmt* computeFunc) {
+  set<lower::Property> assembleProperties, computeProperties;
   assembleProperties.insert(lower::Assemble);
   computeProperties.insert(lower::Compute);
   if (assembleWhileCompute) {
     computeProperties.insert(lower::Assemble);
   }
 
-  content->assembleWhileCompute = assembleWhileCompute;
-  TensorVar tensorVar = getTensorVar();
-  content->assembleFunc = lower::lower(tensorVar, "assemble",
-                                       assembleProperties, getAllocSize());
-  content->computeFunc  = lower::lower(tensorVar, "compute",
-                                       computeProperties, getAllocSize());
-  content->module->addFunction(content->assembleFunc);
-  content->module->addFunction(content->computeFunc);
-  content->module->compile();
+  TensorVar tensorVar = tensor.getTensorVar();
+  *assembleFunc = lower::lower(tensorVar, assembleName, assembleProperties,
+                               tensor.getAllocSize());
+  *computeFunc  = lower::lower(tensorVar, computeName, computeProperties,
+                               tensor.getAllocSize());
 }
 
-static taco_tensor_t* packTensorData(const TensorBase& tensor) {
-  taco_tensor_t* tensorData = (taco_tensor_t*)malloc(sizeof(taco_tensor_t));
-  size_t order = tensor.getOrder();
-  Storage storage = tensor.getStorage();
-  Format format = storage.getFormat();
+void TensorBase::compile(bool assembleWhileCompute) {
+  compileAsync(assembleWhileCompute).wait();
+}
 
-  taco_iassert(order <= INT_MAX);
-  tensorData->order         = static_cast<int>(order);
-  tensorData->dimensions    = (int32_t*)malloc(order * sizeof(int32_t));
-  tensorData->mode_ordering = (int32_t*)malloc(order * sizeof(int32_t));
-  tensorData->mode_types    = (taco_mode_t*)malloc(order * sizeof(taco_mode_t));
-  tensorData->indices       = (uint8_t***)malloc(order * sizeof(uint8_t***));
+shared_future<void> TensorBase::compileAsync(bool assembleWhileCompute) {
+  return taco::compileAsync({*this}, assembleWhileCompute);
+}
 
-  auto index = storage.getIndex();
-  for (size_t i = 0; i < tensor.getOrder(); i++) {
-    auto modeType  = format.getModeTypes()[i];
-    auto modeIndex = index.getModeIndex(i);
+void compile(const vector<TensorBase>& tensors, bool assembleWhileCompute) {
+  compileAsync(tensors, assembleWhileCompute).wait();
+}
 
-    tensorData->dimensions[i] = tensor.getDimension(i);
+shared_future<void> compileAsync(const vector<TensorBase>& tensors,
+                                 bool assembleWhileCompute) {
+  lock_guard<mutex> lock(compiledKernelsMutex);
+
+  // Reuse the kernels of tensors with the same expression, formats and
+  // dimensions if they have already been compiled in this process, and
+  // collect the distinct kernels that must be compiled.
+  vector<string> keys;
+  vector<TensorBase> uncompiled;
+  vector<string> uncompiledKeys;
+  for (auto& tensor : tensors) {
+    taco_uassert(tensor.getTensorVar().getIndexExpr().defined())
+        << error::compile_without_expr;
+    string key = getKernelKey(tensor, assembleWhileCompute);
+    keys.push_back(key);
+    if (!util::contains(compiledKernels, key) &&
+        !util::contains(uncompiledKeys, key)) {
+      uncompiled.push_back(tensor);
+      uncompiledKeys.push_back(key);
+    }
+  }
+
+  // Lower the distinct kernels into one module, so that they are compiled by
+  // a single compiler invocation. Function names are suffixed by their
+  // position in the batch to make them unique within the module. Kernels
+  // are only cached once they have been lowered.
+  if (uncompiled.size() > 0) {
+    shared_ptr<Module> module = make_shared<Module>();
+    vector<CompiledKernel> kernels(uncompiled.size());
+    for (size_t i = 0; i < uncompiled.size(); i++) {
+      string suffix = (uncompiled.size() > 1) ? to_string(i) : "";
+      CompiledKernel& kernel = kernels[i];
+      lowerKernel(uncompiled[i], assembleWhileCompute, "assemble" + suffix,
+                  "compute" + suffix, &kernel.assembleFunc,
+                  &kernel.computeFunc);
+      kernel.module = module;
+      module->addFunction(kernel.assembleFunc);
+      module->addFunction(kernel.computeFunc);
+    }
+    shared_future<void> compiled = module->compileAsync();
+    for (size_t i = 0; i < uncompiled.size(); i++) {
+      kernels[i].compiled = compiled;
+      kernels[i].use = kernelUses.insert(kernelUses.begin(),
+                                         uncompiledKeys[i]);
+      compiledKernels.insert({uncompiledKeys[i], kernels[i]});
+    }
+  }
+
+  // Hand each tensor its kernel
+  vector<shared_future<void>> compiled;
+  for (size_t i = 0; i < tensors.size(); i++) {
+    const CompiledKernel& kernel = compiledKernels.at(keys[i]);
+    auto& content = tensors[i].content;
+    content->assembleWhileCompute = assembleWhileCompute;
+    content->assembleFunc         = kernel.assembleFunc;
+    content->computeFunc          = kernel.computeFunc;
+    content->module               = kernel.module;
+    content->operands = getTensors(tensors[i].getTensorVar().getIndexExpr());
+    compiled.push_back(kernel.compiled);
+    kernelUses.splice(kernelUses.begin(), kernelUses, kernel.use);
+  }
 
+  // Forget the least recently used kernels
+  while (compiledKernels.size() > getKernelCacheSize()) {
+    compiledKernels.erase(kernelUses.back());
+    kernelUses.pop_back();
+  }
+
+  if (compiled.size() == 1) {
+    return compiled[0];
+  }
+
+  // Wait for the kernels on the compile pool, which runs its tasks in order,
+  // so every compilation has been submitted ahead of the task that waits
+  return getCompilePool().submit([compiled]() {
+    for (auto& kernel : compiled) {
+      kernel.wait();
+    }
+  }).share();
+}
+
+/// Returns the size of a taco_tensor_t descriptor for a tensor of the given
+/// order together with its per-mode arrays, rounded up so that descriptors
+/// can be placed one after the other.
+static size_t getTensorDataSize(size_t order) {
+  size_t size = sizeof(taco_tensor_t) +
+                order * sizeof(uint8_t**) +       // indices
+                order * 2 * sizeof(uint8_t*) +    // indices[i]
+                order * sizeof(taco_mode_t) +     // mode_types
+                order * 2 * sizeof(int32_t);      // dimensions, mode_ordering
+  const size_t alignment = alignof(taco_tensor_t);
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+/// Lay out a taco_tensor_t descriptor for a tensor of the given format,
+/// together with its per-mode arrays, in the zeroed block at `arena` of
+/// `getTensorDataSize` bytes. Fields that are determined by the format are
+/// set here, while dimensions and data pointers are set by `packTensorData`.
+static taco_tensor_t* initTensorData(uint8_t* arena, const Format& format,
+                                     DataType ctype) {
+  size_t order = format.getOrder();
+  taco_tensor_t* tensorData = (taco_tensor_t*)arena;
+  arena += sizeof(taco_tensor_t);
+
+  taco_iassert(order <= INT_MAX);
+  tensorData->order         = static_cast<int>(order);
+  tensorData->indices       = (uint8_t***)arena;
+  arena += order * sizeof(uint8_t**);
+  for (size_t i = 0; i < order; i++) {
+    tensorData->indices[i]  = (uint8_t**)arena;
+    arena += 2 * sizeof(uint8_t*);
+  }
+  tensorData->mode_types    = (taco_mode_t*)arena;
+  arena += order * sizeof(taco_mode_t);
+  tensorData->dimensions    = (int32_t*)arena;
+  arena += order * sizeof(int32_t);
+  tensorData->mode_ordering = (int32_t*)arena;
+
+  for (size_t i = 0; i < order; i++) {
     size_t m = format.getModeOrdering()[i];
     taco_iassert(m <= INT_MAX);
     tensorData->mode_ordering[i] = static_cast<int>(m);
 
-    switch (modeType) {
-      case ModeType::Dense: {
+    switch (format.getModeTypes()[i]) {
+      case ModeType::Dense:
         tensorData->mode_types[i] = taco_mode_dense;
-        tensorData->indices[i]    = (uint8_t**)malloc(1 * sizeof(uint8_t**));
+        break;
+      case ModeType::Sparse:
+        tensorData->mode_types[i] = taco_mode_sparse;
+        break;
+      case ModeType::Fixed:
+        taco_not_supported_yet;
+        break;
+    }
+  }
+
+  taco_iassert(ctype.getNumBits() <= INT_MAX);
+  tensorData->csize = static_cast<int>(ctype.getNumBits());
+  return tensorData;
+}
+
+/// Allocate a descriptor for a tensor of the given format in one block that
+/// is released with a single free.
+static taco_tensor_t* allocTensorData(const Format& format, DataType ctype) {
+  uint8_t* arena =
+      (uint8_t*)calloc(1, getTensorDataSize(format.getOrder()));
+  return initTensorData(arena, format, ctype);
+}
+
+/// Refresh the dimensions and data pointers of a tensor's descriptor.
+static void packTensorData(const TensorBase& tensor,
+                           taco_tensor_t* tensorData) {
+  Storage storage = tensor.getStorage();
+  Format format = storage.getFormat();
 
-        const Array& size = modeIndex.getIndexArray(0);
+  const Index& index = storage.getIndex();
+  for (size_t i = 0; i < tensor.getOrder(); i++) {
+    tensorData->dimensions[i] = tensor.getDimension(i);
+
+    switch (format.getModeTypes()[i]) {
+      case ModeType::Dense: {
+        const Array& size = index.getModeIndex(i).getIndexArray(0);
         tensorData->indices[i][0] = (uint8_t*)size.getData();
         break;
       }
       case ModeType::Sparse: {
-        tensorData->mode_types[i]  = taco_mode_sparse;
-        tensorData->indices[i]    = (uint8_t**)malloc(2 * sizeof(uint8_t**));
-
         // When packing results for assemblies they won't have sparse indices
+        const ModeIndex& modeIndex = index.getModeIndex(i);
         if (modeIndex.numIndexArrays() == 0) {
+          tensorData->indices[i][0] = nullptr;
+          tensorData->indices[i][1] = nullptr;
           continue;
         }
 
@@ -450,15 +1242,15 @@ static taco_tensor_t* packTensorData(const TensorBase& tensor) {
     }
   }
 
-  taco_iassert(tensor.getComponentType().getNumBits() <= INT_MAX);
-  tensorData->csize = static_cast<int>(tensor.getComponentType().getNumBits());
-  tensorData->vals  = (uint8_t*)storage.getValues().getData();
-
-  return tensorData;
+  tensorData->vals = (uint8_t*)storage.getValues().getData();
 }
 
 taco_tensor_t* TensorBase::getTacoTensorT() {
-  return packTensorData(*this);
+  if (content->tensorData == nullptr) {
+    content->tensorData = allocTensorData(getFormat(), getComponentType());
+  }
+  packTensorData(*this, content->tensorData);
+  return content->tensorData;
 }
 
 static size_t unpackTensorData(const taco_tensor_t& tensorData,
@@ -495,46 +1287,43 @@ static size_t unpackTensorData(const taco_tensor_t& tensorData,
   return numVals;
 }
 
-static inline vector<TensorBase> getTensors(const IndexExpr& expr) {
-  struct GetOperands : public ExprVisitor {
-    using ExprVisitor::visit;
-    set<TensorBase> inserted;
-    vector<TensorBase> operands;
-    void visit(const AccessNode* node) {
-      taco_iassert(isa<AccessTensorNode>(node)) << "Unknown subexpression";
-      TensorBase tensor = to<AccessTensorNode>(node)->tensor;
-      if (!util::contains(inserted, tensor)) {
-        inserted.insert(tensor);
-        operands.push_back(tensor);
-      }
-    }
-  };
-  GetOperands getOperands;
-  expr.accept(&getOperands);
-  return getOperands.operands;
-}
-
-static inline
-vector<void*> packArguments(const TensorBase& tensor) {
-  vector<void*> arguments;
 
-  // Pack the result tensor
-  arguments.push_back(packTensorData(tensor));
+/// Pack the descriptors of the result and operand tensors into the tensor's
+/// arguments vector. The descriptors are cached by the result tensor, so
+/// repeated calls do not allocate.
+void TensorBase::packArguments() {
+  const vector<TensorBase>& operands = content->operands;
+  if (content->operandData.size() != operands.size()) {
+    for (taco_tensor_t* data : content->operandData) {
+      free(data);
+    }
+    content->operandData.clear();
+    for (const TensorBase& operand : operands) {
+      content->operandData.push_back(
+          allocTensorData(operand.getFormat(), operand.getComponentType()));
+    }
+  }
 
-  // Pack operand tensors
-  for (auto& operand : getTensors(tensor.getTensorVar().getIndexExpr())) {
-    arguments.push_back(packTensorData(operand));
+  content->arguments.resize(1 + operands.size());
+  content->arguments[0] = getTacoTensorT();
+  for (size_t i = 0; i < operands.size(); i++) {
+    packTensorData(operands[i], content->operandData[i]);
+    content->arguments[i+1] = content->operandData[i];
   }
+}
 
-  return arguments;
+static inline string getFunctionName(const Stmt& func) {
+  return func.as<Function>()->name;
 }
 
 void TensorBase::assemble() {
   taco_uassert(this->content->assembleFunc.defined())
       << error::assemble_without_compile;
 
-  this->content->arguments = packArguments(*this);
-  content->module->callFuncPacked("assemble", content->arguments.data());
+  packArguments();
+  content->module->callFuncPacked(getFunctionName(content->assembleFunc),
+                                  content->arguments.data(),
+                                  content->numThreads);
 
   if (!content->assembleWhileCompute) {
     taco_tensor_t* tensorData = ((taco_tensor_t*)content->arguments[0]);
@@ -546,8 +1335,10 @@ void TensorBase::compute() {
   taco_uassert(this->content->computeFunc.defined())
       << error::compute_without_compile;
 
-  this->content->arguments = packArguments(*this);
-  this->content->module->callFuncPacked("compute", content->arguments.data());
+  packArguments();
+  this->content->module->callFuncPacked(getFunctionName(content->computeFunc),
+                                        content->arguments.data(),
+                                        content->numThreads);
 
   if (content->assembleWhileCompute) {
     taco_tensor_t* tensorData = ((taco_tensor_t*)content->arguments[0]);
@@ -555,6 +1346,11 @@ void TensorBase::compute() {
   }
 }
 
+void TensorBase::setNumThreads(int numThreads) {
+  taco_uassert(numThreads >= 0) << "The number of threads must not be negative";
+  content->numThreads = numThreads;
+}
+
 void TensorBase::evaluate() {
   this->compile();
   if (!getTensorVar().isAccumulating()) {
@@ -563,11 +1359,206 @@ void TensorBase::evaluate() {
   this->compute();
 }
 
+struct Kernel::Content {
+  TensorVar             resultVar;
+  vector<TensorBase>    operands;
+
+  // The index variables of each access in the expression, where index 0
+  // refers to the result and index k > 0 to the k-th operand.
+  vector<pair<size_t,vector<IndexVar>>> accesses;
+
+  Stmt                  assembleFunc;
+  Stmt                  computeFunc;
+  bool                  assembleWhileCompute;
+  shared_ptr<Module>    module;
+  int                   numThreads = 0;
+
+  // The entry points of the assemble and compute functions, which are looked
+  // up once
+  void*                 assembleShim = nullptr;
+  void*                 computeShim = nullptr;
+};
+
+Kernel::Kernel() : content(nullptr) {
+}
+
+Kernel::Kernel(const TensorBase& tensor, bool assembleWhileCompute)
+    : content(new Content) {
+  TensorBase templateTensor = tensor;
+  templateTensor.compile(assembleWhileCompute);
+
+  content->resultVar            = tensor.getTensorVar();
+  content->operands             = getTensors(content->resultVar.getIndexExpr());
+  content->assembleFunc         = templateTensor.content->assembleFunc;
+  content->computeFunc          = templateTensor.content->computeFunc;
+  content->assembleWhileCompute = assembleWhileCompute;
+  content->module               = templateTensor.content->module;
+  content->assembleShim = content->module->getFunc(
+      "_shim_" + getFunctionName(content->assembleFunc));
+  content->computeShim = content->module->getFunc(
+      "_shim_" + getFunctionName(content->computeFunc));
+  taco_iassert(content->assembleShim != nullptr &&
+               content->computeShim != nullptr);
+
+  content->accesses.push_back({0, content->resultVar.getFreeVars()});
+  struct GetAccesses : public ExprVisitor {
+    using ExprVisitor::visit;
+    const vector<TensorBase>* operands;
+    vector<pair<size_t,vector<IndexVar>>> accesses;
+    void visit(const AccessNode* node) {
+      TensorBase tensor = to<AccessTensorNode>(node)->tensor;
+      size_t k = find(operands->begin(), operands->end(), tensor) -
+                 operands->begin();
+      accesses.push_back({k+1, node->indexVars});
+    }
+  };
+  GetAccesses getAccesses;
+  getAccesses.operands = &content->operands;
+  content->resultVar.getIndexExpr().accept(&getAccesses);
+  util::append(content->accesses, getAccesses.accesses);
+}
+
+void Kernel::assemble(TensorBase& result,
+                      const vector<TensorBase>& operands) const {
+  taco_uassert(defined()) << error::assemble_without_compile;
+  call(content->assembleShim, result, operands,
+       !content->assembleWhileCompute);
+}
+
+void Kernel::compute(TensorBase& result,
+                     const vector<TensorBase>& operands) const {
+  taco_uassert(defined()) << error::compute_without_compile;
+  call(content->computeShim, result, operands,
+       content->assembleWhileCompute);
+}
+
+void Kernel::evaluate(TensorBase& result,
+                      const vector<TensorBase>& operands) const {
+  if (!content->resultVar.isAccumulating()) {
+    assemble(result, operands);
+  }
+  compute(result, operands);
+}
+
+void Kernel::setNumThreads(int numThreads) {
+  taco_uassert(numThreads >= 0) << "The number of threads must not be negative";
+  content->numThreads = numThreads;
+}
+
+size_t Kernel::getNumOperands() const {
+  return content->operands.size();
+}
+
+bool Kernel::defined() const {
+  return content != nullptr;
+}
+
+void Kernel::checkArguments(const TensorBase& result,
+                            const vector<TensorBase>& operands) const {
+  taco_uassert(operands.size() == content->operands.size())
+      << "The kernel takes " << content->operands.size() << " operands but "
+      << operands.size() << " were given";
+
+  auto checkTensor = [](const TensorBase& tensor, const TensorVar& var) {
+    taco_uassert(tensor.getComponentType() == var.getType().getDataType())
+        << "Tensor " << tensor.getName() << " has component type "
+        << tensor.getComponentType() << " but the kernel expects "
+        << var.getType().getDataType();
+    taco_uassert(tensor.getOrder() == var.getType().getShape().getOrder())
+        << "Tensor " << tensor.getName() << " has order "
+        << tensor.getOrder() << " but the kernel expects "
+        << var.getType().getShape().getOrder();
+    taco_uassert(tensor.getFormat() == var.getFormat())
+        << "Tensor " << tensor.getName() << " has format "
+        << tensor.getFormat() << " but the kernel expects "
+        << var.getFormat();
+  };
+  // Lowering specializes the loops over small dense modes to their size
+  auto checkDenseDimensions = [](const TensorBase& tensor,
+                                 const TensorVar& var) {
+    const Format& format = var.getFormat();
+    for (size_t level = 0; level < format.getOrder(); level++) {
+      size_t mode = format.getModeOrdering()[level];
+      Dimension dimension = var.getType().getShape().getDimension(mode);
+      if (format.getModeTypes()[level] == ModeType::Dense &&
+          dimension.isFixed() && dimension.getSize() <= 16) {
+        taco_uassert(tensor.getDimension(mode) == (int)dimension.getSize())
+            << "Mode " << mode << " of tensor " << tensor.getName()
+            << " has dimension " << tensor.getDimension(mode)
+            << " but the kernel is specialized to dimension "
+            << dimension.getSize();
+      }
+    }
+  };
+
+  checkTensor(result, content->resultVar);
+  checkDenseDimensions(result, content->resultVar);
+  for (size_t i = 0; i < operands.size(); i++) {
+    checkTensor(operands[i], content->operands[i].getTensorVar());
+    checkDenseDimensions(operands[i], content->operands[i].getTensorVar());
+  }
+
+  map<IndexVar,int> dimensions;
+  for (auto& access : content->accesses) {
+    const TensorBase& tensor = (access.first == 0) ? result
+                                                   : operands[access.first-1];
+    for (size_t mode = 0; mode < access.second.size(); mode++) {
+      const IndexVar& indexVar = access.second[mode];
+      int dimension = tensor.getDimension(mode);
+      if (!util::contains(dimensions, indexVar)) {
+        dimensions.insert({indexVar, dimension});
+      }
+      taco_uassert(dimensions.at(indexVar) == dimension)
+          << "Mode " << mode << " of tensor " << tensor.getName()
+          << " has dimension " << dimension << " but other modes indexed by "
+          << indexVar << " have dimension " << dimensions.at(indexVar);
+    }
+  }
+}
+
+void Kernel::call(void* func, TensorBase& result,
+                  const vector<TensorBase>& operands, bool unpack) const {
+  checkArguments(result, operands);
+
+  // Calls that share tensors may run concurrently, so every thread packs the
+  // descriptors into an arena of its own, which its later calls reuse
+  thread_local vector<uint8_t> arena;
+  thread_local vector<void*> arguments;
+  size_t size = getTensorDataSize(result.getOrder());
+  for (const TensorBase& operand : operands) {
+    size += getTensorDataSize(operand.getOrder());
+  }
+  arena.assign(size, 0);
+  arguments.clear();
+  uint8_t* tensorData = arena.data();
+  auto addArgument = [&](const TensorBase& tensor) {
+    taco_tensor_t* descriptor = initTensorData(tensorData, tensor.getFormat(),
+                                               tensor.getComponentType());
+    packTensorData(tensor, descriptor);
+    arguments.push_back(descriptor);
+    tensorData += getTensorDataSize(tensor.getOrder());
+  };
+  addArgument(result);
+  for (const TensorBase& operand : operands) {
+    addArgument(operand);
+  }
+  content->module->callFunc(func, arguments.data(), content->numThreads);
+
+  if (unpack) {
+    taco_tensor_t* tensorData = ((taco_tensor_t*)arguments[0]);
+    result.content->valuesSize = unpackTensorData(*tensorData, result);
+  }
+}
+
 void TensorBase::setIndexExpression(const vector<IndexVar>& indexVars, IndexExpr expr,
                          bool accumulate) {
   content->tensorVar.setIndexExpression(indexVars, expr, accumulate);
 }
 
+void TensorBase::setSchedule(const Schedule& schedule) {
+  content->tensorVar.setSchedule(schedule);
+}
+
 void TensorBase::printComputeIR(ostream& os, bool color, bool simplify) const {
   IRPrinter printer(os, color, simplify);
   printer.print(content->computeFunc.as<Function>()->body);
@@ -586,6 +1577,10 @@ void TensorBase::compileSource(std::string source) {
   taco_iassert(getTensorVar().getIndexExpr().defined())
       << "No expression defined for tensor";
 
+  // The module may be shared with other tensors, so we compile the user
+  // source into a fresh one.
+  content->module = make_shared<Module>();
+
   set<lower::Property> assembleProperties, computeProperties;
   assembleProperties.insert(lower::Assemble);
   computeProperties.insert(lower::Compute);
@@ -600,44 +1595,49 @@ void TensorBase::compileSource(std::string source) {
   CodeGen_C::generateShim(content->assembleFunc, ss);
   ss << endl;
   CodeGen_C::generateShim(content->computeFunc, ss);
+  content->operands = getTensors(tensorVar.getIndexExpr());
   content->module->setSource(source + "\n" + ss.str());
   content->module->compile();
 }
 
-bool equals(const TensorBase& a, const TensorBase& b) {
-  // Component type must be the same
-  if (a.getComponentType() != b.getComponentType()) {
-    return false;
-  }
-
-  // Orders must be the same
-  if (a.getOrder() != b.getOrder()) {
-    return false;
-  }
-
-  // Dimensions must be the same
-  for (size_t mode = 0; mode < a.getOrder(); mode++) {
-    if (a.getDimension(mode) != b.getDimension(mode)) {
-      return false;
-    }
-  }
-
-  // Values must be the same
-  auto at = iterate<double>(a);
-  auto bt = iterate<double>(b);
-  auto ait = at.begin();
-  auto bit = bt.begin();
+void TensorBase::bindPrecompiled(int (*assemble)(void**),
+                                 int (*compute)(void**),
+                                 bool assembleWhileCompute) {
+  taco_uassert(getTensorVar().getIndexExpr().defined())
+      << error::compile_without_expr;
 
-  for (; ait != at.end() && bit != bt.end(); ++ait, ++bit) {
-    if (ait->first != bit->first) {
-      return false;
-    }
-    if (abs((ait->second - bit->second)/ait->second) > 10e-6) {
-      return false;
-    }
+  // The precompiled kernels take the same packed arguments as the JIT
+  // compiled ones, so we only lower the expression to get the functions'
+  // signatures and never invoke the compiler.
+  content->module = make_shared<Module>();
+  content->assembleWhileCompute = assembleWhileCompute;
+  lowerKernel(*this, assembleWhileCompute, "assemble", "compute",
+              &content->assembleFunc, &content->computeFunc);
+  content->operands = getTensors(getTensorVar().getIndexExpr());
+  content->module->setFunc("_shim_assemble", reinterpret_cast<void*>(assemble));
+  content->module->setFunc("_shim_compute", reinterpret_cast<void*>(compute));
+}
+
+void compileToStaticLibrary(string path, string prefix,
+                            const vector<TensorBase>& tensors,
+                            bool assembleWhileCompute) {
+  Module module;
+  for (size_t i = 0; i < tensors.size(); i++) {
+    taco_uassert(tensors[i].getTensorVar().getIndexExpr().defined())
+        << error::compile_without_expr;
+    Stmt assembleFunc, computeFunc;
+    lowerKernel(tensors[i], assembleWhileCompute,
+                prefix + "_assemble" + to_string(i),
+                prefix + "_compute" + to_string(i),
+                &assembleFunc, &computeFunc);
+    module.addFunction(assembleFunc);
+    module.addFunction(computeFunc);
   }
+  module.compileToStaticLibrary(path, prefix);
+}
 
-  return (ait == at.end() && bit == bt.end());
+bool equals(const TensorBase& a, const TensorBase& b) {
+  return compare(a, b).isEqual;
 }
 
 bool operator==(const TensorBase& a, const TensorBase& b) {
@@ -672,12 +1672,14 @@ ostream& operator<<(ostream& os, const TensorBase& tensor) {
   os << tensor.getName() << " (" << util::join(dimensionStrings, "x") << ") "
      << tensor.getFormat() << ":" << std::endl;
 
-  // Print coordinates
+  // Print coordinates, whose values are stored in the component type
+  const ComponentOps ops = getComponentOps(tensor.getComponentType());
   size_t numCoordinates = tensor.coordinateBufferUsed / tensor.coordinateSize;
   for (size_t i = 0; i < numCoordinates; i++) {
     int* ptr = (int*)&tensor.coordinateBuffer->data()[i*tensor.coordinateSize];
-    os << "(" << util::join(ptr, ptr+tensor.getOrder()) << "): "
-       << ((double*)(ptr+tensor.getOrder()))[0] << std::endl;
+    os << "(" << util::join(ptr, ptr+tensor.getOrder()) << "): ";
+    ops.print(os, (const char*)(ptr+tensor.getOrder()));
+    os << std::endl;
   }
 
   // Print packed data
@@ -686,7 +1688,11 @@ ostream& operator<<(ostream& os, const TensorBase& tensor) {
   return os;
 }
 
+/// Returns the extension of a file name, ignoring a `.gz` extension.
 static string getExtension(string filename) {
+  if (hasGzipExtension(filename)) {
+    filename = filename.substr(0, filename.size() - 3);
+  }
   return filename.substr(filename.find_last_of(".") + 1);
 }
 
@@ -704,25 +1710,41 @@ TensorBase dispatchRead(T& file, FileType filetype, Format format, bool pack) {
     case FileType::rb:
       tensor = readRB(file, format, pack);
       break;
+    case FileType::bin:
+      tensor = readBIN(file, format, pack);
+      break;
   }
   return tensor;
 }
 
+/// Reads a file, decompressing it while it is read if it is compressed.
+static TensorBase readFile(string filename, FileType filetype, Format format,
+                           bool pack) {
+  if (isGzipFile(filename)) {
+    GzipInputStream stream(filename);
+    return dispatchRead(stream, filetype, format, pack);
+  }
+  return dispatchRead(filename, filetype, format, pack);
+}
+
 TensorBase read(std::string filename, Format format, bool pack) {
   string extension = getExtension(filename);
 
   TensorBase tensor;
   if (extension == "ttx") {
-    tensor = dispatchRead(filename, FileType::ttx, format, pack);
+    tensor = readFile(filename, FileType::ttx, format, pack);
   }
   else if (extension == "tns") {
-    tensor = dispatchRead(filename, FileType::tns, format, pack);
+    tensor = readFile(filename, FileType::tns, format, pack);
   }
   else if (extension == "mtx") {
-    tensor = dispatchRead(filename, FileType::mtx, format, pack);
+    tensor = readFile(filename, FileType::mtx, format, pack);
   }
   else if (extension == "rb") {
-    tensor = dispatchRead(filename, FileType::rb, format, pack);
+    tensor = readFile(filename, FileType::rb, format, pack);
+  }
+  else if (extension == "bin") {
+    tensor = readFile(filename, FileType::bin, format, pack);
   }
   else {
     taco_uerror << "File extension not recognized: " << filename << std::endl;
@@ -737,7 +1759,7 @@ TensorBase read(std::string filename, Format format, bool pack) {
 }
 
 TensorBase read(string filename, FileType filetype, Format format, bool pack) {
-  return dispatchRead(filename, filetype, format, pack);
+  return readFile(filename, filetype, format, pack);
 }
 
 TensorBase read(istream& stream, FileType filetype,  Format format, bool pack) {
@@ -757,25 +1779,44 @@ void dispatchWrite(T& file, const TensorBase& tensor, FileType filetype) {
     case FileType::rb:
       writeRB(file, tensor);
       break;
+    case FileType::bin:
+      writeBIN(file, tensor);
+      break;
+  }
+}
+
+/// Writes a file, compressing it while it is written if its name ends with
+/// `.gz`.
+static void writeFile(string filename, const TensorBase& tensor,
+                      FileType filetype) {
+  if (hasGzipExtension(filename)) {
+    GzipOutputStream stream(filename);
+    dispatchWrite(stream, tensor, filetype);
+    stream.close();
+    return;
   }
+  dispatchWrite(filename, tensor, filetype);
 }
 
 void write(string filename, const TensorBase& tensor) {
   string extension = getExtension(filename);
   if (extension == "ttx") {
-    dispatchWrite(filename, tensor, FileType::ttx);
+    writeFile(filename, tensor, FileType::ttx);
   }
   else if (extension == "tns") {
-    dispatchWrite(filename, tensor, FileType::tns);
+    writeFile(filename, tensor, FileType::tns);
   }
   else if (extension == "mtx") {
     taco_iassert(tensor.getOrder() == 2) <<
        "The .mtx format only supports matrices. Consider using the .ttx format "
        "instead";
-    dispatchWrite(filename, tensor, FileType::mtx);
+    writeFile(filename, tensor, FileType::mtx);
   }
   else if (extension == "rb") {
-    dispatchWrite(filename, tensor, FileType::rb);
+    writeFile(filename, tensor, FileType::rb);
+  }
+  else if (extension == "bin") {
+    writeFile(filename, tensor, FileType::bin);
   }
   else {
     taco_uerror << "File extension not recognized: " << filename << std::endl;
@@ -783,7 +1824,7 @@ void write(string filename, const TensorBase& tensor) {
 }
 
 void write(string filename, FileType filetype, const TensorBase& tensor) {
-  dispatchWrite(filename, tensor, filetype);
+  writeFile(filename, tensor, filetype);
 }
 
 void write(ofstream& stream, FileType filetype, const TensorBase& tensor) {
@@ -868,6 +1909,423 @@ void getCSCArrays(const TensorBase& tensor,
   *vals   = static_cast<double*>(storage.getValues().getData());
 }
 
+/// Returns whether the format stores a matrix in a dense and a compressed mode.
+static bool isCompressedMatrix(const Format& format) {
+  return format.getOrder() == 2 && format.getModeTypes()[0] == Dense &&
+         format.getModeTypes()[1] == Sparse;
+}
+
+/// Transposes a compressed matrix with a counting sort of its index: every
+/// block of rows counts its components per column in parallel, the counts are
+/// turned into the first position of every block in every column, and every
+/// block then scatters its components in parallel.
+static Storage transposeCompressed(const Storage& source, const Format& format,
+                                   int numColumns, const DataType& ctype) {
+  const ModeIndex rowIndex = source.getIndex().getModeIndex(0);
+  const ModeIndex columnIndex = source.getIndex().getModeIndex(1);
+  const int numRows = ((const int*)rowIndex.getIndexArray(0).getData())[0];
+  const int* pos = (const int*)columnIndex.getIndexArray(0).getData();
+  const int* idx = (const int*)columnIndex.getIndexArray(1).getData();
+  const char* vals = (const char*)source.getValues().getData();
+  const size_t numBytes = ctype.getNumBytes();
+  const size_t nnz = pos[numRows];
+
+  // Every block keeps a count per column, so blocks are limited by the number
+  // of components per column
+  size_t numBlocks = util::getNumBlocks(nnz, 1 << 14);
+  if (numBlocks * numColumns > 4 * nnz) {
+    numBlocks = std::max((size_t)1, 4 * nnz / std::max(numColumns, 1));
+  }
+  vector<int> offsets(numBlocks * numColumns, 0);
+  util::parallelFor(numBlocks, [&](size_t block) {
+    int* counts = &offsets[block * numColumns];
+    int end = (int)util::getBlockBegin(numRows, numBlocks, block + 1);
+    for (int i = (int)util::getBlockBegin(numRows, numBlocks, block);
+         i < end; i++) {
+      for (int k = pos[i]; k < pos[i+1]; k++) {
+        counts[idx[k]]++;
+      }
+    }
+  });
+
+  Array transposedPos = makeArray(type<int>(), numColumns + 1);
+  Array transposedIdx = makeArray(type<int>(), nnz);
+  Array transposedVals = makeArray(ctype, nnz);
+  int* tpos = (int*)transposedPos.getData();
+  int sum = 0;
+  for (int j = 0; j < numColumns; j++) {
+    tpos[j] = sum;
+    for (size_t block = 0; block < numBlocks; block++) {
+      int count = offsets[block * numColumns + j];
+      offsets[block * numColumns + j] = sum;
+      sum += count;
+    }
+  }
+  tpos[numColumns] = sum;
+
+  // Rows are scattered in increasing order, so every column is sorted
+  int* tidx = (int*)transposedIdx.getData();
+  char* tvals = (char*)transposedVals.getData();
+  util::parallelFor(numBlocks, [&](size_t block) {
+    int* next = &offsets[block * numColumns];
+    int end = (int)util::getBlockBegin(numRows, numBlocks, block + 1);
+    for (int i = (int)util::getBlockBegin(numRows, numBlocks, block);
+         i < end; i++) {
+      for (int k = pos[i]; k < pos[i+1]; k++) {
+        int t = next[idx[k]]++;
+        tidx[t] = i;
+        memcpy(&tvals[t * numBytes], &vals[k * numBytes], numBytes);
+      }
+    }
+  });
+
+  Storage storage(format);
+  storage.setIndex(Index(format, {ModeIndex({makeArray({numColumns})}),
+                                  ModeIndex({transposedPos, transposedIdx})}));
+  storage.setValues(transposedVals);
+  return storage;
+}
+
+/// Writes the coordinates of every component stored in the subtree at
+/// position `p` of level `level` to the components' value positions.
+static void extractCoordinates(const Storage& storage,
+                               const vector<int>& levelDimensions,
+                               vector<int>& coordinate, size_t level, size_t p,
+                               vector<vector<int>>& coordinates) {
+  const Format& format = storage.getFormat();
+  if (level == format.getOrder()) {
+    const vector<size_t>& modeOrdering = format.getModeOrdering();
+    for (size_t i = 0; i < level; i++) {
+      coordinates[modeOrdering[i]][p] = coordinate[i];
+    }
+    return;
+  }
+
+  const ModeIndex modeIndex = storage.getIndex().getModeIndex(level);
+  switch (format.getModeTypes()[level]) {
+    case Dense: {
+      for (int j = 0; j < levelDimensions[level]; j++) {
+        coordinate[level] = j;
+        extractCoordinates(storage, levelDimensions, coordinate, level + 1,
+                           p * levelDimensions[level] + j, coordinates);
+      }
+      break;
+    }
+    case Sparse: {
+      const int* pos = (const int*)modeIndex.getIndexArray(0).getData();
+      const int* idx = (const int*)modeIndex.getIndexArray(1).getData();
+      for (int k = pos[p]; k < pos[p+1]; k++) {
+        coordinate[level] = idx[k];
+        extractCoordinates(storage, levelDimensions, coordinate, level + 1, k,
+                           coordinates);
+      }
+      break;
+    }
+    case Fixed: {
+      const int size = ((const int*)modeIndex.getIndexArray(0).getData())[0];
+      const int* idx = (const int*)modeIndex.getIndexArray(1).getData();
+      for (size_t k = p * size; k < (p + 1) * size; k++) {
+        coordinate[level] = idx[k];
+        extractCoordinates(storage, levelDimensions, coordinate, level + 1, k,
+                           coordinates);
+      }
+      break;
+    }
+  }
+}
+
+/// Returns the coordinates of every component stored in a packed tensor of
+/// order one or more, with one vector per mode and the coordinates of every
+/// component at the position of its value. The coordinates are extracted in
+/// parallel over the positions of the first level.
+static vector<vector<int>> getCoordinates(const Storage& storage,
+                                          const vector<int>& dimensions) {
+  const Format& format = storage.getFormat();
+  const size_t order = format.getOrder();
+  const vector<size_t>& modeOrdering = format.getModeOrdering();
+  vector<int> levelDimensions(order);
+  for (size_t i = 0; i < order; i++) {
+    levelDimensions[i] = dimensions[modeOrdering[i]];
+  }
+  const size_t numValues = storage.getIndex().getSize();
+  vector<vector<int>> coordinates(order, vector<int>(numValues));
+  const ModeIndex firstIndex = storage.getIndex().getModeIndex(0);
+  const int* firstIdx = nullptr;
+  size_t begin = 0;
+  size_t end = levelDimensions[0];
+  switch (format.getModeTypes()[0]) {
+    case Dense:
+      break;
+    case Sparse:
+      begin = ((const int*)firstIndex.getIndexArray(0).getData())[0];
+      end = ((const int*)firstIndex.getIndexArray(0).getData())[1];
+      firstIdx = (const int*)firstIndex.getIndexArray(1).getData();
+      break;
+    case Fixed:
+      end = ((const int*)firstIndex.getIndexArray(0).getData())[0];
+      firstIdx = (const int*)firstIndex.getIndexArray(1).getData();
+      break;
+  }
+  const size_t numPositions = end - begin;
+  const size_t numBlocks = std::min(util::getNumBlocks(numValues, 1 << 16),
+                                    std::max(numPositions, (size_t)1));
+  util::parallelFor(numBlocks, [&](size_t block) {
+    vector<int> coordinate(order);
+    size_t blockEnd = begin + util::getBlockBegin(numPositions, numBlocks,
+                                                  block + 1);
+    for (size_t k = begin + util::getBlockBegin(numPositions, numBlocks, block);
+         k < blockEnd; k++) {
+      coordinate[0] = (firstIdx != nullptr) ? firstIdx[k] : (int)k;
+      extractCoordinates(storage, levelDimensions, coordinate, 1, k,
+                         coordinates);
+    }
+  });
+  return coordinates;
+}
+
+TensorBase convert(const TensorBase& tensor, const Format& format) {
+  const size_t order = tensor.getOrder();
+  taco_uassert(format.getOrder() == order) <<
+      "A tensor of order " << order << " cannot be converted to a format of "
+      "order " << format.getOrder();
+  TensorBase source = tensor.getPacked();
+
+  const DataType& ctype = tensor.getComponentType();
+  TensorBase result(tensor.getName(), ctype, tensor.getDimensions(), format);
+  const Storage& storage = source.getStorage();
+  const Format& sourceFormat = storage.getFormat();
+  if (order == 0) {
+    Array value = makeArray(ctype, 1);
+    memcpy(value.getData(), storage.getValues().getData(), ctype.getNumBytes());
+    result.getStorage().setValues(value);
+    return result;
+  }
+
+  // Compressed matrices are transposed directly
+  if (isCompressedMatrix(sourceFormat) && isCompressedMatrix(format) &&
+      sourceFormat.getModeOrdering()[0] == format.getModeOrdering()[1]) {
+    int numColumns = tensor.getDimension(format.getModeOrdering()[0]);
+    result.getStorage() = transposeCompressed(storage, format, numColumns,
+                                              ctype);
+    return result;
+  }
+
+  const size_t numValues = storage.getIndex().getSize();
+  vector<vector<int>> coordinates = getCoordinates(storage,
+                                                   tensor.getDimensions());
+
+  // Pack the coordinates, which are only sorted if the mode ordering is kept
+  vector<const int*> coordinatePointers;
+  for (auto& modeCoordinates : coordinates) {
+    coordinatePointers.push_back(modeCoordinates.data());
+  }
+  if (numValues > 0) {
+    result.adoptCoordinates(coordinatePointers, storage.getValues().getData(),
+                            numValues);
+  }
+  result.pack();
+  return result;
+}
+
+/// True iff the `size` bytes at `a` and `b` are equal, comparing blocks of
+/// the arrays in parallel.
+static bool equalBytes(const void* a, const void* b, size_t size) {
+  const size_t numBlocks = util::getNumBlocks(size, 1 << 20);
+  vector<char> isEqual(numBlocks);
+  util::parallelFor(numBlocks, [&](size_t block) {
+    size_t begin = util::getBlockBegin(size, numBlocks, block);
+    size_t end = util::getBlockBegin(size, numBlocks, block + 1);
+    isEqual[block] = (end == begin) ||
+                     memcmp((const char*)a + begin, (const char*)b + begin,
+                            end - begin) == 0;
+  });
+  return std::find(isEqual.begin(), isEqual.end(), false) == isEqual.end();
+}
+
+/// True iff the used parts of the index arrays of two packed tensors in the
+/// same format are the same.
+static bool equalIndices(const Storage& a, const Storage& b) {
+  const Format& format = a.getFormat();
+  size_t size = 1;
+  for (size_t i = 0; i < format.getOrder(); i++) {
+    const ModeIndex aIndex = a.getIndex().getModeIndex(i);
+    const ModeIndex bIndex = b.getIndex().getModeIndex(i);
+    const int* aFirst = (const int*)aIndex.getIndexArray(0).getData();
+    const int* bFirst = (const int*)bIndex.getIndexArray(0).getData();
+    switch (format.getModeTypes()[i]) {
+      case Dense:
+        if (aFirst[0] != bFirst[0]) {
+          return false;
+        }
+        size *= aFirst[0];
+        break;
+      case Sparse:
+        if (!equalBytes(aFirst, bFirst, (size + 1) * sizeof(int))) {
+          return false;
+        }
+        size = aFirst[size];
+        break;
+      case Fixed:
+        if (aFirst[0] != bFirst[0]) {
+          return false;
+        }
+        size *= aFirst[0];
+        break;
+    }
+    if (format.getModeTypes()[i] != Dense &&
+        !equalBytes(aIndex.getIndexArray(1).getData(),
+                    bIndex.getIndexArray(1).getData(), size * sizeof(int))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Returns the coordinate of the component stored at value position `p` of a
+/// packed tensor, found by walking the levels from the innermost outwards.
+static vector<int> getCoordinate(const Storage& storage, size_t p) {
+  const Format& format = storage.getFormat();
+  const size_t order = format.getOrder();
+
+  // The number of positions of every level
+  vector<size_t> sizes(order + 1, 1);
+  for (size_t i = 0; i < order; i++) {
+    const int* first = (const int*)storage.getIndex().getModeIndex(i)
+                                          .getIndexArray(0).getData();
+    sizes[i+1] = (format.getModeTypes()[i] == Sparse) ? first[sizes[i]]
+                                                       : sizes[i] * first[0];
+  }
+
+  vector<int> coordinate(order);
+  for (size_t i = order; i-- > 0;) {
+    const ModeIndex modeIndex = storage.getIndex().getModeIndex(i);
+    const int* first = (const int*)modeIndex.getIndexArray(0).getData();
+    const size_t mode = format.getModeOrdering()[i];
+    switch (format.getModeTypes()[i]) {
+      case Dense:
+        coordinate[mode] = (int)(p % first[0]);
+        p /= first[0];
+        break;
+      case Sparse:
+        coordinate[mode] = ((const int*)modeIndex.getIndexArray(1).getData())[p];
+        p = std::upper_bound(first, first + sizes[i] + 1, (int)p) - first - 1;
+        break;
+      case Fixed:
+        coordinate[mode] = ((const int*)modeIndex.getIndexArray(1).getData())[p];
+        p /= first[0];
+        break;
+    }
+  }
+  return coordinate;
+}
+
+/// Adds the errors of a block of components to the comparison, whose first
+/// mismatch is `mismatch` if the block's first mismatch is the first one.
+static void addErrors(const ComponentErrors& errors, TensorComparison& result,
+                      std::function<vector<int>(size_t)> mismatch) {
+  result.maxAbsError = std::max(result.maxAbsError, errors.maxAbsError);
+  result.maxRelError = std::max(result.maxRelError, errors.maxRelError);
+  if (errors.firstMismatch != SIZE_MAX && result.isEqual) {
+    result.isEqual = false;
+    result.mismatch = mismatch(errors.firstMismatch);
+  }
+}
+
+/// Compares two packed tensors in the same format by merging their components
+/// in storage order, comparing components stored in one tensor only to zero.
+static void mergeCompare(const Storage& a, const Storage& b,
+                         const vector<int>& dimensions, const DataType& ctype,
+                         double relTolerance, double absTolerance,
+                         TensorComparison& result) {
+  const size_t order = dimensions.size();
+  const vector<size_t>& modeOrdering = a.getFormat().getModeOrdering();
+  const ComponentOps ops = getComponentOps(ctype);
+  const size_t numBytes = ctype.getNumBytes();
+  const vector<char> zero(numBytes, 0);
+  const size_t aSize = a.getIndex().getSize();
+  const size_t bSize = b.getIndex().getSize();
+  const vector<vector<int>> aCoordinates = getCoordinates(a, dimensions);
+  const vector<vector<int>> bCoordinates = getCoordinates(b, dimensions);
+  const char* aValues = (const char*)a.getValues().getData();
+  const char* bValues = (const char*)b.getValues().getData();
+
+  auto coordinate = [&](const vector<vector<int>>& coordinates, size_t p) {
+    vector<int> coordinate(order);
+    for (size_t mode = 0; mode < order; mode++) {
+      coordinate[mode] = coordinates[mode][p];
+    }
+    return coordinate;
+  };
+  size_t i = 0;
+  size_t j = 0;
+  while (i < aSize || j < bSize) {
+    int comparison = (i == aSize) ? 1 : (j == bSize) ? -1 : 0;
+    for (size_t level = 0; comparison == 0 && level < order; level++) {
+      const size_t mode = modeOrdering[level];
+      comparison = (aCoordinates[mode][i] < bCoordinates[mode][j]) ? -1 :
+                   (aCoordinates[mode][i] > bCoordinates[mode][j]) ? 1 : 0;
+    }
+    const char* aValue = (comparison <= 0) ? &aValues[i * numBytes] : &zero[0];
+    const char* bValue = (comparison >= 0) ? &bValues[j * numBytes] : &zero[0];
+    size_t p = (comparison <= 0) ? i : j;
+    const vector<vector<int>>& coordinates = (comparison <= 0) ? aCoordinates
+                                                                : bCoordinates;
+    addErrors(ops.compare(aValue, bValue, 1, relTolerance, absTolerance),
+              result, [&](size_t) { return coordinate(coordinates, p); });
+    i += (comparison <= 0);
+    j += (comparison >= 0);
+  }
+}
+
+TensorComparison compare(const TensorBase& a, const TensorBase& b,
+                         double relTolerance, double absTolerance) {
+  TensorComparison result;
+  if (a.getComponentType() != b.getComponentType() ||
+      a.getDimensions() != b.getDimensions()) {
+    result.isEqual = false;
+    return result;
+  }
+  TensorBase at = a.getPacked();
+  TensorBase bt = b.getPacked();
+
+  const DataType& ctype = a.getComponentType();
+  const ComponentOps ops = getComponentOps(ctype);
+  const size_t numBytes = ctype.getNumBytes();
+  const Storage& aStorage = at.getStorage();
+  Storage bStorage = (bt.getFormat() == at.getFormat())
+                     ? bt.getStorage()
+                     : convert(bt, at.getFormat()).getStorage();
+
+  // Tensors with the same index arrays have their values compared in parallel
+  if (equalIndices(aStorage, bStorage)) {
+    const size_t size = aStorage.getIndex().getSize();
+    const char* aValues = (const char*)aStorage.getValues().getData();
+    const char* bValues = (const char*)bStorage.getValues().getData();
+    const size_t numBlocks = util::getNumBlocks(size, 1 << 16);
+    vector<ComponentErrors> errors(numBlocks);
+    util::parallelFor(numBlocks, [&](size_t block) {
+      size_t begin = util::getBlockBegin(size, numBlocks, block);
+      size_t end = util::getBlockBegin(size, numBlocks, block + 1);
+      errors[block] = ops.compare(&aValues[begin * numBytes],
+                                  &bValues[begin * numBytes], end - begin,
+                                  relTolerance, absTolerance);
+      if (errors[block].firstMismatch != SIZE_MAX) {
+        errors[block].firstMismatch += begin;
+      }
+    });
+    for (auto& blockErrors : errors) {
+      addErrors(blockErrors, result, [&](size_t p) {
+        return getCoordinate(aStorage, p);
+      });
+    }
+    return result;
+  }
+
+  mergeCompare(aStorage, bStorage, a.getDimensions(), ctype, relTolerance,
+               absTolerance, result);
+  return result;
+}
+
 void packOperands(const TensorBase& tensor) {
   for (TensorBase operand : getTensors(tensor.getTensorVar().getIndexExpr())) {
     operand.pack();
@@ -2,6 +2,8 @@
 #include <ftw.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <errno.h>
+#include <sys/stat.h>
 
 namespace taco {
 namespace util {
@@ -23,4 +25,65 @@ void cachedtmpdirCleanup(void) {
       "Unable to create cleanup taco temporary directory. Sorry.";
   }
 }
+
+/// Returns true iff `dir` is a directory that is owned by the current user
+/// and that no other user can write to, so that libraries in it can be
+/// trusted.
+static bool isPrivateDirectory(const std::string& dir) {
+  struct stat status;
+  return lstat(dir.c_str(), &status) == 0 && S_ISDIR(status.st_mode) &&
+         status.st_uid == getuid() &&
+         (status.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+static std::string findCachedir() {
+  // Unlike the tmpdir the cache directory is shared by all processes of a
+  // user and outlives them. Setting TACO_CACHEDIR to the empty string
+  // disables it.
+  std::string cachedir;
+  const char* tacoCachedir = getenv("TACO_CACHEDIR");
+  if (tacoCachedir != nullptr) {
+    cachedir = tacoCachedir;
+    if (cachedir == "") {
+      return "";
+    }
+    taco_uassert(cachedir.front() == '/') <<
+      "The TACO_CACHEDIR environment variable must be an absolute path";
+  }
+  else {
+    // Default to the user's cache directory, creating it if needed
+    std::string usercache = getFromEnv("XDG_CACHE_HOME", "");
+    if (usercache == "" || usercache.front() != '/') {
+      std::string home = getFromEnv("HOME", "");
+      if (home == "" || home.front() != '/') {
+        return "";
+      }
+      usercache = home + "/.cache";
+    }
+    mkdir(usercache.c_str(), 0700);
+    cachedir = usercache + "/taco";
+  }
+  if (cachedir.back() != '/') {
+    cachedir += '/';
+  }
+
+  // The cache is an optimization, so we silently go without it if the
+  // directory cannot be created or written to, or if other users could place
+  // libraries in it
+  if (mkdir(cachedir.c_str(), 0700) != 0 && errno != EEXIST) {
+    return "";
+  }
+  // (without the trailing slash, which would make lstat follow a symlink)
+  if (!isPrivateDirectory(cachedir.substr(0, cachedir.size() - 1)) ||
+      access(cachedir.c_str(), W_OK) != 0) {
+    return "";
+  }
+  return cachedir;
+}
+
+std::string getCachedir() {
+  static const std::string cachedir = findCachedir();
+  return cachedir;
+}
+
 }}
@@ -1,6 +1,8 @@
 #include "taco/util/strings.h"
 
 #include <iostream>
+#include <iomanip>
+#include <cstdint>
 
 using namespace std;
 
@@ -44,4 +46,15 @@ string fill(string text, char fill, size_t n) {
   return string(prefix,fill) + " " + text + " " + string(suffix,fill);
 }
 
+string hash(const string& text) {
+  uint64_t hash = 14695981039346656037ull;
+  for (char c : text) {
+    hash ^= (uint64_t)(unsigned char)c;
+    hash *= 1099511628211ull;
+  }
+  stringstream ss;
+  ss << hex << setw(16) << setfill('0') << hash;
+  return ss.str();
+}
+
 }}
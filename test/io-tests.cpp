@@ -1,6 +1,19 @@
 #include "test.h"
 
 #include "taco/tensor.h"
+#include "taco/parallel.h"
+#include "taco/storage/file_io_bin.h"
+#include "taco/storage/file_io_mtx.h"
+#include "taco/storage/file_io_rb.h"
+#include "taco/storage/file_io_tns.h"
+#include "taco/util/strings.h"
+#include "storage/file_io_gzip.h"
+#include "taco/util/env.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
 
 using namespace taco;
 
@@ -18,6 +31,16 @@ TEST(io, tns) {
   expected.pack();
 
   ASSERT_TRUE(equals(expected, tensor));
+
+  // Blank lines before the first coordinate do not count towards the order
+  std::stringstream stream("  \n\r\n# comment\n2 3 1.5\n1 1 2\n");
+  TensorBase matrix = readTNS(stream, Sparse);
+  ASSERT_EQ(2u, matrix.getOrder());
+  TensorBase expectedMatrix(Float(64), {2,3});
+  expectedMatrix.insert({1, 2}, 1.5);
+  expectedMatrix.insert({0, 0}, 2.0);
+  expectedMatrix.pack();
+  ASSERT_TRUE(equals(expectedMatrix, matrix));
 }
 
 TEST(io, mtx) {
@@ -127,3 +150,212 @@ TEST(io, mtxsymmetric) {
 
   ASSERT_TRUE(equals(expected, tensor));
 }
+
+TEST(io, bin) {
+  const std::string filename = util::getTmpdir() + "io_bin_test.bin";
+  Format csc({Dense,Sparse}, {1,0});
+  for (auto& format : {Format({Dense,Dense}), CSR, csc,
+                       Format({Sparse,Sparse}), Format({Dense,Fixed})}) {
+    TensorBase expected(Float(32), {3,4}, format);
+    expected.insert({0, 3}, 1.0);
+    expected.insert({2, 1}, 2.0);
+    expected.insert({2, 3}, 3.0);
+    expected.pack();
+    write(filename, expected);
+
+    TensorBase tensor = read(filename, format);
+    ASSERT_EQ(format, tensor.getFormat());
+    ASSERT_EQ(Float(32), tensor.getComponentType());
+    ASSERT_TRUE(equals(expected, tensor)) << format;
+
+    // Tensors stored in another format are converted
+    TensorBase converted = read(filename, FileType::bin, CSR);
+    ASSERT_EQ(CSR, converted.getFormat());
+    ASSERT_TRUE(equals(expected, converted)) << format;
+  }
+
+  TensorBase scalar(Float(64), {}, Format());
+  scalar.insert({}, 4.5);
+  scalar.pack();
+  std::stringstream stream;
+  writeBIN(stream, scalar);
+  ASSERT_TRUE(equals(scalar, readBIN(stream, Format())));
+  std::remove(filename.c_str());
+}
+
+TEST(io, parallel_parse) {
+  // Large enough to be split into several chunks that are parsed in parallel
+  const std::string tnsFilename = util::getTmpdir() + "io_parse_test.tns";
+  const std::string mtxFilename = util::getTmpdir() + "io_parse_test.mtx";
+  const int n = 150000;
+  const std::vector<std::string> values = {"1", "-2.5", "0.125", "3e2",
+      "1.5E-3", "0.1000000000000000055511151231257827", "-7.25e+30", "4."};
+  int numThreads = getNumThreads();
+  setNumThreads(4);
+
+  TensorBase expectedTNS(Float(64), {1000,1000,3}, Sparse);
+  TensorBase expectedMTX(Float(64), {1000,1000}, CSR);
+  std::ofstream tns(tnsFilename);
+  std::ofstream mtx(mtxFilename);
+  tns << "# a comment" << std::endl;
+  mtx << "%%MatrixMarket matrix coordinate real symmetric" << std::endl;
+  mtx << "% a comment" << std::endl;
+  mtx << "1000 1000 " << n << std::endl;
+  for (int k = 0; k < n; k++) {
+    int i = (k * 7919) % 1000;
+    int j = k / 150;
+    const std::string& value = values[k % values.size()];
+    tns << i+1 << " " << j+1 << "\t" << k%3+1 << " " << value << std::endl;
+    mtx << std::max(i,j)+1 << " " << std::min(i,j)+1 << " " << value << "\r\n";
+    if (k % 1000 == 0) {
+      tns << std::endl;
+    }
+    expectedTNS.insert({i, j, k%3}, std::stod(value));
+    expectedMTX.insert({std::max(i,j), std::min(i,j)}, std::stod(value));
+    if (i != j) {
+      expectedMTX.insert({std::min(i,j), std::max(i,j)}, std::stod(value));
+    }
+  }
+  tns.close();
+  mtx.close();
+  expectedTNS.pack();
+  expectedMTX.pack();
+
+  TensorBase tensorTNS = read(tnsFilename, Sparse);
+  ASSERT_EQ(expectedTNS.getDimensions(), tensorTNS.getDimensions());
+  ASSERT_TRUE(equals(expectedTNS, tensorTNS));
+  std::ifstream tnsStream(tnsFilename);
+  ASSERT_TRUE(equals(expectedTNS, readTNS(tnsStream, Sparse)));
+
+  TensorBase tensorMTX = read(mtxFilename, CSR);
+  TensorComparison comparison = compare(expectedMTX, tensorMTX, 0.0);
+  ASSERT_TRUE(comparison.isEqual) << util::join(comparison.mismatch);
+  std::ifstream mtxStream(mtxFilename);
+  ASSERT_TRUE(equals(expectedMTX, readMTX(mtxStream, CSR)));
+
+  setNumThreads(numThreads);
+  std::remove(tnsFilename.c_str());
+  std::remove(mtxFilename.c_str());
+}
+
+TEST(io, tns_streaming) {
+  const std::string filename = util::getTmpdir() + "io_streaming_test.tns";
+  std::ofstream tns(filename);
+  tns << "# a comment" << std::endl;
+  for (int k = 0; k < 5000; k++) {
+    // Every coordinate occurs twice, in different windows
+    int n = (k * 7919) % 2500;
+    tns << n%7+1 << " " << n%13+1 << " " << n/91+1 << " " << k%5+1 << std::endl;
+  }
+  tns.close();
+
+  for (auto& format : {Format({Sparse,Sparse,Sparse}),
+                       Format({Dense,Sparse,Sparse}),
+                       Format({Sparse,Dense,Sparse}, {2,0,1}),
+                       Format({Dense,Dense,Dense}, {1,2,0})}) {
+    TensorBase expected = readTNS(filename, format);
+    TensorBase tensor = readTNSStreaming(filename, format, 4096);
+    ASSERT_EQ(format, tensor.getFormat());
+    ASSERT_EQ(expected.getDimensions(), tensor.getDimensions());
+    ASSERT_TRUE(equals(expected, tensor)) << format;
+    ASSERT_TRUE(equals(tensor, readTNSStreaming(filename, format))) << format;
+  }
+  std::remove(filename.c_str());
+}
+
+TEST(io, parallel_write) {
+  // Large enough to be formatted in several blocks that are written in order
+  int numThreads = getNumThreads();
+  setNumThreads(4);
+  TensorBase tensor(Float(64), {500,400,3}, Format({Sparse,Dense,Sparse}));
+  for (int k = 0; k < 200000; k++) {
+    tensor.insert({k / 400, k % 400, k % 3}, (k % 7 - 3) * 1.0625e5);
+  }
+  tensor.pack();
+
+  std::stringstream expected;
+  forEachNonzero<double>(tensor, [&](const std::vector<int>& coordinate,
+                                     double value) {
+    for (int coord : coordinate) {
+      expected << coord+1 << " ";
+    }
+    expected << value << std::endl;
+  });
+  std::stringstream tns;
+  writeTNS(tns, tensor);
+  ASSERT_EQ(expected.str(), tns.str());
+
+  std::stringstream mtx;
+  writeMTX(mtx, tensor);
+  std::string line;
+  for (int i = 0; i < 3; i++) {
+    std::getline(mtx, line);
+  }
+  ASSERT_EQ(expected.str(), mtx.str().substr(mtx.tellg()));
+
+  TensorBase matrix(Float(64), {300,400}, CSC);
+  for (int k = 0; k < 100000; k++) {
+    matrix.insert({k % 300, k / 300}, (k % 9) * 0.5);
+  }
+  matrix.pack();
+  std::stringstream rb;
+  writeRB(rb, matrix);
+  ASSERT_TRUE(equals(matrix, readRB(rb, CSC)));
+  setNumThreads(numThreads);
+}
+
+TEST(io, gzip) {
+  if (!isGzipSupported()) {
+    return;
+  }
+  TensorBase expected(Float(64), {30,40}, CSR);
+  for (int k = 0; k < 1000; k++) {
+    expected.insert({k % 30, (k * 7) % 40}, (k % 9) * 0.5);
+  }
+  expected.pack();
+
+  for (auto& extension : {".tns", ".mtx", ".bin"}) {
+    const std::string filename = util::getTmpdir() + "io_gzip_test" +
+                                 extension + ".gz";
+    write(filename, expected);
+    ASSERT_TRUE(isGzipFile(filename)) << filename;
+    TensorBase tensor = read(filename, CSR);
+    ASSERT_EQ("io_gzip_test", tensor.getName());
+    ASSERT_TRUE(equals(expected, tensor)) << filename;
+
+    // Compressed files are also recognized by their contents
+    const std::string renamed = util::getTmpdir() + "io_gzip_test" + extension;
+    ASSERT_EQ(0, std::rename(filename.c_str(), renamed.c_str()));
+    ASSERT_TRUE(equals(expected, read(renamed, CSR))) << renamed;
+    std::remove(renamed.c_str());
+  }
+}
+
+TEST(io, rb) {
+  TensorBase csc = read(testDataDirectory()+"rua_32.rb", CSC);
+  ASSERT_EQ(CSC, csc.getFormat());
+  ASSERT_EQ(126u, csc.getStorage().getIndex().getSize());
+  TensorBase csr = read(testDataDirectory()+"rua_32.rb", CSR);
+  ASSERT_EQ(CSR, csr.getFormat());
+  ASSERT_TRUE(equals(csc, csr));
+
+  // Values may have Fortran exponents
+  std::stringstream stream;
+  stream << "Matrix                                                          KEY"
+         << std::endl;
+  stream << "4 1 1 1 0" << std::endl;
+  stream << "RUA 3 2 3 0" << std::endl;
+  stream << "(16I5) (16I5) (4D20.12)" << std::endl;
+  stream << "    1    3    4" << std::endl;
+  stream << "    1    3    2" << std::endl;
+  stream << "0.150000000000D+01 -0.25D-01 2.0d2" << std::endl;
+  TensorBase expected(Float(64), {3,2}, CSC);
+  expected.insert({0, 0}, 1.5);
+  expected.insert({2, 0}, -0.025);
+  expected.insert({1, 1}, 200.0);
+  expected.pack();
+  TensorBase tensor = readRB(stream, CSC);
+  ASSERT_EQ(expected.getDimensions(), tensor.getDimensions());
+  TensorComparison comparison = compare(expected, tensor, 0.0);
+  ASSERT_TRUE(comparison.isEqual) << util::join(comparison.mismatch);
+}
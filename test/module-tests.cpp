@@ -0,0 +1,41 @@
+#include "test.h"
+
+#include "codegen/module.h"
+#include "taco/util/env.h"
+#include "taco/util/strings.h"
+
+using namespace taco;
+using namespace taco::ir;
+
+TEST(module, hash) {
+  ASSERT_EQ(16u, util::hash("").size());
+  ASSERT_EQ(util::hash("int f() {return 1;}"), util::hash("int f() {return 1;}"));
+  ASSERT_NE(util::hash("int f() {return 1;}"), util::hash("int f() {return 2;}"));
+}
+
+TEST(module, cache) {
+  string cachedir = util::getCachedir();
+  if (cachedir == "") {
+    return;
+  }
+
+  Module first;
+  first.setSource("int module_cache_test() { return 42; }\n");
+  string firstPath = first.compile();
+  ASSERT_EQ(cachedir, firstPath.substr(0, cachedir.size()));
+
+  Module second;
+  second.setSource("int module_cache_test() { return 42; }\n");
+  ASSERT_EQ(firstPath, second.compile());
+
+  typedef int (*fnptr_t)();
+  void* v_func_ptr = second.getFunc("module_cache_test");
+  ASSERT_NE(nullptr, v_func_ptr);
+  fnptr_t func_ptr;
+  *reinterpret_cast<void**>(&func_ptr) = v_func_ptr;
+  ASSERT_EQ(42, func_ptr());
+
+  Module third;
+  third.setSource("int module_cache_test() { return 43; }\n");
+  ASSERT_NE(firstPath, third.compile());
+}
@@ -0,0 +1,218 @@
+#include "test.h"
+#include "taco/tensor.h"
+#include "taco/parallel.h"
+
+#include <thread>
+
+using namespace taco;
+
+TEST(parallel, num_threads) {
+  int numThreads = getNumThreads();
+  ASSERT_LT(0, numThreads);
+  setNumThreads(3);
+  ASSERT_EQ(3, getNumThreads());
+  setNumThreads(numThreads);
+  ASSERT_EQ(numThreads, getNumThreads());
+}
+
+TEST(parallel, inserters) {
+  const int n = 100;
+  const int numInserters = 4;
+  Tensor<double> a({n,n}, Format({Dense,Sparse}));
+  a.insert({0,0}, 1.0);
+
+  // Every inserter inserts the same coordinates, so values are summed
+  vector<std::thread> threads;
+  for (int t = 0; t < numInserters; t++) {
+    TensorBase::Inserter inserter = a.inserter();
+    threads.push_back(std::thread([inserter, t]() mutable {
+      for (int i = 0; i < n; i++) {
+        inserter.insert({(i * 7) % n, i}, 1.0 + t);
+      }
+    }));
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  a.pack();
+
+  Tensor<double> expected({n,n}, Format({Dense,Sparse}));
+  for (int i = 0; i < n; i++) {
+    expected.insert({(i * 7) % n, i}, 10.0 + (i == 0));
+  }
+  expected.pack();
+  ASSERT_TRUE(equals(expected, a));
+}
+
+TEST(parallel, inserters_across_packs) {
+  Tensor<double> a({4,4}, Format({Dense,Sparse}));
+  TensorBase::Inserter kept = a.inserter();
+  for (int i = 0; i < 4; i++) {
+    TensorBase::Inserter inserter = a.inserter();
+    inserter.insert({i,i}, 1.0);
+  }
+  a.pack();
+
+  // An inserter that outlives a pack inserts into the next one
+  kept.insert({1,2}, 3.0);
+  a.pack();
+
+  Tensor<double> expected({4,4}, Format({Dense,Sparse}));
+  expected.insert({1,2}, 3.0);
+  expected.pack();
+  ASSERT_TRUE(equals(expected, a));
+}
+
+TEST(parallel, spmv) {
+  const int n = 1000;
+  Tensor<double> B({n,n}, Format({Dense,Sparse}));
+  Tensor<double> c({n}, Format({Dense}));
+  Tensor<double> expected({n}, Format({Dense}));
+  for (int i = 0; i < n; i++) {
+    B.insert({i,i}, 2.0);
+    B.insert({i,(i+1)%n}, 1.0);
+    c.insert({i}, (double)i);
+  }
+  B.pack();
+  c.pack();
+  for (int i = 0; i < n; i++) {
+    expected.insert({i}, 2.0*i + (i+1)%n);
+  }
+  expected.pack();
+
+  int numThreads = getNumThreads();
+  setNumThreads(4);
+
+  IndexVar i, j;
+  Tensor<double> a({n}, Format({Dense}));
+  a(i) = B(i,j) * c(j);
+  a.evaluate();
+  ASSERT_TRUE(equals(expected, a));
+
+  Tensor<double> serial({n}, Format({Dense}));
+  serial(i) = B(i,j) * c(j);
+  serial.setNumThreads(1);
+  serial.evaluate();
+  ASSERT_TRUE(equals(expected, serial));
+
+  setNumThreads(numThreads);
+}
+
+TEST(parallel, schedules) {
+  // A matrix with a few dense hub rows and many short rows
+  const int n = 500;
+  Tensor<double> B({n,n}, Format({Dense,Sparse}));
+  Tensor<double> c({n}, Format({Dense}));
+  Tensor<double> expected({n}, Format({Dense}));
+  for (int i = 0; i < n; i++) {
+    double sum = 0.0;
+    if (i % 100 == 0) {
+      for (int j = 0; j < n; j++) {
+        B.insert({i,j}, 1.0);
+        sum += j;
+      }
+    }
+    else if (i % 3 == 0) {
+      B.insert({i,i}, 2.0);
+      sum += 2.0*i;
+    }
+    c.insert({i}, (double)i);
+    if (sum != 0.0) {
+      expected.insert({i}, sum);
+    }
+  }
+  B.pack();
+  c.pack();
+  expected.pack();
+
+  struct {
+    ParallelSchedule parallelSchedule;
+    int chunkSize;
+    std::string pragma;
+  } schedules[] = {
+    {ParallelSchedule::Static,   0,  "#pragma omp parallel for\n"},
+    {ParallelSchedule::Static,   8,  "schedule(static, 8)"},
+    {ParallelSchedule::Dynamic,  0,  "schedule(dynamic, 16)"},
+    {ParallelSchedule::Dynamic,  4,  "schedule(dynamic, 4)"},
+    {ParallelSchedule::Guided,   0,  "schedule(guided)"},
+    {ParallelSchedule::Guided,   2,  "schedule(guided, 2)"},
+    {ParallelSchedule::Balanced, 0,  "taco_lower_bound("}
+  };
+
+  int numThreads = getNumThreads();
+  setNumThreads(3);
+  for (auto& schedule : schedules) {
+    IndexVar i, j;
+    Tensor<double> a({n}, Format({Dense}));
+    a(i) = B(i,j) * c(j);
+    Schedule s;
+    s.setParallelSchedule(schedule.parallelSchedule, schedule.chunkSize);
+    a.setSchedule(s);
+    a.evaluate();
+    ASSERT_NE(std::string::npos, a.getSource().find(schedule.pragma))
+        << schedule.parallelSchedule << " " << schedule.chunkSize;
+    ASSERT_TRUE(equals(expected, a))
+        << schedule.parallelSchedule << " " << schedule.chunkSize;
+  }
+  setNumThreads(numThreads);
+}
+
+TEST(parallel, sparse_output) {
+  const int n = 300;
+  Format csr({Dense,Sparse});
+  Tensor<double> B({n,n}, csr);
+  Tensor<double> C({n,n}, csr);
+  Tensor<double> expectedAdd({n,n}, csr);
+  Tensor<double> expectedMul({n,n}, csr);
+  for (int i = 0; i < n; i++) {
+    // Rows of varying length that only partly overlap
+    for (int j = i % 7; j < n; j += 5 + i % 11) {
+      B.insert({i,j}, 1.0 + j);
+    }
+    for (int j = i % 3; j < n; j += 3 + i % 5) {
+      C.insert({i,j}, 2.0);
+    }
+  }
+  B.pack();
+  C.pack();
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) {
+      bool inB = (j >= i % 7) && ((j - i % 7) % (5 + i % 11) == 0);
+      bool inC = (j >= i % 3) && ((j - i % 3) % (3 + i % 5) == 0);
+      double b = inB ? 1.0 + j : 0.0;
+      double c = inC ? 2.0 : 0.0;
+      if (inB || inC) {
+        expectedAdd.insert({i,j}, b + c);
+      }
+      if (inB && inC) {
+        expectedMul.insert({i,j}, b * c);
+      }
+    }
+  }
+  expectedAdd.pack();
+  expectedMul.pack();
+
+  int numThreads = getNumThreads();
+  setNumThreads(4);
+  for (auto schedule : {ParallelSchedule::Default, ParallelSchedule::Static,
+                        ParallelSchedule::Balanced}) {
+    IndexVar i, j;
+    Schedule s;
+    s.setParallelSchedule(schedule);
+
+    Tensor<double> add({n,n}, csr);
+    add(i,j) = B(i,j) + C(i,j);
+    add.setSchedule(s);
+    add.evaluate();
+    ASSERT_NE(std::string::npos, add.getSource().find("#pragma omp parallel"))
+        << schedule;
+    ASSERT_TRUE(equals(expectedAdd, add)) << schedule;
+
+    Tensor<double> mul({n,n}, csr);
+    mul(i,j) = B(i,j) * C(i,j);
+    mul.setSchedule(s);
+    mul.evaluate();
+    ASSERT_TRUE(equals(expectedMul, mul)) << schedule;
+  }
+  setNumThreads(numThreads);
+}
@@ -1,8 +1,18 @@
 #include "test.h"
 #include "taco/tensor.h"
+#include "taco/parallel.h"
+#include "taco/storage/pack.h"
 
+#include <chrono>
+#include <future>
+#include <sstream>
+#include <thread>
 #include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <dlfcn.h>
 #include "taco/util/collections.h"
+#include "taco/util/env.h"
 
 using namespace taco;
 
@@ -62,3 +72,784 @@ TEST(tensor, duplicates) {
     ASSERT_EQ(vals.at(val.first), val.second);
   }
 }
+
+TEST(tensor, pack_sorted) {
+  // Large enough to be sorted in parallel, with many duplicates and with
+  // coordinates that do not fit in one 64-bit sort key
+  const int n = 200000;
+  const int dim = 1 << 30;
+  int numThreads = getNumThreads();
+  setNumThreads(4);
+  Tensor<double> a({dim,dim,dim}, Format({Sparse,Sparse,Sparse}, {2,0,1}));
+  map<vector<int>,double> vals;
+  for (int i = 0; i < n; i++) {
+    vector<int> coord = {(i * 7919) % 1000, (int)((i * 104729LL) % dim), (i % 3) * 5};
+    a.insert(coord, 1.0 + i % 4);
+    vals[{coord[2], coord[0], coord[1]}] += 1.0 + i % 4;
+  }
+  a.pack();
+  setNumThreads(numThreads);
+
+  auto expected = vals.begin();
+  for (auto& val : a) {
+    ASSERT_TRUE(expected != vals.end());
+    ASSERT_EQ(expected->first[0], val.first[2]);
+    ASSERT_EQ(expected->first[1], val.first[0]);
+    ASSERT_EQ(expected->first[2], val.first[1]);
+    ASSERT_EQ(expected->second, val.second);
+    expected++;
+  }
+  ASSERT_TRUE(expected == vals.end());
+}
+
+TEST(tensor, pack_types) {
+  Tensor<int64_t> a({4,5}, Format({Dense,Sparse}));
+  a.insert({3,1}, (int64_t(1) << 40) + 1);
+  a.insert({0,4}, 2);
+  a.insert({3,1}, 3);
+  a.pack();
+  ASSERT_EQ(2u, a.getStorage().getValues().getSize());
+  map<vector<int>,int64_t> avals = {{{0,4}, 2}, {{3,1}, (int64_t(1)<<40)+4}};
+  for (auto& val : a) {
+    ASSERT_TRUE(util::contains(avals, val.first));
+    ASSERT_EQ(avals.at(val.first), val.second);
+  }
+
+  Tensor<float> b({3,3}, Format({Dense,Dense}));
+  b.insert({1,2}, 1.5f);
+  b.insert({1,2}, 2.0);
+  b.pack();
+  ASSERT_EQ(9u, b.getStorage().getValues().getSize());
+  ASSERT_EQ(3.5f, ((float*)b.getStorage().getValues().getData())[5]);
+}
+
+TEST(tensor, print_unpacked) {
+  Tensor<float> a("a", {3,3}, Format({Dense,Sparse}));
+  a.insert({1,2}, 1.5f);
+  stringstream aout;
+  aout << a;
+  ASSERT_NE(string::npos, aout.str().find("(1, 2): 1.5\n")) << aout.str();
+
+  Tensor<int> b("b", {3}, Format({Sparse}));
+  b.insert({0}, 7);
+  b.insert({2}, -3);
+  stringstream bout;
+  bout << b;
+  ASSERT_NE(string::npos, bout.str().find("(0): 7\n")) << bout.str();
+  ASSERT_NE(string::npos, bout.str().find("(2): -3\n")) << bout.str();
+}
+
+TEST(tensor, pack_compiled) {
+  // Sorted and unique coordinates of a 4x5x3 tensor, with empty slices
+  vector<vector<int>> coordinates = {{0, 0, 0, 2, 2, 3},
+                                     {1, 1, 4, 0, 3, 3},
+                                     {0, 2, 1, 1, 0, 2}};
+  vector<double> values = {1.0, 2.0, 3.0, 4.0, 5.0, 6.0};
+  vector<int> dimensions = {4, 5, 3};
+  for (auto& format : {Format({Dense,Dense,Dense}),
+                       Format({Dense,Sparse,Sparse}),
+                       Format({Sparse,Dense,Sparse}),
+                       Format({Sparse,Sparse,Dense}),
+                       Format({Sparse,Sparse,Sparse})}) {
+    storage::Storage expected = storage::pack(dimensions, format, coordinates,
+                                              values);
+    storage::Storage actual =
+        storage::packCompiled(dimensions, format, coordinates, values.data(),
+                              values.size(), type<double>());
+    for (size_t i = 0; i < dimensions.size(); i++) {
+      auto expectedIndex = expected.getIndex().getModeIndex(i);
+      auto actualIndex = actual.getIndex().getModeIndex(i);
+      ASSERT_EQ(expectedIndex.numIndexArrays(), actualIndex.numIndexArrays());
+      for (size_t j = 0; j < expectedIndex.numIndexArrays(); j++) {
+        auto expectedArray = expectedIndex.getIndexArray(j);
+        auto actualArray = actualIndex.getIndexArray(j);
+        ASSERT_EQ(expectedArray.getSize(), actualArray.getSize()) << format;
+        for (size_t k = 0; k < expectedArray.getSize(); k++) {
+          ASSERT_EQ(((int*)expectedArray.getData())[k],
+                    ((int*)actualArray.getData())[k]) << format;
+        }
+      }
+    }
+    ASSERT_EQ(expected.getValues().getSize(), actual.getValues().getSize());
+    for (size_t k = 0; k < expected.getValues().getSize(); k++) {
+      ASSERT_EQ(((double*)expected.getValues().getData())[k],
+                ((double*)actual.getValues().getData())[k]) << format;
+    }
+  }
+}
+
+TEST(tensor, pack_compiled_without_compiler) {
+  // Packs fall back to the interpreted pack if the kernel cannot be compiled
+  string cc = util::getFromEnv("TACO_CC", "");
+  string threshold = util::getFromEnv("TACO_JIT_PACK_THRESHOLD", "");
+  setenv("TACO_CC", "/nonexistent/taco-cc", 1);
+  setenv("TACO_JIT_PACK_THRESHOLD", "1", 1);
+
+  Tensor<double> a({3,4}, Format({Sparse,Sparse}));
+  a.insert({2,1}, 1.0);
+  a.insert({0,3}, 2.0);
+  a.pack();
+
+  for (auto& var : {make_pair(string("TACO_CC"), cc),
+                    make_pair(string("TACO_JIT_PACK_THRESHOLD"), threshold)}) {
+    if (var.second != "") {
+      setenv(var.first.c_str(), var.second.c_str(), 1);
+    }
+    else {
+      unsetenv(var.first.c_str());
+    }
+  }
+
+  Tensor<double> expected({3,4}, Format({Sparse,Sparse}));
+  expected.insert({2,1}, 1.0);
+  expected.insert({0,3}, 2.0);
+  expected.pack();
+  ASSERT_TRUE(equals(expected, a));
+}
+
+TEST(tensor, insert_bulk) {
+  Tensor<double> a({3,4}, CSR);
+  vector<int> coordinates = {2,1, 0,3, 2,1, 0,0};
+  vector<double> values = {1.0, 2.0, 3.0, 4.0};
+  a.insertBulk(coordinates.data(), values.data(), values.size());
+  a.pack();
+
+  Tensor<double> expected({3,4}, CSR);
+  expected.insert({0,0}, 4.0);
+  expected.insert({0,3}, 2.0);
+  expected.insert({2,1}, 4.0);
+  expected.pack();
+  ASSERT_TRUE(equals(expected, a));
+}
+
+TEST(tensor, adopt_coordinates) {
+  Tensor<double> expected({3,4}, CSR);
+  expected.insert({0,0}, 4.0);
+  expected.insert({0,3}, 2.0);
+  expected.insert({2,1}, 1.0);
+  expected.pack();
+
+  // Sorted and unique coordinates are packed from the caller's arrays
+  vector<int> rows = {0, 0, 2};
+  vector<int> cols = {0, 3, 1};
+  vector<double> values = {4.0, 2.0, 1.0};
+  Tensor<double> a({3,4}, CSR);
+  a.adoptCoordinates({rows.data(), cols.data()}, values.data(), values.size());
+  a.pack();
+  ASSERT_TRUE(equals(expected, a));
+
+  // Unsorted coordinates with duplicates, and combined with inserted ones
+  vector<int> unsortedRows = {2, 0, 2};
+  vector<int> unsortedCols = {1, 3, 1};
+  vector<double> unsortedValues = {0.25, 2.0, 0.75};
+  Tensor<double> b({3,4}, CSR);
+  b.insert({0,0}, 4.0);
+  b.adoptCoordinates({unsortedRows.data(), unsortedCols.data()},
+                     unsortedValues.data(), unsortedValues.size());
+  b.pack();
+  ASSERT_TRUE(equals(expected, b));
+
+  // Coordinates that are sorted by row are not sorted in column-major order
+  Format csc({Dense,Sparse}, {1,0});
+  Tensor<double> expectedCSC({3,4}, csc);
+  expectedCSC.insert({0,0}, 4.0);
+  expectedCSC.insert({0,3}, 2.0);
+  expectedCSC.insert({2,1}, 1.0);
+  expectedCSC.pack();
+  Tensor<double> c({3,4}, csc);
+  c.adoptCoordinates({rows.data(), cols.data()}, values.data(), values.size());
+  c.pack();
+  ASSERT_TRUE(equals(expectedCSC, c));
+}
+
+TEST(tensor, pack_incremental) {
+  Format dcsr({Sparse,Sparse});
+  Format csc({Dense,Sparse}, {1,0});
+  for (auto& format : {Format({Dense,Dense}), CSR, csc, dcsr}) {
+    Tensor<double> expected({3,4}, format);
+    expected.insert({0,0}, 4.0);
+    expected.insert({0,3}, 2.0);
+    expected.insert({1,2}, 5.0);
+    expected.insert({2,1}, 1.0);
+    expected.pack();
+
+    Tensor<double> partial({3,4}, format);
+    partial.insert({0,3}, 2.0);
+    partial.insert({2,1}, 0.5);
+    partial.pack();
+
+    Tensor<double> a({3,4}, format);
+    a.insert({0,3}, 2.0);
+    a.insert({2,1}, 0.5);
+    a.pack();
+
+    // Packing incrementally without new coordinates keeps the components
+    a.packIncremental();
+    ASSERT_TRUE(equals(partial, a)) << format;
+
+    // New coordinates are merged with the packed components
+    a.insert({2,1}, 0.5);
+    a.insert({0,0}, 4.0);
+    a.insert({1,2}, 5.0);
+    a.packIncremental();
+    ASSERT_TRUE(equals(expected, a)) << format;
+
+    // New coordinates replace the packed components unless merged
+    a.insert({0,3}, 2.0);
+    a.insert({2,1}, 0.5);
+    a.pack();
+    ASSERT_TRUE(equals(partial, a)) << format;
+
+    // Packing without new coordinates leaves no components
+    Tensor<double> empty({3,4}, format);
+    empty.pack();
+    a.pack();
+    ASSERT_TRUE(equals(empty, a)) << format;
+  }
+
+  Tensor<double> s(1.0);
+  s.pack();
+  s.insert({}, 2.0);
+  s.insert({}, 3.0);
+  s.packIncremental();
+  ASSERT_EQ(6.0, s.begin()->second);
+  s.insert({}, 2.0);
+  s.pack();
+  ASSERT_EQ(2.0, s.begin()->second);
+}
+
+TEST(tensor, convert_unpacked) {
+  // Converting a tensor with new coordinates leaves them to its own pack
+  Tensor<double> a({3,4}, CSR);
+  a.insert({0,3}, 2.0);
+  a.insert({2,1}, 1.0);
+  TensorBase csc = convert(a, Format({Dense,Sparse}, {1,0}));
+  ASSERT_EQ(nullptr, a.getStorage().getValues().getData());
+
+  a.pack();
+  ASSERT_TRUE(equals(a, csc));
+}
+
+TEST(tensor, compare_unpacked) {
+  // Comparing tensors with new coordinates leaves them to their own pack
+  Tensor<double> a({3,4}, CSR);
+  Tensor<double> b({3,4}, Format({Dense,Sparse}, {1,0}));
+  a.insert({0,3}, 2.0);
+  b.insert({0,3}, 2.0);
+  ASSERT_TRUE(equals(a, b));
+  ASSERT_EQ(nullptr, a.getStorage().getValues().getData());
+  ASSERT_EQ(nullptr, b.getStorage().getValues().getData());
+
+  a.pack();
+  b.pack();
+  ASSERT_TRUE(equals(a, b));
+}
+
+TEST(tensor, convert) {
+  Format csc({Dense,Sparse}, {1,0});
+  Format dcsr({Sparse,Sparse});
+  Format dcsc({Sparse,Sparse}, {1,0});
+  vector<Format> formats = {Format({Dense,Dense}), CSR, csc, dcsr, dcsc};
+  auto makeMatrix = [](int rows, int cols, Format format) {
+    Tensor<double> tensor({rows,cols}, format);
+    for (int i = 0; i < rows; i++) {
+      for (int j = (i * 7) % 3; j < cols; j += 1 + i % 3) {
+        tensor.insert({i,j}, i + j / 1000.0);
+      }
+    }
+    tensor.pack();
+    return tensor;
+  };
+  vector<Tensor<double>> tensors;
+  for (auto& format : formats) {
+    tensors.push_back(makeMatrix(40, 30, format));
+  }
+
+  // Dense tensors are only converted to the dense format, since the zeros
+  // they store are kept
+  for (auto& tensor : tensors) {
+    bool isDense = (tensor.getFormat() == formats[0]);
+    for (size_t i = isDense ? 0 : 1; i < (isDense ? 1 : formats.size()); i++) {
+      TensorBase converted = convert(tensor, formats[i]);
+      ASSERT_EQ(formats[i], converted.getFormat());
+      ASSERT_TRUE(equals(tensors[i], converted))
+          << tensor.getFormat() << " to " << formats[i];
+    }
+  }
+
+  // Large enough to be transposed in parallel
+  int numThreads = getNumThreads();
+  setNumThreads(4);
+  ASSERT_TRUE(equals(makeMatrix(400, 300, csc),
+                     convert(makeMatrix(400, 300, CSR), csc)));
+  setNumThreads(numThreads);
+
+  Format sss({Sparse,Sparse,Sparse}, {2,0,1});
+  Tensor<double> a({3,4,5}, Format({Sparse,Dense,Sparse}));
+  Tensor<double> expected({3,4,5}, sss);
+  for (Tensor<double> tensor : {a, expected}) {
+    tensor.insert({0,1,4}, 1.0);
+    tensor.insert({2,3,0}, 2.0);
+    tensor.insert({2,0,4}, 3.0);
+    tensor.pack();
+  }
+  ASSERT_TRUE(equals(expected, convert(a, sss)));
+}
+
+TEST(tensor, for_each_nonzero) {
+  for (auto& format : {Format({Dense,Sparse,Dense}),
+                       Format({Sparse,Sparse,Sparse}, {2,0,1}),
+                       Format({Dense,Dense,Dense}, {1,2,0}),
+                       Format({Dense,Fixed,Sparse})}) {
+    Tensor<double> a({3,4,5}, format);
+    a.insert({0,1,4}, 1.0);
+    a.insert({2,3,0}, 2.0);
+    a.insert({2,0,4}, 3.0);
+    a.insert({2,0,1}, 4.0);
+    a.pack();
+
+    vector<pair<vector<int>,double>> expected;
+    for (auto& value : a) {
+      expected.push_back(value);
+    }
+    vector<pair<vector<int>,double>> actual;
+    forEachNonzero<double>(a, [&](const vector<int>& coordinate, double value) {
+      actual.push_back({coordinate, value});
+    });
+    ASSERT_EQ(expected, actual) << format;
+  }
+
+  Tensor<float> b(type<float>());
+  b.insert({}, 2.5f);
+  b.pack();
+  float sum = 0;
+  forEachNonzero<float>(b, [&](const vector<int>& coordinate, float value) {
+    ASSERT_TRUE(coordinate.empty());
+    sum += value;
+  });
+  ASSERT_EQ(2.5f, sum);
+}
+
+TEST(tensor, for_each_nonzero_orders) {
+  // Orders past the specialized ones are visited by the generic loop
+  for (auto& format : {Format({Sparse}), Format({Dense,Sparse}, {1,0}),
+                       Format({Dense,Sparse,Sparse,Dense})}) {
+    vector<int> dimensions(format.getOrder(), 3);
+    Tensor<double> a(dimensions, format);
+    for (int i = 0; i < 3; i++) {
+      a.insert(vector<int>(format.getOrder(), i), (double)i + 1.0);
+    }
+    a.pack();
+
+    vector<pair<vector<int>,double>> expected;
+    for (auto& value : a) {
+      expected.push_back(value);
+    }
+    vector<pair<vector<int>,double>> actual;
+    forEachNonzero<double>(a, [&](const vector<int>& coordinate, double value) {
+      actual.push_back({coordinate, value});
+    });
+    ASSERT_EQ(expected, actual) << format;
+  }
+}
+
+TEST(tensor, for_each_nonzero_speed) {
+  const int n = 1000;
+  Tensor<double> a({n,n}, CSR);
+  for (int i = 0; i < n; i++) {
+    for (int j = i % 2; j < n; j += 2) {
+      a.insert({i,j}, 1.0);
+    }
+  }
+  a.pack();
+
+  double iterateSum = 0.0;
+  auto start = chrono::steady_clock::now();
+  for (auto& value : iterate<double>(a)) {
+    iterateSum += value.second;
+  }
+  auto iterateTime = chrono::steady_clock::now() - start;
+
+  double forEachSum = 0.0;
+  start = chrono::steady_clock::now();
+  forEachNonzero<double>(a, [&](const vector<int>& coordinate, double value) {
+    forEachSum += value;
+  });
+  auto forEachTime = chrono::steady_clock::now() - start;
+
+  ASSERT_EQ(iterateSum, forEachSum);
+  ASSERT_LT(forEachTime, iterateTime);
+}
+
+TEST(tensor, compare) {
+  Format csc({Dense,Sparse}, {1,0});
+  auto insertComponents = [](Tensor<double>& tensor) {
+    tensor.insert({0,3}, 2.0);
+    tensor.insert({2,1}, NAN);
+    tensor.insert({2,3}, 4.0);
+  };
+  Tensor<double> a({3,4}, CSR);
+  insertComponents(a);
+  a.pack();
+  Tensor<double> b({3,4}, CSR);
+  insertComponents(b);
+  b.insert({2,3}, 1e-7);
+  b.pack();
+  Tensor<double> c({3,4}, csc);
+  insertComponents(c);
+  c.insert({1,1}, 0.0);
+  c.pack();
+
+  // NaNs are equal and tolerances are relative by default
+  TensorComparison ab = compare(a, b);
+  ASSERT_TRUE(ab.isEqual);
+  ASSERT_TRUE(ab.mismatch.empty());
+  ASSERT_NEAR(1e-7, ab.maxAbsError, 1e-12);
+  ASSERT_FALSE(compare(a, b, 0.0).isEqual);
+  ASSERT_EQ(vector<int>({2,3}), compare(a, b, 0.0).mismatch);
+  ASSERT_TRUE(compare(a, b, 0.0, 1e-6).isEqual);
+
+  // Tensors in different formats and with explicit zeros are compared by
+  // coordinate
+  ASSERT_TRUE(equals(a, c));
+  ASSERT_TRUE(equals(c, a));
+
+  Tensor<double> d({3,4}, csc);
+  d.insert({0,3}, 2.0);
+  d.insert({2,1}, 1.0);
+  d.insert({2,3}, 4.0);
+  d.insert({1,2}, 0.5);
+  d.pack();
+  TensorComparison ad = compare(a, d);
+  ASSERT_FALSE(ad.isEqual);
+  ASSERT_EQ(vector<int>({1,2}), ad.mismatch);
+  ASSERT_EQ(INFINITY, ad.maxAbsError);
+
+  // The first mismatch is in the storage order of the first tensor
+  ASSERT_EQ(vector<int>({2,1}), compare(d, c).mismatch);
+
+  ASSERT_FALSE(equals(a, Tensor<double>({4,3}, CSR)));
+}
+
+TEST(tensor, reuse_kernel) {
+  Tensor<double> B1({3,3}, CSR);
+  Tensor<double> c1({3}, Format({Dense}));
+  B1.insert({0,1}, 2.0);
+  B1.insert({2,2}, 3.0);
+  B1.pack();
+  c1.insert({1}, 4.0);
+  c1.insert({2}, 5.0);
+  c1.pack();
+
+  Tensor<double> B2({3,3}, CSR);
+  Tensor<double> c2({3}, Format({Dense}));
+  B2.insert({1,0}, 1.0);
+  B2.pack();
+  c2.insert({0}, 6.0);
+  c2.pack();
+
+  IndexVar i, j;
+  Tensor<double> a1({3}, Format({Dense}));
+  a1(i) = B1(i,j) * c1(j);
+  a1.evaluate();
+
+  Tensor<double> a2({3}, Format({Dense}));
+  a2(i) = B2(i,j) * c2(j);
+  a2.evaluate();
+
+  // The second tensor reuses the first tensor's kernel
+  ASSERT_EQ(a1.getSource(), a2.getSource());
+
+  Tensor<double> expected1({3}, Format({Dense}));
+  expected1.insert({0}, 8.0);
+  expected1.insert({2}, 15.0);
+  expected1.pack();
+  ASSERT_TRUE(equals(expected1, a1));
+
+  Tensor<double> expected2({3}, Format({Dense}));
+  expected2.insert({1}, 6.0);
+  expected2.pack();
+  ASSERT_TRUE(equals(expected2, a2));
+
+  // A different operand format needs a different kernel
+  Tensor<double> B3({3,3}, Dense);
+  B3.pack();
+  Tensor<double> a3({3}, Format({Dense}));
+  a3(i) = B3(i,j) * c1(j);
+  a3.compile();
+  ASSERT_NE(a1.getSource(), a3.getSource());
+}
+
+TEST(tensor, compile_async) {
+  Tensor<double> B({4,4}, CSR);
+  B.insert({0,0}, 1.0);
+  B.insert({1,3}, 2.0);
+  B.insert({3,2}, 3.0);
+  B.pack();
+
+  Tensor<double> C({4,4}, CSR);
+  C.insert({0,0}, 4.0);
+  C.insert({3,3}, 5.0);
+  C.pack();
+
+  IndexVar i, j;
+  Tensor<double> sum({4,4}, CSR);
+  sum(i,j) = B(i,j) + C(i,j);
+  Tensor<double> product({4,4}, CSR);
+  product(i,j) = B(i,j) * C(i,j);
+
+  std::shared_future<void> sumCompiled = sum.compileAsync();
+  std::shared_future<void> productCompiled = product.compileAsync();
+  productCompiled.wait();
+
+  sum.assemble();
+  sum.compute();
+  product.assemble();
+  product.compute();
+  ASSERT_TRUE(sumCompiled.valid());
+
+  Tensor<double> expectedSum({4,4}, CSR);
+  expectedSum.insert({0,0}, 5.0);
+  expectedSum.insert({1,3}, 2.0);
+  expectedSum.insert({3,2}, 3.0);
+  expectedSum.insert({3,3}, 5.0);
+  expectedSum.pack();
+  ASSERT_TRUE(equals(expectedSum, sum));
+
+  Tensor<double> expectedProduct({4,4}, CSR);
+  expectedProduct.insert({0,0}, 4.0);
+  expectedProduct.pack();
+  ASSERT_TRUE(equals(expectedProduct, product));
+}
+
+TEST(tensor, compile_batch) {
+  Tensor<double> B({3,3}, Format({Dense,Sparse}));
+  B.insert({0,1}, 1.0);
+  B.insert({2,2}, 2.0);
+  B.pack();
+
+  Tensor<double> c({3}, Format({Dense}));
+  c.insert({0}, 3.0);
+  c.insert({1}, 4.0);
+  c.insert({2}, 5.0);
+  c.pack();
+
+  IndexVar i, j;
+  Tensor<double> a({3}, Format({Dense}));
+  a(i) = B(i,j) * c(j);
+  Tensor<double> D({3,3}, Format({Dense,Sparse}));
+  D(i,j) = B(i,j) + B(i,j);
+  Tensor<double> E({3,3}, Format({Dense,Sparse}));
+  E(i,j) = B(i,j) + B(i,j);
+
+  compile({a, D, E});
+  a.assemble();
+  a.compute();
+  D.assemble();
+  D.compute();
+  E.assemble();
+  E.compute();
+
+  Tensor<double> expectedA({3}, Format({Dense}));
+  expectedA.insert({0}, 4.0);
+  expectedA.insert({2}, 10.0);
+  expectedA.pack();
+  ASSERT_TRUE(equals(expectedA, a));
+
+  Tensor<double> expectedD({3,3}, Format({Dense,Sparse}));
+  expectedD.insert({0,1}, 2.0);
+  expectedD.insert({2,2}, 4.0);
+  expectedD.pack();
+  ASSERT_TRUE(equals(expectedD, D));
+  ASSERT_TRUE(equals(expectedD, E));
+}
+
+TEST(tensor, compile_batch_async) {
+  Tensor<double> B({3,3}, Format({Dense,Sparse}));
+  B.insert({0,1}, 1.0);
+  B.insert({2,2}, 2.0);
+  B.pack();
+
+  IndexVar i, j;
+  Tensor<double> D({3,3}, Format({Dense,Sparse}));
+  D(i,j) = B(i,j) * B(i,j);
+  Tensor<double> e({3}, Format({Dense}));
+  e(i) = B(i,j);
+
+  // The future of a batch becomes ready without being waited for
+  shared_future<void> compiled = compileAsync({D, e});
+  auto start = chrono::steady_clock::now();
+  while (compiled.wait_for(chrono::seconds(0)) != future_status::ready) {
+    ASSERT_LT(chrono::steady_clock::now() - start, chrono::minutes(5));
+    this_thread::sleep_for(chrono::milliseconds(10));
+  }
+  D.assemble();
+  D.compute();
+  e.assemble();
+  e.compute();
+
+  Tensor<double> expectedD({3,3}, Format({Dense,Sparse}));
+  expectedD.insert({0,1}, 1.0);
+  expectedD.insert({2,2}, 4.0);
+  expectedD.pack();
+  ASSERT_TRUE(equals(expectedD, D));
+
+  Tensor<double> expectedE({3}, Format({Dense}));
+  expectedE.insert({0}, 1.0);
+  expectedE.insert({2}, 2.0);
+  expectedE.pack();
+  ASSERT_TRUE(equals(expectedE, e));
+}
+
+TEST(tensor, static_library) {
+  Tensor<double> B({3,3}, Format({Dense,Sparse}));
+  B.insert({0,0}, 1.0);
+  B.insert({1,2}, 2.0);
+  B.pack();
+
+  Tensor<double> c({3}, Format({Dense}));
+  c.insert({0}, 3.0);
+  c.insert({2}, 4.0);
+  c.pack();
+
+  IndexVar i, j;
+  Tensor<double> a({3}, Format({Dense}));
+  a(i) = B(i,j) * c(j);
+
+  string tmpdir = util::getTmpdir();
+  compileToStaticLibrary(tmpdir, "static_library_test", {a});
+
+  // Load the library the way a program that links it would see it. The
+  // kernels need the OpenMP runtime if the compiler supports it.
+  string cmd = "cc -shared -o " + tmpdir + "static_library_test.so " +
+               "-Wl,--whole-archive " + tmpdir + "static_library_test.a " +
+               "-Wl,--no-whole-archive";
+  cmd = cmd + " -fopenmp 2> /dev/null || " + cmd;
+  ASSERT_EQ(0, system(cmd.c_str()));
+  void* lib = dlopen((tmpdir + "static_library_test.so").c_str(), RTLD_NOW);
+  ASSERT_NE(nullptr, lib);
+
+  typedef int (*fnptr_t)(void**);
+  fnptr_t assemble, compute;
+  *reinterpret_cast<void**>(&assemble) =
+      dlsym(lib, "_shim_static_library_test_assemble0");
+  *reinterpret_cast<void**>(&compute) =
+      dlsym(lib, "_shim_static_library_test_compute0");
+  ASSERT_NE(nullptr, assemble);
+  ASSERT_NE(nullptr, compute);
+
+  Tensor<double> d({3}, Format({Dense}));
+  d(i) = B(i,j) * c(j);
+  d.bindPrecompiled(assemble, compute);
+  d.assemble();
+  d.compute();
+
+  Tensor<double> expected({3}, Format({Dense}));
+  expected.insert({0}, 3.0);
+  expected.insert({1}, 8.0);
+  expected.pack();
+  ASSERT_TRUE(equals(expected, d));
+}
+
+TEST(tensor, kernel) {
+  Format csr({Dense,Sparse});
+  Format dv({Dense});
+
+  IndexVar i, j;
+  Tensor<double> B("B", {32,32}, csr);
+  Tensor<double> c("c", {32}, dv);
+  Tensor<double> a("a", {32}, dv);
+  a(i) = B(i,j) * c(j) + c(i);
+
+  Kernel kernel(a);
+  ASSERT_TRUE(kernel.defined());
+  ASSERT_EQ(2u, kernel.getNumOperands());
+
+  for (int n = 20; n < 100; n *= 2) {
+    Tensor<double> Bn({n,n}, csr);
+    Tensor<double> cn({n}, dv);
+    Tensor<double> expected({n}, dv);
+    for (int k = 0; k < n; k++) {
+      Bn.insert({k,n-1}, (double)k);
+      cn.insert({k}, 1.0);
+      expected.insert({k}, (double)k + 1.0);
+    }
+    Bn.pack();
+    cn.pack();
+    expected.pack();
+
+    Tensor<double> an({n}, dv);
+    kernel.evaluate(an, {Bn, cn});
+    ASSERT_TRUE(equals(expected, an));
+  }
+}
+
+TEST(tensor, kernel_concurrent_calls) {
+  Format csr({Dense,Sparse});
+  Format dv({Dense});
+
+  IndexVar i, j;
+  Tensor<double> B({64,64}, csr);
+  Tensor<double> c({64}, dv);
+  for (int k = 0; k < 64; k++) {
+    B.insert({k,63-k}, (double)k);
+    c.insert({k}, 1.0);
+  }
+  B.pack();
+  c.pack();
+
+  Tensor<double> a({64}, dv);
+  a(i) = B(i,j) * c(j);
+  Kernel kernel(a);
+
+  // Calls that share their operands run concurrently
+  vector<Tensor<double>> results;
+  for (int t = 0; t < 4; t++) {
+    results.push_back(Tensor<double>({64}, dv));
+  }
+  vector<thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.push_back(thread([&, t]() {
+      for (int k = 0; k < 50; k++) {
+        kernel.evaluate(results[t], {B, c});
+      }
+    }));
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  Tensor<double> expected({64}, dv);
+  for (int k = 0; k < 64; k++) {
+    expected.insert({k}, (double)k);
+  }
+  expected.pack();
+  for (auto& result : results) {
+    ASSERT_TRUE(equals(expected, result));
+  }
+}
+
+TEST(tensor, repeated_compute) {
+  Tensor<double> B({3,3}, Format({Dense,Sparse}));
+  B.insert({0,2}, 2.0);
+  B.insert({2,1}, 3.0);
+  B.pack();
+
+  IndexVar i, j;
+  Tensor<double> A({3,3}, Format({Dense,Sparse}));
+  A(i,j) = B(i,j) * B(i,j);
+  A.compile();
+  A.assemble();
+
+  taco_tensor_t* descriptor = B.getTacoTensorT();
+  for (int k = 0; k < 3; k++) {
+    A.compute();
+    ASSERT_EQ(descriptor, B.getTacoTensorT());
+  }
+
+  Tensor<double> expected({3,3}, Format({Dense,Sparse}));
+  expected.insert({0,2}, 4.0);
+  expected.insert({2,1}, 9.0);
+  expected.pack();
+  ASSERT_TRUE(equals(expected, A));
+}